@@ -26,6 +26,7 @@ limitations under the License.
 #include <QApplication>
 #include <QDebug>
 #include <QFileInfo>
+#include <QList>
 
 //QtImageViewer includes
 #include "QtGlSliceView.h"
@@ -63,15 +64,31 @@ int parseAndExecImageViewer(int argc, char* argv[])
   QtImageViewer viewer( 0 );
   viewer.setWindowTitle("ImageViewer");
 
+  // Before loading so that the readers follow the settings.
+  QList<int> cpus;
+  for(size_t i = 0; i < affinity.size(); ++i)
+    {
+    cpus << affinity[i];
+    }
+  viewer.setThreadAffinity(cpus);
+  viewer.setMaxThreadCount(threads);
+  viewer.setAdaptiveThreadCount(adaptiveThreads);
+
   QString filePathToLoad;
   filePathToLoad = QString::fromStdString(inputImage);
 
   viewer.loadInputImage(filePathToLoad);
 
+  viewer.setLazyOverlayLoading(lazyOverlays);
+  viewer.setOverlayCacheSize(overlayCacheSize);
   if(!overlayImage.empty())
     {
     viewer.loadOverlayImage(QString::fromStdString(overlayImage));
     }
+  for(size_t i = 0; i < extraOverlayImages.size(); ++i)
+    {
+    viewer.addOverlayImage(QString::fromStdString(extraOverlayImages[i]));
+    }
   viewer.sliceView()->setOrientation(orientation);
   if(sliceOffset != -1)
     {
@@ -91,7 +108,11 @@ int parseAndExecImageViewer(int argc, char* argv[])
   viewer.sliceView()->flipZ(zFlipped);
   viewer.sliceView()->flipY(yFlipped);
   viewer.sliceView()->flipX(xFlipped);
-  viewer.sliceView()->setOverlayOpacity(overlayOpacity);
+  for(int i = 0; i < viewer.sliceView()->overlayLayerCount(); ++i)
+    {
+    viewer.sliceView()->setOverlayLayerOpacity(i, overlayOpacity);
+    }
+  viewer.sliceView()->setOverlayMode(overlayMode.c_str());
   viewer.sliceView()->setViewCrosshairs(crosshairs);
   viewer.sliceView()->setDisplayState(details);
   viewer.sliceView()->setViewValuePhysicalUnits(physicalUnits);
@@ -101,6 +122,7 @@ int parseAndExecImageViewer(int argc, char* argv[])
   viewer.sliceView()->setImageMode(imageMode.c_str());
   viewer.sliceView()->setIWModeMax(iwModeMax.c_str());
   viewer.sliceView()->setIWModeMin(iwModeMin.c_str());
+  viewer.sliceView()->setShaderWindowing(!cpuWindowing);
   viewer.sliceView()->update();
 
   viewer.show();
@@ -26,20 +26,32 @@ limitations under the License.
 
 //QtImageViewer include
 #include "QtGlSliceView.h"
+#include "QtOverlayAnalysis.h"
+#include "QtOverlayEditHistory.h"
+#include "QtOverlayLayer.h"
+#include "QtRegionGrowing.h"
+#include "QtSliceRenderer.h"
+#include "QtSliceShader.h"
+#include "QtSliceTexture.h"
+#include "QtTaskScheduler.h"
 #include "ui_QtImageViewerHelp.h"
 
 //itk include
 #include "itkMinimumMaximumImageCalculator.h"
+#include "itkMultiThreader.h"
 
 //std includes
+#include <algorithm>
 #include <cmath>
 
 // Qt includes
 #include <QDebug>
 #include <QFile>
 #include <QFileDialog>
+#include <QGLFramebufferObject>
 #include <QKeyEvent>
 #include <QMouseEvent>
+#include <QMutexLocker>
 #include <QScrollArea>
 
 QtGlSliceView::QtGlSliceView(QWidget* widgetParent)
@@ -50,7 +62,8 @@ QtGlSliceView::QtGlSliceView(QWidget* widgetParent)
   cValidOverlayData     = false;
   cSingleStep           = 1.0;
   cViewOverlayData      = false;
-  cOverlayOpacity       = 0.0;
+  cOverlayMode          = OVERLAY_FILLED;
+  cCurrentOverlayLayer  = -1;
   cWinOverlayData       = NULL;
   cHelpDialog = 0;
   cViewValuePhysicalUnits = false;
@@ -59,6 +72,17 @@ QtGlSliceView::QtGlSliceView(QWidget* widgetParent)
   cViewCrosshairs = true;
   cViewValue = true;
   cClickMode = CM_SELECT;
+  cPaintLabel = 1;
+  cPaintRadius = 3;
+  cPainting = false;
+  cPaintValue = 0;
+  cGrowMin = 1.;
+  cGrowMax = 0.;
+  cGrowPreview = false;
+  cGrowPending = false;
+  cGrowPreviewQueued = false;
+  cGrowFirst.Fill(0);
+  cGrowLast.Fill(-1);
 
   cWinOrientationCallBack = NULL;
   cWinOrientationArg = NULL;
@@ -126,6 +150,7 @@ QtGlSliceView::QtGlSliceView(QWidget* widgetParent)
     cWinOrder[i] = 0;
     cWinCenter[i] = 0;
     cClickSelect[i] = 0;
+    cPaintLast[i] = 0;
     }
   cWinOrder[0] = 0;
   cWinOrder[1] = 1;
@@ -143,9 +168,74 @@ QtGlSliceView::QtGlSliceView(QWidget* widgetParent)
   inDataSizeY = 0;
   cWinImData = NULL;
   cWinZBuffer = NULL;
+  cWinValueData = NULL;
+  cWinImBackData = NULL;
+  cWinValueBackData = NULL;
+  cWinOverlayBackData = NULL;
+  cWinZBackBuffer = NULL;
+  cWinFrameData = NULL;
+  cWinFrameBackData = NULL;
+  cWinTexture = new QtSliceTexture;
+  cWinValueFrame = false;
+  cWinValueMode = IMG_VAL;
+  cWinValueOffset = 0;
+  cWinValueScale = 1;
+  cWinValueOverlay = false;
+  cWinShader = new QtSliceShader;
+  cTextAtlas = new QtGlyphAtlas;
+  cLabelAtlas = new QtGlyphAtlas;
+  cBaseLayer = NULL;
+  cBaseLayerModified = true;
+  cRenderPending = false;
+  cFrameScheduled = false;
+  cRenderedFrames = 0;
+  cPaintedFrames = 0;
+  cDisplayedFrames = 0;
+  cOverwrittenFrames = 0;
+  cWinFrameNumber = 0;
+  cDisplayedFrameNumber = 0;
+  cSliceStepPending = false;
+  cSliceStepTarget = 0;
+  cHoverPending = false;
+  cWinValueMinX = 0;
+  cWinValueMinY = 0;
+  cWinValueAxis = 0;
+  cWinValueSlice = 0;
+  cClickedPointsModified = true;
+  cClickedPointsSlice = 0;
+  cClickedPointsAxis = 0;
+  cShaderWindowing = true;
+  cShaderSupported = false;
   cfastMovVal = 1; //fast moving pace: 1 by defaut
   cfastMovThresh = 10; //how many single step moves before fast moving
 
+  cOverlayHistory = new QtOverlayEditHistory;
+  cOverlayAnalysis = new QtOverlayAnalysis;
+  cOverlayAnalysisPending = false;
+  cOverlayAnalysisRequest = 0;
+  cSaveOverlayStatistics = false;
+  cDetailsModified = true;
+  cDetailLabelsModified = true;
+  for (int i = 0; i < 17; ++i)
+    {
+    cDetailsKey[i] = 0;
+    }
+  for (int i = 0; i < 5; ++i)
+    {
+    cValueKey[i] = 0;
+    }
+  QObject::connect(cOverlayAnalysis, SIGNAL(analyzed(int, QString)),
+                   this, SLOT(onOverlayAnalyzed(int, QString)),
+                   Qt::QueuedConnection);
+  cRegionGrowing = new QtRegionGrowing;
+  QObject::connect(cRegionGrowing, SIGNAL(regionGrown()),
+                   this, SLOT(onRegionGrown()));
+  cRenderer = new QtSliceRenderer(this);
+  QObject::connect(cRenderer, SIGNAL(sliceRendered()),
+                   this, SLOT(onSliceRendered()));
+  QObject::connect(cRenderer, SIGNAL(idle()),
+                   this, SLOT(onRendererIdle()));
+
   QSizePolicy sP = this->sizePolicy();
   sP.setHeightForWidth(true);
   this->setSizePolicy(sP);
@@ -153,6 +243,39 @@ QtGlSliceView::QtGlSliceView(QWidget* widgetParent)
 }
 
 
+QtGlSliceView::~QtGlSliceView()
+{
+  // Stop the renderer before releasing the buffers it writes into.
+  delete cRenderer;
+  cRenderer = NULL;
+  delete cRegionGrowing;
+  delete cOverlayHistory;
+  // The GL objects belong to the context of the view.
+  this->makeCurrent();
+  cWinTexture->release();
+  delete cWinTexture;
+  cWinShader->release();
+  delete cWinShader;
+  cTextAtlas->release();
+  delete cTextAtlas;
+  cLabelAtlas->release();
+  delete cLabelAtlas;
+  delete cBaseLayer;
+  delete cOverlayAnalysis;
+
+  delete [] cWinImData;
+  delete [] cWinOverlayData;
+  delete [] cWinZBuffer;
+  delete [] cWinImBackData;
+  delete [] cWinOverlayBackData;
+  delete [] cWinZBackBuffer;
+  delete [] cWinFrameData;
+  delete [] cWinFrameBackData;
+  delete [] cWinValueData;
+  delete [] cWinValueBackData;
+}
+
+
 void
 QtGlSliceView::
 setInputImage(ImageType * newImData)
@@ -169,10 +292,10 @@ setInputImage(ImageType * newImData)
     }
 
   SizeType myImageSize = region.GetSize();
-  if (cValidOverlayData)
+  this->finishRegionGrowing();
+  foreach (const OverlayLayerType& overlay, cOverlayLayers)
     {
-    RegionType overlayRegion = cOverlayData->GetLargestPossibleRegion();
-    SizeType   overlaySize   = overlayRegion.GetSize();
+    QtOverlayLayer::SizeType overlaySize = overlay.Layer->size();
 
     for (int i=0; i<3; i++)
       {
@@ -217,19 +340,7 @@ setInputImage(ImageType * newImData)
   cWinDataSizeX = cDimSize[0];
   cWinDataSizeY = cDimSize[1];
 
-  if (cWinImData != NULL)
-    {
-    delete [] cWinImData;
-    }
-
-  cWinImData = new unsigned char[ cWinDataSizeX * cWinDataSizeY ];
-
-  if (cWinZBuffer != NULL)
-    {
-    delete [] cWinZBuffer;
-    }
-
-  cWinZBuffer = new unsigned short[ cWinDataSizeX * cWinDataSizeY ];
+  this->allocateWinData();
   this->changeSlice(((this->maxSliceNum() -1)/2));
   this->updateGeometry();
   this->update();
@@ -249,41 +360,332 @@ void
 QtGlSliceView
 ::setInputOverlay(OverlayType * newOverlayData)
 {
-  RegionType newoverlay_region = newOverlayData->GetLargestPossibleRegion();
+  this->setOverlayLayer(new QtLabel8OverlayLayer(newOverlayData));
+}
+
+
+void QtGlSliceView::setInputOverlay(Label16OverlayType * newOverlayData)
+{
+  this->setOverlayLayer(new QtLabel16OverlayLayer(newOverlayData));
+}
+
+
+void QtGlSliceView::setInputOverlay(RGBOverlayType * newOverlayData)
+{
+  this->setOverlayLayer(new QtRGBOverlayLayer(newOverlayData));
+}
 
-  SizeType newoverlay_size = newoverlay_region.GetSize();
 
-  RegionType cImData_region = cImData->GetLargestPossibleRegion();
+void QtGlSliceView::setInputOverlay(RGBAOverlayType * newOverlayData)
+{
+  this->setOverlayLayer(new QtRGBAOverlayLayer(newOverlayData));
+}
 
-  SizeType cImData_size = cImData_region.GetSize();
 
-  if (!cValidImData || newoverlay_size[2]==cImData_size[2])
+void QtGlSliceView::setOverlayLayer(QtOverlayLayer * newOverlayLayer)
+{
+  if (cOverlayLayers.isEmpty())
     {
-    cOverlayData = newOverlayData;
+    this->addOverlayLayer(newOverlayLayer);
+    return;
+    }
+  const int current = cCurrentOverlayLayer;
+  if (this->addOverlayLayer(newOverlayLayer) >= 0)
+    {
+    // Take the place of the current layer, with its colors.
+    OverlayLayerType overlay = cOverlayLayers.takeLast();
+    overlay.ColorTable = cOverlayLayers[current].ColorTable;
+    // The strokes may have edited the replaced layer.
+    this->finishRegionGrowing();
+    cOverlayHistory->clear();
+    this->clearOverlayStatistics();
+    cOverlayLayers[current] = overlay;
+    this->setCurrentOverlayLayer(current);
+    update();
+    }
+}
 
-    cViewOverlayData  = true;
-    cValidOverlayData = true;
-    cOverlayOpacity   = 1.0;
 
-    if(cWinOverlayData != NULL) 
-      {
-      delete [] cWinOverlayData;
-      }
+int QtGlSliceView::addOverlayLayer(QtOverlayLayer * newOverlayLayer)
+{
+  QSharedPointer<QtOverlayLayer> layer(newOverlayLayer);
+  QtOverlayLayer::SizeType newoverlay_size = layer->size();
 
-    cWinOverlayData = new unsigned char[ cWinDataSizeX * cWinDataSizeY * 4 ];
+  // The layers are sampled with the indices of the image. Without an
+  // image, setInputImage() checks them.
+  if (cValidImData && cImData)
+    {
+    RegionType cImData_region = cImData->GetLargestPossibleRegion();
+
+    SizeType cImData_size = cImData_region.GetSize();
 
-    if (cWinZBuffer != NULL)
+    for (int i = 0; i < 3; i++)
       {
-      delete [] cWinZBuffer;
+      if (newoverlay_size[i] != cImData_size[i])
+        {
+        qWarning()<<"Overlay path invalid, make sure both images have the same size.";
+        return -1;
+        }
       }
-    cWinZBuffer = new unsigned short[cWinDataSizeX * cWinDataSizeY * 4];
+    }
+
+  OverlayLayerType overlay;
+  overlay.Layer = layer;
+  overlay.ColorTable = cColorTable;
+  if (!cOverlayLayers.isEmpty())
+    {
+    overlay.ColorTable = ColorTableType::New();
+    overlay.ColorTable->UseDiscreteColors();
+    }
+  overlay.Opacity = 1.0;
+  overlay.Visible = true;
+  overlay.LUTMTime = 0;
+  overlay.LUTOpacity = -1.0;
+  cOverlayLayers.append(overlay);
+
+  cViewOverlayData  = true;
+  if (!cValidOverlayData)
+    {
+    cValidOverlayData = true;
+    this->allocateWinData();
     emit validOverlayDataChanged(cValidOverlayData);
-    update();
     }
-  else
+  this->setCurrentOverlayLayer(cOverlayLayers.size() - 1);
+  update();
+  return cOverlayLayers.size() - 1;
+}
+
+
+void QtGlSliceView::removeOverlayLayer(int index)
+{
+  if (index < 0 || index >= cOverlayLayers.size())
+    {
+    return;
+    }
+  this->finishRegionGrowing();
+  cOverlayLayers.removeAt(index);
+  cOverlayHistory->clear();
+  this->clearOverlayStatistics();
+  if (cOverlayLayers.isEmpty())
+    {
+    cValidOverlayData = false;
+    this->allocateWinData();
+    emit validOverlayDataChanged(cValidOverlayData);
+    }
+  this->setCurrentOverlayLayer(qMin(cCurrentOverlayLayer,
+                                    cOverlayLayers.size() - 1));
+  update();
+}
+
+
+int QtGlSliceView::overlayLayerCount() const
+{
+  return cOverlayLayers.size();
+}
+
+
+QtOverlayLayer* QtGlSliceView::overlayLayer(int index) const
+{
+  if (index < 0 || index >= cOverlayLayers.size())
+    {
+    return NULL;
+    }
+  return cOverlayLayers[index].Layer.data();
+}
+
+
+int QtGlSliceView::currentOverlayLayer() const
+{
+  return cCurrentOverlayLayer;
+}
+
+
+void QtGlSliceView::setCurrentOverlayLayer(int index)
+{
+  if (index < 0 || index >= cOverlayLayers.size())
+    {
+    index = cOverlayLayers.isEmpty() ? -1 : cCurrentOverlayLayer;
+    }
+  cCurrentOverlayLayer = index;
+  QtLabel8OverlayLayer* label8Layer =
+    dynamic_cast<QtLabel8OverlayLayer*>(this->overlayLayer(index));
+  cOverlayData = label8Layer ? label8Layer->overlayImage() : NULL;
+  emit currentOverlayLayerChanged(cCurrentOverlayLayer);
+  emit overlayOpacityChanged(this->overlayOpacity());
+}
+
+
+double QtGlSliceView::overlayLayerOpacity(int index) const
+{
+  if (index < 0 || index >= cOverlayLayers.size())
+    {
+    return 0.0;
+    }
+  return cOverlayLayers[index].Opacity;
+}
+
+
+void QtGlSliceView::setOverlayLayerOpacity(int index, double opacity)
+{
+  if (index < 0 || index >= cOverlayLayers.size())
+    {
+    return;
+    }
+  cOverlayLayers[index].Opacity = qBound(0., opacity, 1.);
+  if (index == cCurrentOverlayLayer)
+    {
+    emit overlayOpacityChanged(cOverlayLayers[index].Opacity);
+    }
+  this->updateOverlay();
+}
+
+
+bool QtGlSliceView::isOverlayLayerVisible(int index) const
+{
+  if (index < 0 || index >= cOverlayLayers.size())
+    {
+    return false;
+    }
+  return cOverlayLayers[index].Visible;
+}
+
+
+void QtGlSliceView::setOverlayLayerVisible(int index, bool visible)
+{
+  if (index < 0 || index >= cOverlayLayers.size() ||
+      cOverlayLayers[index].Visible == visible)
+    {
+    return;
+    }
+  cOverlayLayers[index].Visible = visible;
+  this->updateOverlay();
+}
+
+
+bool QtGlSliceView::isLabelVisible(int label) const
+{
+  if (cCurrentOverlayLayer < 0 || label <= 0)
+    {
+    return false;
+    }
+  const QVector<bool>& hidden = cOverlayLayers[cCurrentOverlayLayer].HiddenLabels;
+  return label >= hidden.size() || !hidden[label];
+}
+
+
+void QtGlSliceView::setLabelVisible(int label, bool visible)
+{
+  if (cCurrentOverlayLayer < 0 || label <= 0 ||
+      this->isLabelVisible(label) == visible)
+    {
+    return;
+    }
+  OverlayLayerType& overlay = cOverlayLayers[cCurrentOverlayLayer];
+  if (label >= overlay.HiddenLabels.size())
+    {
+    overlay.HiddenLabels.resize(label + 1);
+    }
+  overlay.HiddenLabels[label] = !visible;
+  overlay.LUTMTime = 0;
+  this->updateOverlay();
+  emit labelsChanged();
+}
+
+
+QColor QtGlSliceView::labelColor(int label) const
+{
+  if (cCurrentOverlayLayer < 0 || label <= 0)
+    {
+    return QColor();
+    }
+  const OverlayLayerType& overlay = cOverlayLayers[cCurrentOverlayLayer];
+  if (overlay.LabelColors.contains(label))
     {
-    qWarning()<<"Overlay path invalid, make sure both images have the same size.";
+    return overlay.LabelColors.value(label);
     }
+  // The discrete colors are cycled through for labels past the table.
+  const unsigned int c =
+    (label-1) % overlay.ColorTable->GetNumberOfColors();
+  return QColor::fromRgbF(overlay.ColorTable->GetColor(c).GetRed(),
+                          overlay.ColorTable->GetColor(c).GetGreen(),
+                          overlay.ColorTable->GetColor(c).GetBlue());
+}
+
+
+void QtGlSliceView::setLabelColor(int label, const QColor& color)
+{
+  if (cCurrentOverlayLayer < 0 || label <= 0 || !color.isValid())
+    {
+    return;
+    }
+  OverlayLayerType& overlay = cOverlayLayers[cCurrentOverlayLayer];
+  overlay.LabelColors.insert(label, color);
+  overlay.LUTMTime = 0;
+  this->updateOverlay();
+  emit labelsChanged();
+}
+
+
+void QtGlSliceView::isolateLabel(int label)
+{
+  if (cCurrentOverlayLayer < 0 || label <= 0)
+    {
+    return;
+    }
+  OverlayLayerType& overlay = cOverlayLayers[cCurrentOverlayLayer];
+  int labelCount = qMax(label + 1,
+    static_cast<int>(overlay.Layer->labelCount()));
+  // The labels of the slabs not read yet are hidden too.
+  if (dynamic_cast<QtStreamedOverlayLayer*>(overlay.Layer.data()))
+    {
+    labelCount = qMax(labelCount, 65536);
+    }
+  overlay.HiddenLabels.fill(true, labelCount);
+  overlay.HiddenLabels[label] = false;
+  overlay.LUTMTime = 0;
+  this->updateOverlay();
+  emit labelsChanged();
+}
+
+
+void QtGlSliceView::showAllLabels()
+{
+  if (cCurrentOverlayLayer < 0)
+    {
+    return;
+    }
+  OverlayLayerType& overlay = cOverlayLayers[cCurrentOverlayLayer];
+  overlay.HiddenLabels.clear();
+  overlay.LUTMTime = 0;
+  this->updateOverlay();
+  emit labelsChanged();
+}
+
+
+int QtGlSliceView::clickedLabel() const
+{
+  QtOverlayLayer* layer = this->overlayLayer();
+  if (!layer || !layer->isLabelMap())
+    {
+    return 0;
+    }
+  QtOverlayLayer::IndexType index;
+  for (int i = 0; i < 3; ++i)
+    {
+    index[i] = static_cast<itk::IndexValueType>(cClickSelect[i]);
+    }
+  return static_cast<int>(layer->valueAt(index));
+}
+
+
+QtGlSliceView::ColorTableType*
+QtGlSliceView::overlayColorTable(int index) const
+{
+  if (index < 0 || index >= cOverlayLayers.size())
+    {
+    return NULL;
+    }
+  return cOverlayLayers[index].ColorTable.GetPointer();
 }
 
 
@@ -294,12 +696,18 @@ QtGlSliceView::inputOverlay(void) const
 }
 
 
+QtOverlayLayer* QtGlSliceView::overlayLayer() const
+{
+  return this->overlayLayer(cCurrentOverlayLayer);
+}
+
+
 void 
 QtGlSliceView::
 setViewOverlayData(bool newViewOverlayData)
 {
   cViewOverlayData = newViewOverlayData;
-  paintGL();
+  this->updateOverlay();
 }
 
 
@@ -313,22 +721,54 @@ QtGlSliceView::viewOverlayData(void) const
 void 
 QtGlSliceView::setOverlayOpacity(double newOverlayOpacity)
 {
-  cOverlayOpacity = qBound(0., newOverlayOpacity, 1.);
-  emit overlayOpacityChanged(cOverlayOpacity);
-  update();
+  this->setOverlayLayerOpacity(cCurrentOverlayLayer, newOverlayOpacity);
 }
 
 
 double
 QtGlSliceView::overlayOpacity(void) const
 {
-  return cOverlayOpacity;
+  return this->overlayLayerOpacity(cCurrentOverlayLayer);
+}
+
+
+void QtGlSliceView::setOverlayMode(OverlayModeType newOverlayMode)
+{
+  if(newOverlayMode == cOverlayMode)
+    {
+    return;
+    }
+  cOverlayMode = newOverlayMode;
+  this->updateOverlay();
+}
+
+
+void QtGlSliceView::setOverlayMode(const char* newOverlayMode)
+{
+  for (int i = 0; i < NUM_OverlayModeTypes; ++i)
+    {
+    if (QString(newOverlayMode) == QString(OverlayModeTypeName[i]))
+      {
+      this->setOverlayMode(static_cast<OverlayModeType>(i));
+      break;
+      }
+    }
+}
+
+
+OverlayModeType QtGlSliceView::overlayMode(void) const
+{
+  return cOverlayMode;
 }
 
 
 QtGlSliceView::ColorTableType* QtGlSliceView::colorTable(void) const
 {
-  return cColorTable.GetPointer();
+  if (cCurrentOverlayLayer < 0)
+    {
+    return cColorTable.GetPointer();
+    }
+  return this->overlayColorTable(cCurrentOverlayLayer);
 }
 
 
@@ -398,269 +838,422 @@ QtGlSliceView::update()
     cWinMaxY = cDimSize[ cWinOrder[1] ] - 1;
     }
   
-  memset(cWinImData, 0, cWinDataSizeX*cWinDataSizeY);
-  if(cValidOverlayData)
+  if(!cImData || cWinImData == NULL)
     {
-    memset(cWinOverlayData, 0, cWinDataSizeX*cWinDataSizeY*4);
-    }
-  
-  IndexType ind;
-  
-  int l, m;
-  
-  double tf;
-  
-  ind[ cWinOrder[ 2 ] ] = cWinCenter[ cWinOrder[ 2 ] ];
-  int startK = cWinMinY;
-  if(startK<0)
-    startK = 0;
-  int startJ = cWinMinX;
-  if(startJ<0)
-    startJ = 0;
-  for(int k=startK; k <= cWinMaxY; k++)
-    {
-    ind[cWinOrder[1]] = k;
-    
-    if(k-cWinMinY >= (int)cWinDataSizeY)
-      continue;
-
-    for(int j=startJ; j <= cWinMaxX; j++) 
-      {
-      ind[cWinOrder[0]] = j;
-      
-      if(j-cWinMinX >= (int)cWinDataSizeX)
-         continue;
-
-      switch(cImageMode)
-        {
-        default:
-        case IMG_VAL:
-          tf = (double)((cImData->GetPixel(ind)-cIWMin)/(cIWMax-cIWMin)*255);
-          break;
-        case IMG_INV:
-          tf = (double)((cIWMax-cImData->GetPixel(ind))/(cIWMax-cIWMin)*255);
-          break;
-        case IMG_LOG:
-          tf = (double)(log(cImData->GetPixel(ind)-cIWMin+0.00000001)
-            /log(cIWMax-cIWMin+0.00000001)*255);
-          break;
-        case IMG_DX:
-          if(ind[0]>0) 
-            {
-            tf = (double)((cImData->GetPixel(ind)-cIWMin)/(cIWMax-cIWMin)*255);
-            ind[0]--;
-            tf -= (double)((cImData->GetPixel(ind)-cIWMin)/(cIWMax-cIWMin)*255);
-            ind[0]++;
-            tf += 128;
-            }
-          else
-            {
-            tf = 128;
-            }
-          break;
-        case IMG_DY:
-          if(ind[1]>0) 
-            {
-            tf = (double)((cImData->GetPixel(ind)-cIWMin)/(cIWMax-cIWMin)*255);
-            ind[1]--;
-            tf -= (double)((cImData->GetPixel(ind)-cIWMin)/(cIWMax-cIWMin)*255);
-            ind[1]++;
-            tf += 128;
-            }
-          else
-            {
-            tf = 128;
-            }
-          break;
-        case IMG_DZ:
-          if(ind[2]>0) 
-            {
-            tf = (double)((cImData->GetPixel(ind)-cIWMin)/(cIWMax-cIWMin)*255);
-            ind[2]--;
-            tf -= (double)((cImData->GetPixel(ind)-cIWMin)/(cIWMax-cIWMin)*255);
-            ind[2]++;
-            tf += 128;
-            }
-          else
-            {
-            tf = 128;
-            }
-          break;
-        case IMG_BLEND:
-          {
-          const int tempval = (int)cWinCenter[cWinOrder[2]]-1;
-          int tmpI = ind[cWinOrder[2]];
-          ind[cWinOrder[2]] = (tempval < 0) ? 0 : tempval;
-          tf = (double)(cImData->GetPixel(ind));
-          
-          ind[cWinOrder[2]] = cWinCenter[cWinOrder[2]];
-          tf += (double)(cImData->GetPixel(ind))*2;
-          
-          const int tempval1 = (int)cDimSize[cWinOrder[2]]-1;
-          const int tempval2 = (int)cWinCenter[cWinOrder[2]]+1;
-          ind[cWinOrder[2]] = (tempval1 < tempval2) ? tempval1 : tempval2;
-          tf += (double)(cImData->GetPixel(ind));
-          
-          tf = (double)((tf/4-cIWMin)/(cIWMax-cIWMin)*255);
-          ind[cWinOrder[2]] = tmpI;
-          break;
-          }
-        case IMG_MIP:
-          tf = cIWMin;
-          m = (j-cWinMinX) + (k-cWinMinY)*cWinDataSizeX;
-          cWinZBuffer[m] = 0;
-          int tmpI = ind[cWinOrder[2]];
-          for(l=0; l<(int)cDimSize[cWinOrder[2]]; l++) 
-            {
-            ind[cWinOrder[2]] = l;        
-            if(cImData->GetPixel(ind) > tf) 
-              {
-              tf = (double)(cImData->GetPixel(ind));
-              cWinZBuffer[m] = (unsigned short)l;
-              }
-            }
-          tf = (double)((tf-cIWMin)/(cIWMax-cIWMin)*255);
-          ind[cWinOrder[2]] = tmpI;
-          break;
-          }
-      
-      if(tf > 255)
-        {
-        switch(cIWModeMax) 
-          {
-          case IW_MIN:
-            tf = 0;
-            break;
-          default:
-          case IW_MAX:
-            tf = 255;
-            break;
-          case IW_FLIP:
-            tf = 512-tf;
-            if(tf<0) 
-              {
-              tf = 0;
-              }
-            break;
-          }
-        }
-      else 
-        {
-        if(tf < 0)
-          {
-          switch(cIWModeMin) 
-            {
-            default:
-            case IW_MIN:
-              tf = 0;
-              break;
-            case IW_MAX:
-              tf = 255;
-              break;
-            case IW_FLIP:
-              tf = -tf;
-              if(tf>255)
-                {
-                tf = 255;
-                }
-              break;
-            }
-          }
-        }
-      
-      l = (j-cWinMinX) + (k-cWinMinY)*cWinDataSizeX;
-      cWinImData[l] = (unsigned char)tf;
-      
-      if(cValidOverlayData)
-        {
-        l = l * 4;
-        if(cImageMode == IMG_MIP)
-          {
-          ind[cWinOrder[2]] = cWinZBuffer[(j-cWinMinX) + 
-            (k-cWinMinY)*cWinDataSizeX];
-          }
-        
-        if(sizeof(OverlayPixelType) == 1)
-          {
-          m = (int)*((unsigned char *)&(cOverlayData->GetPixel(ind)));
-          if(m > 0)
-            {
-            m = m - 1;
-            cWinOverlayData[l+0] = 
-              (unsigned char)(cColorTable->GetColor(m).GetRed()*255);
-            cWinOverlayData[l+1] = 
-              (unsigned char)(cColorTable->GetColor(m).GetGreen()*255);
-            cWinOverlayData[l+2] = 
-              (unsigned char)(cColorTable->GetColor(m).GetBlue()*255);
-            cWinOverlayData[l+3] = 
-              (unsigned char)(cOverlayOpacity*255);
-            }
-          }
-        else 
-          {
-          if(((unsigned char *)&(cOverlayData->GetPixel(ind)))[0]
-            + ((unsigned char *)&(cOverlayData->GetPixel(ind)))[1]
-            + ((unsigned char *)&(cOverlayData->GetPixel(ind)))[2] > 0)
-              {
-            if(sizeof(OverlayPixelType) == 3)
-              {
-              cWinOverlayData[l+0] = 
-                ((unsigned char *)&(cOverlayData->GetPixel(ind)))[0];
-              cWinOverlayData[l+1] = 
-                ((unsigned char *)&(cOverlayData->GetPixel(ind)))[1];
-              cWinOverlayData[l+2] = 
-                ((unsigned char *)&(cOverlayData->GetPixel(ind)))[2];
-              cWinOverlayData[l+3] = 
-                (unsigned char)(cOverlayOpacity*255);
-              }
-            else 
-              {
-              if(sizeof(OverlayPixelType) == 4)
-                {
-                cWinOverlayData[l+0] = 
-                  ((unsigned char *)&(cOverlayData->GetPixel(ind)))[0];
-                cWinOverlayData[l+1] = 
-                  ((unsigned char *)&(cOverlayData->GetPixel(ind)))[1];
-                cWinOverlayData[l+2] = 
-                  ((unsigned char *)&(cOverlayData->GetPixel(ind)))[2];
-                cWinOverlayData[l+3] = 
-                  (unsigned char)(((unsigned char *)
-                  &(cOverlayData->GetPixel(ind)))[3]*cOverlayOpacity);
-                }
-              }
-            }
-          }
-        }
-      }
+    return;
     }
-  resizeGL(this->width(), this->height());
-  paintGL();
-  updateGL();
+  this->updateOverlay();
 }
 
 
-void QtGlSliceView::setValidOverlayData(bool newValidOverlayData)
+void QtGlSliceView::updateOverlay()
 {
-  this->cValidOverlayData = newValidOverlayData;
+  if(!cValidImData || !cImData || cWinImData == NULL)
+    {
+    return;
+    }
+  this->scheduleRender();
 }
 
 
-bool QtGlSliceView::validOverlayData() const
+void QtGlSliceView::scheduleRender()
 {
-  return this->cValidOverlayData;
+  cRenderPending = true;
+  if(!cFrameScheduled)
+    {
+    cFrameScheduled = true;
+    QMetaObject::invokeMethod(this, "renderScheduledFrame",
+                              Qt::QueuedConnection);
+    }
 }
 
 
-QDialog* QtGlSliceView::helpWindow() const
+void QtGlSliceView::schedulePaint()
 {
-  return this->cHelpDialog;
+  // Qt posts a single paint event however many times it is called.
+  QGLWidget::update();
 }
 
 
-void QtGlSliceView::setSingleStep(double step)
+void QtGlSliceView::renderScheduledFrame()
 {
-  this->cSingleStep = (step != 0. ? step : 1.);
-}
+  cFrameScheduled = false;
+  if(!cRenderPending)
+    {
+    return;
+    }
+  cRenderPending = false;
+  if(!cValidImData || !cImData || cWinImData == NULL)
+    {
+    return;
+    }
+  this->updateOverlayLUT();
+  cRenderer->requestRender(this->renderState());
+  ++cRenderedFrames;
+}
+
+
+int QtGlSliceView::renderedFrames() const
+{
+  return cRenderedFrames;
+}
+
+
+int QtGlSliceView::paintedFrames() const
+{
+  return cPaintedFrames;
+}
+
+
+int QtGlSliceView::displayedFrames() const
+{
+  return cDisplayedFrames;
+}
+
+
+int QtGlSliceView::droppedFrames() const
+{
+  return cRenderer->droppedFrames() + cOverwrittenFrames;
+}
+
+
+void QtGlSliceView::resetFrameCounts()
+{
+  cRenderedFrames = 0;
+  cPaintedFrames = 0;
+  cDisplayedFrames = 0;
+  cOverwrittenFrames = 0;
+  cRenderer->resetDroppedFrames();
+}
+
+
+void QtGlSliceView::updateOverlayLUT()
+{
+  for(int i=0; i<cOverlayLayers.size(); i++)
+    {
+    OverlayLayerType& overlay = cOverlayLayers[i];
+    if(!overlay.Layer->isLabelMap())
+      {
+      continue;
+      }
+    // Grown by powers of 2 as a streamed layer reads larger labels.
+    const int labelCount = static_cast<int>(overlay.Layer->labelCount());
+    int lutSize = 256;
+    while(lutSize < labelCount)
+      {
+      lutSize *= 2;
+      }
+    if(overlay.LUT.size() == lutSize &&
+       overlay.LUTMTime == overlay.ColorTable->GetMTime() &&
+       overlay.LUTOpacity == overlay.Opacity)
+      {
+      continue;
+      }
+    overlay.LUT.resize(lutSize);
+    overlay.LUT[0] = 0;
+    // Premultiplied by the opacity, as composited by the renderer.
+    const double alpha = overlay.Opacity;
+    const int hiddenSize = qMin(lutSize, overlay.HiddenLabels.size());
+    for(int m=1; m<lutSize; m++)
+      {
+      if(m < hiddenSize && overlay.HiddenLabels[m])
+        {
+        overlay.LUT[m] = 0;
+        continue;
+        }
+      double rgb[3];
+      if(overlay.LabelColors.contains(m))
+        {
+        const QColor& color = overlay.LabelColors[m];
+        rgb[0] = color.redF();
+        rgb[1] = color.greenF();
+        rgb[2] = color.blueF();
+        }
+      else
+        {
+        // The table only has a few colors, cycled through.
+        const unsigned int c = (m-1) % overlay.ColorTable->GetNumberOfColors();
+        rgb[0] = overlay.ColorTable->GetColor(c).GetRed();
+        rgb[1] = overlay.ColorTable->GetColor(c).GetGreen();
+        rgb[2] = overlay.ColorTable->GetColor(c).GetBlue();
+        }
+      unsigned char rgba[4];
+      rgba[0] = (unsigned char)(rgb[0]*alpha*255);
+      rgba[1] = (unsigned char)(rgb[1]*alpha*255);
+      rgba[2] = (unsigned char)(rgb[2]*alpha*255);
+      rgba[3] = (unsigned char)(alpha*255);
+      // Copy the bytes so that the entry is in RGBA order in memory
+      // whatever the endianness.
+      memcpy(&overlay.LUT[m], rgba, 4);
+      }
+    overlay.LUTMTime = overlay.ColorTable->GetMTime();
+    overlay.LUTOpacity = overlay.Opacity;
+    }
+}
+
+
+QtSliceRenderState QtGlSliceView::renderState() const
+{
+  QtSliceRenderState state;
+  state.Image = cImData;
+  state.ImageMTime = cImData ? cImData->GetMTime() : 0;
+  state.ValidOverlayData = cValidOverlayData && cViewOverlayData &&
+    cWinOverlayBackData != NULL;
+  state.OverlayMode = cOverlayMode;
+  state.ImageMode = cImageMode;
+  state.IWModeMin = cIWModeMin;
+  state.IWModeMax = cIWModeMax;
+  state.IWMin = cIWMin;
+  state.IWMax = cIWMax;
+  state.ShaderWindow = this->isWindowedByShader();
+  if(state.ShaderWindow)
+    {
+    // Normalize the values for 16-bit textures. The differences of the
+    // derivative modes are within [-range, range].
+    const double range = cDataMax > cDataMin ? cDataMax - cDataMin : 1.0;
+    const bool derivative = cImageMode == IMG_DX || cImageMode == IMG_DY ||
+      cImageMode == IMG_DZ;
+    state.ValueOffset = derivative ? -range : cDataMin;
+    state.ValueScale = derivative ? 2*range : range;
+    }
+  for(int i=0; i<3; i++)
+    {
+    state.DimSize[i] = cDimSize[i];
+    state.WinOrder[i] = cWinOrder[i];
+    state.WinCenter[i] = cWinCenter[i];
+    }
+  state.WinMinX = cWinMinX;
+  state.WinMaxX = cWinMaxX;
+  state.WinMinY = cWinMinY;
+  state.WinMaxY = cWinMaxY;
+  state.WinDataSizeX = cWinDataSizeX;
+  state.WinDataSizeY = cWinDataSizeY;
+  if(!state.ValidOverlayData)
+    {
+    return state;
+    }
+  // Restrict each layer to its labeled box in the slice, or in the whole
+  // volume for the MIP.
+  const int sliceAxis = cWinOrder[2];
+  int firstSlice = cWinCenter[sliceAxis];
+  int lastSlice = firstSlice;
+  if(cImageMode == IMG_MIP)
+    {
+    firstSlice = 0;
+    lastSlice = cDimSize[sliceAxis] - 1;
+    }
+  const int jBounds = cWinOrder[0] < cWinOrder[1] ? 0 : 2;
+  foreach(const OverlayLayerType& overlay, cOverlayLayers)
+    {
+    if(!overlay.Visible)
+      {
+      continue;
+      }
+    QtSliceOverlayState overlayState;
+    overlayState.Layer = overlay.Layer;
+    overlayState.LUT = overlay.LUT;
+    overlayState.Opacity = (unsigned char)(overlay.Opacity*255);
+    int bounds[4];
+    if(overlay.Layer->bounds(sliceAxis, firstSlice, lastSlice, bounds))
+      {
+      overlayState.Bounds[0] = bounds[jBounds];
+      overlayState.Bounds[1] = bounds[jBounds + 1];
+      overlayState.Bounds[2] = bounds[2 - jBounds];
+      overlayState.Bounds[3] = bounds[3 - jBounds];
+      overlayState.Empty = false;
+      if(state.OverlayEmpty)
+        {
+        for(int i=0; i<4; i++)
+          {
+          state.OverlayBounds[i] = overlayState.Bounds[i];
+          }
+        state.OverlayEmpty = false;
+        }
+      for(int i=0; i<4; i+=2)
+        {
+        state.OverlayBounds[i] = qMin(state.OverlayBounds[i],
+                                      overlayState.Bounds[i]);
+        state.OverlayBounds[i+1] = qMax(state.OverlayBounds[i+1],
+                                        overlayState.Bounds[i+1]);
+        }
+      }
+    state.Overlays.append(overlayState);
+    }
+  return state;
+}
+
+
+void QtGlSliceView::allocateWinData()
+{
+  cRenderer->cancel();
+
+  QMutexLocker locker(&cWinDataMutex);
+  const int winDataSize = cWinDataSizeX * cWinDataSizeY;
+
+  delete [] cWinImData;
+  delete [] cWinImBackData;
+  cWinImData = new unsigned char[ winDataSize ];
+  cWinImBackData = new unsigned char[ winDataSize ];
+  memset(cWinImData, 0, winDataSize);
+
+  delete [] cWinValueData;
+  delete [] cWinValueBackData;
+  cWinValueData = new float[ winDataSize ];
+  cWinValueBackData = new float[ winDataSize ];
+  memset(cWinValueData, 0, winDataSize * sizeof(float));
+
+  delete [] cWinZBuffer;
+  delete [] cWinZBackBuffer;
+  cWinZBuffer = new unsigned short[ winDataSize ];
+  cWinZBackBuffer = new unsigned short[ winDataSize ];
+  memset(cWinZBuffer, 0, winDataSize * sizeof(unsigned short));
+
+  delete [] cWinOverlayData;
+  delete [] cWinOverlayBackData;
+  cWinOverlayData = NULL;
+  cWinOverlayBackData = NULL;
+  if(cValidOverlayData)
+    {
+    cWinOverlayData = new unsigned char[ winDataSize * 4 ];
+    cWinOverlayBackData = new unsigned char[ winDataSize * 4 ];
+    memset(cWinOverlayData, 0, winDataSize * 4);
+    }
+
+  delete [] cWinFrameData;
+  delete [] cWinFrameBackData;
+  cWinFrameData = new unsigned char[ winDataSize * 4 ];
+  cWinFrameBackData = new unsigned char[ winDataSize * 4 ];
+  memset(cWinFrameData, 0, winDataSize * 4);
+  cWinFrameDirty = QRect(0, 0, cWinDataSizeX, cWinDataSizeY);
+  cWinValueFrame = false;
+}
+
+
+void QtGlSliceView::swapWinData(const QtSliceRenderState& state)
+{
+  QMutexLocker locker(&cWinDataMutex);
+  qSwap(cWinImData, cWinImBackData);
+  qSwap(cWinValueData, cWinValueBackData);
+  qSwap(cWinZBuffer, cWinZBackBuffer);
+  qSwap(cWinFrameData, cWinFrameBackData);
+  cWinFrameDirty = QRect(0, 0, cWinDataSizeX, cWinDataSizeY);
+  ++cWinFrameNumber;
+  if(cWinOverlayBackData != NULL)
+    {
+    qSwap(cWinOverlayData, cWinOverlayBackData);
+    }
+  cWinValueFrame = state.ShaderWindow;
+  cWinValueMode = state.ImageMode;
+  cWinValueOffset = state.ValueOffset;
+  cWinValueScale = state.ValueScale;
+  // Pixels resliced by QtSliceRenderer::resliceRows().
+  const int minX = qMax(state.WinMinX, 0) - state.WinMinX;
+  const int minY = qMax(state.WinMinY, 0) - state.WinMinY;
+  const int maxX = qMin(state.WinMaxX - state.WinMinX,
+                        state.WinDataSizeX - 1);
+  const int maxY = qMin(state.WinMaxY - state.WinMinY,
+                        state.WinDataSizeY - 1);
+  cWinValueBox = QRect(QPoint(minX, minY), QPoint(maxX, maxY));
+  cWinValueOverlay = state.ValidOverlayData && !state.OverlayEmpty;
+  cWinValueMinX = state.WinMinX;
+  cWinValueMinY = state.WinMinY;
+  cWinValueAxis = state.WinOrder[2];
+  cWinValueSlice = state.WinCenter[state.WinOrder[2]];
+}
+
+
+QVector<unsigned int> QtGlSliceView::frame() const
+{
+  QMutexLocker locker(&cWinDataMutex);
+  QVector<unsigned int> pixels;
+  if(cWinFrameData != NULL)
+    {
+    pixels.resize(cWinDataSizeX * cWinDataSizeY);
+    if(cWinValueFrame)
+      {
+      QtSliceRenderState state;
+      state.ImageMode = cWinValueMode;
+      state.IWModeMin = cIWModeMin;
+      state.IWModeMax = cIWModeMax;
+      state.IWMin = cIWMin;
+      state.IWMax = cIWMax;
+      state.ShaderWindow = true;
+      state.ValueOffset = cWinValueOffset;
+      state.ValueScale = cWinValueScale;
+      state.WinDataSizeX = cWinDataSizeX;
+      state.WinDataSizeY = cWinDataSizeY;
+      QtSliceRenderer::composeValueFrame(state, cWinValueBox, cWinValueData,
+        cWinValueOverlay ?
+          reinterpret_cast<const unsigned int*>(cWinOverlayData) : NULL,
+        pixels.data());
+      }
+    else
+      {
+      memcpy(pixels.data(), cWinFrameData, pixels.size() * 4);
+      }
+    }
+  return pixels;
+}
+
+
+QSize QtGlSliceView::frameSize() const
+{
+  return QSize(cWinDataSizeX, cWinDataSizeY);
+}
+
+
+void QtGlSliceView::onSliceRendered()
+{
+  // A streamed layer may have read labels past its LUT for this frame.
+  for(int i=0; i<cOverlayLayers.size(); i++)
+    {
+    const OverlayLayerType& overlay = cOverlayLayers[i];
+    if(overlay.Layer->isLabelMap() &&
+       static_cast<int>(overlay.Layer->labelCount()) > overlay.LUT.size())
+      {
+      this->updateOverlay();
+      break;
+      }
+    }
+  this->schedulePaint();
+}
+
+
+void QtGlSliceView::onRendererIdle()
+{
+  if(!cPaintPoints.isEmpty() && !cRenderer->isBusy())
+    {
+    this->paintQueuedStroke();
+    }
+  if(cGrowPreviewQueued)
+    {
+    this->applyRegionPreview();
+    }
+}
+
+
+void QtGlSliceView::setValidOverlayData(bool newValidOverlayData)
+{
+  this->cValidOverlayData = newValidOverlayData;
+}
+
+
+bool QtGlSliceView::validOverlayData() const
+{
+  return this->cValidOverlayData;
+}
+
+
+QDialog* QtGlSliceView::helpWindow() const
+{
+  return this->cHelpDialog;
+}
+
+
+void QtGlSliceView::setSingleStep(double step)
+{
+  this->cSingleStep = (step != 0. ? step : 1.);
+}
 
 
 double QtGlSliceView::singleStep() const
@@ -695,6 +1288,92 @@ void QtGlSliceView::setMaxDisplayStates(int newNumberOfStates)
 }
 
 
+int QtGlSliceView::maxThreadCount() const
+{
+  return QtTaskScheduler::instance()->maximumThreadCount();
+}
+
+
+void QtGlSliceView::setMaxThreadCount(int count)
+{
+  QtTaskScheduler* scheduler = QtTaskScheduler::instance();
+  scheduler->setMaximumThreadCount(count);
+  this->updateITKThreadCount();
+}
+
+
+bool QtGlSliceView::adaptiveThreadCount() const
+{
+  return QtTaskScheduler::instance()->adaptiveThreadCount();
+}
+
+
+void QtGlSliceView::setAdaptiveThreadCount(bool adaptive)
+{
+  QtTaskScheduler::instance()->setAdaptiveThreadCount(adaptive);
+}
+
+
+bool QtGlSliceView::shaderWindowing() const
+{
+  return cShaderWindowing;
+}
+
+
+void QtGlSliceView::setShaderWindowing(bool enable)
+{
+  if(enable == cShaderWindowing)
+    {
+    return;
+    }
+  cShaderWindowing = enable;
+  update();
+}
+
+
+bool QtGlSliceView::isWindowedByShader() const
+{
+  return cShaderWindowing && cShaderSupported && cImageMode != IMG_MIP;
+}
+
+
+void QtGlSliceView::updateIntensityWindow()
+{
+  if(this->isWindowedByShader())
+    {
+    cBaseLayerModified = true;
+    this->schedulePaint();
+    }
+  else
+    {
+    update();
+    }
+}
+
+
+QList<int> QtGlSliceView::threadAffinity() const
+{
+  return QtTaskScheduler::instance()->threadAffinity();
+}
+
+
+void QtGlSliceView::setThreadAffinity(const QList<int>& cpus)
+{
+  QtTaskScheduler::instance()->setThreadAffinity(cpus);
+  this->updateITKThreadCount();
+}
+
+
+void QtGlSliceView::updateITKThreadCount()
+{
+  // ITK filters (readers, statistics...) pick their number of threads when
+  // they are created, so they follow the cap but not the adaptive mode.
+  const int count = QtTaskScheduler::instance()->threadLimit();
+  itk::MultiThreader::SetGlobalMaximumNumberOfThreads(count);
+  itk::MultiThreader::SetGlobalDefaultNumberOfThreads(count);
+}
+
+
 void QtGlSliceView::setDisplayState(int state)
 {
   if (state == this->cDisplayState)
@@ -1138,22 +1817,8 @@ void QtGlSliceView::keyPressEvent(QKeyEvent* keyEvent)
         {
         pace = fastMovVal();
         }
-      if((int)cWinCenter[cWinOrder[2]]-pace<0)
-        {
-        if((int)cWinCenter[cWinOrder[2]] == 0)
-          {
-          return;
-          }
-        else
-          {
-          setSliceNum(0);
-          }
-        }
-      else
-        {
-        setSliceNum((int)cWinCenter[cWinOrder[2]]-pace);
-        }
-      update();
+      // The steps of the auto-repeated keys are applied together.
+      stepSlice(-pace);
       break;
     case Qt::Key_Greater: // >
     case Qt::Key_Period:
@@ -1167,22 +1832,8 @@ void QtGlSliceView::keyPressEvent(QKeyEvent* keyEvent)
         {
         pace = fastMovVal();
         }
-      if((int)cWinCenter[cWinOrder[2]]+pace>(int)cDimSize[cWinOrder[2]]-1)
-        {
-        if((int)cWinCenter[cWinOrder[2]] == (int)cDimSize[cWinOrder[2]]-1)
-          {
-          return;
-          }
-        else
-          {
-          setSliceNum((int)cDimSize[cWinOrder[2]]-1);
-          }
-        }
-      else
-        {
-        setSliceNum((int)cWinCenter[cWinOrder[2]]+pace);
-        }
-      update();
+      // The steps of the auto-repeated keys are applied together.
+      stepSlice(pace);
       break;
     case Qt::Key_R:
       setZoom(1.0);
@@ -1211,12 +1862,24 @@ void QtGlSliceView::keyPressEvent(QKeyEvent* keyEvent)
       update();
       break;
     case Qt::Key_Z:
+      if(keyEvent->modifiers() & Qt::ControlModifier)
+        {
+        if(keyEvent->modifiers() & Qt::ShiftModifier)
+          {
+          redoOverlayEdit();
+          }
+        else
+          {
+          undoOverlayEdit();
+          }
+        break;
+        }
       flipZ(!isZFlipped());
       update();
       break;
     case Qt::Key_E:
       setIWModeMax(iwModeMax() == IW_FLIP ? IW_MAX : IW_FLIP);
-      update();
+      this->updateIntensityWindow();
       break;
     case Qt::Key_L:
       switch(imageMode())
@@ -1258,26 +1921,34 @@ void QtGlSliceView::keyPressEvent(QKeyEvent* keyEvent)
       break;
     case Qt::Key_Q:
       setIWMax(iwMax()-singleStep());
-      update();
       break;
     case Qt::Key_W:
       setIWMax(iwMax()+singleStep());
-      update();
       break;
     case (Qt::Key_A):
       if (keyEvent->modifiers() & Qt::ShiftModifier)
         {
         setViewAxisLabel(!viewAxisLabel());
+        update();
         }
       else
         {
         setIWMin(iwMin()-singleStep());
         }
-      update();
       break;
     case Qt::Key_S:
-      setIWMin(iwMin()+singleStep());
-      update();
+      if(keyEvent->modifiers() & Qt::ControlModifier)
+        {
+        saveOverlayStatistics();
+        }
+      else if(keyEvent->modifiers() & Qt::ShiftModifier)
+        {
+        analyzeOverlay();
+        }
+      else
+        {
+        setIWMin(iwMin()+singleStep());
+        }
       break;
     case (Qt::Key_I):
       if(!(keyEvent->modifiers() & Qt::ShiftModifier))
@@ -1379,31 +2050,116 @@ void QtGlSliceView::keyPressEvent(QKeyEvent* keyEvent)
         {
         int newState = this->nextDisplayState(this->displayState());
         this->setDisplayState(newState);
+        update();
         }
       else
         {
         setIWModeMin(iwModeMin() == IW_FLIP ? IW_MIN : IW_FLIP);
+        this->updateIntensityWindow();
         }
-      update();
       break;
     case (Qt::Key_O):
       if(keyEvent->modifiers() & Qt::ShiftModifier)
         {
-        setOverlay(!viewOverlayData());
+        setViewOverlayData(!viewOverlayData());
+        }
+      else
+        {
+        setOverlayLayerVisible(currentOverlayLayer(),
+          !isOverlayLayerVisible(currentOverlayLayer()));
         }
-      update();
-      break;
-    case Qt::Key_B:
-    //decrease opacity overlay
-      setOverlayOpacity(overlayOpacity() - 0.025);
-      //update();
       break;
-    case Qt::Key_N:
-    //increase opacity overlay
-      setOverlayOpacity(overlayOpacity() + 0.025);
-      //update();
+    case Qt::Key_U:
+      // Hide (isolate with Shift) the label at the last clicked point.
+      if(clickedLabel() > 0)
+        {
+        const int label = clickedLabel();
+        if(!(keyEvent->modifiers() & Qt::ShiftModifier))
+          {
+          setLabelVisible(label, !isLabelVisible(label));
+          break;
+          }
+        bool isolated = isLabelVisible(label);
+        const int labelCount = overlayLayer()->labelCount();
+        for(int m=1; isolated && m<labelCount; m++)
+          {
+          isolated = m == label || !isLabelVisible(m);
+          }
+        if(isolated)
+          {
+          showAllLabels();
+          }
+        else
+          {
+          isolateLabel(label);
+          }
+        }
       break;
-    case Qt::Key_H:
+    case Qt::Key_F:
+      if(keyEvent->modifiers() & Qt::ShiftModifier)
+        {
+        // Toggle growing regions of the overlay with the mouse.
+        setClickMode(clickMode() == CM_GROW ? CM_SELECT : CM_GROW);
+        }
+      else
+        {
+        // Toggle painting the overlay with the mouse.
+        setClickMode(clickMode() == CM_PAINT ? CM_SELECT : CM_PAINT);
+        }
+      break;
+    case Qt::Key_ParenLeft:
+      setPaintRadius(paintRadius() - 1);
+      break;
+    case Qt::Key_ParenRight:
+      setPaintRadius(paintRadius() + 1);
+      break;
+    case Qt::Key_BracketLeft:
+      if(overlayLayerCount() > 0)
+        {
+        setCurrentOverlayLayer((currentOverlayLayer() + overlayLayerCount()
+                                - 1) % overlayLayerCount());
+        }
+      break;
+    case Qt::Key_BracketRight:
+      if(overlayLayerCount() > 0)
+        {
+        setCurrentOverlayLayer((currentOverlayLayer() + 1) %
+                               overlayLayerCount());
+        }
+      break;
+    case Qt::Key_B:
+      if(keyEvent->modifiers() & Qt::ShiftModifier)
+        {
+        setOverlayMode(overlayMode() == OVERLAY_FILLED ?
+                       OVERLAY_OUTLINE : OVERLAY_FILLED);
+        }
+      else
+        {
+        //decrease opacity overlay
+        setOverlayOpacity(overlayOpacity() - 0.025);
+        }
+      //update();
+      break;
+    case Qt::Key_N:
+    //increase opacity overlay
+      setOverlayOpacity(overlayOpacity() + 0.025);
+      //update();
+      break;
+    case Qt::Key_G:
+      // Jump to the next (previous with Shift) slice with overlay labels.
+      if(this->overlayLayer())
+        {
+        const int slice = this->overlayLayer()->nextLabeledSlice(
+          cWinOrder[2], cWinCenter[cWinOrder[2]],
+          (keyEvent->modifiers() & Qt::ShiftModifier) ? -1 : 1);
+        if(slice >= 0)
+          {
+          setSliceNum(slice);
+          update();
+          }
+        }
+      break;
+    case Qt::Key_H:
       showHelp();
       break;
     default:
@@ -1495,11 +2251,199 @@ void QtGlSliceView::initializeGL()
   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  //if you don't include this
     //image size differences distort
     //glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+  // The frames rendered before are windowed on the CPU.
+  cShaderSupported = cWinShader->initialize();
+  if(cShaderSupported && cShaderWindowing)
+    {
+    update();
+    }
+}
+
+QRect QtGlSliceView::visibleFrameBox(double x, double y,
+                                     double scaleX, double scaleY) const
+{
+  if(scaleX == 0 || scaleY == 0)
+    {
+    return QRect();
+    }
+  // Pixel i of the frame covers [x + i*scaleX, x + (i+1)*scaleX].
+  const double x0 = (0 - x) / scaleX;
+  const double x1 = (this->width() - x) / scaleX;
+  const double y0 = (0 - y) / scaleY;
+  const double y1 = (this->height() - y) / scaleY;
+  const QRect box(QPoint((int)floor(qMin(x0, x1)), (int)floor(qMin(y0, y1))),
+                  QPoint((int)ceil(qMax(x0, x1)), (int)ceil(qMax(y0, y1))));
+  return box & QRect(0, 0, cWinDataSizeX, cWinDataSizeY);
+}
+
+
+void QtGlSliceView::paintBaseLayer(int frameX, int frameY,
+                                   double frameScaleX, double frameScaleY)
+{
+  bool drawTexture = false;
+  bool drawShader = false;
+  bool drawOverlay = false;
+  bool renderAgain = false;
+  // Only the tiles of the frame in the view are uploaded and drawn.
+  const QRect visible =
+    this->visibleFrameBox(frameX, frameY, frameScaleX, frameScaleY);
+  {
+  // The renderer swaps the front buffers when a frame is complete.
+  QMutexLocker locker(&cWinDataMutex);
+  if(cWinFrameNumber != cDisplayedFrameNumber)
+    {
+    // The frames swapped in since the last repaint are not displayed.
+    cOverwrittenFrames += cWinFrameNumber - cDisplayedFrameNumber - 1;
+    cDisplayedFrameNumber = cWinFrameNumber;
+    ++cDisplayedFrames;
+    }
+  if(cValidImData && cViewImData && cWinValueFrame)
+    {
+    if(cWinShader->isSupported(cWinDataSizeX, cWinDataSizeY))
+      {
+      drawOverlay = cWinValueOverlay;
+      cWinShader->upload(cWinValueData,
+                         drawOverlay ? cWinOverlayData : NULL,
+                         cWinDataSizeX, cWinDataSizeY, cWinFrameDirty,
+                         visible);
+      cWinFrameDirty = QRect();
+      cWinShader->setValues(cWinValueMode, cWinValueOffset,
+                            cWinValueScale, cWinValueBox);
+      // The current window, which may be newer than the frame.
+      cWinShader->setWindow(cIWMin, cIWMax, cIWModeMin, cIWModeMax);
+      drawShader = true;
+      }
+    else
+      {
+      // Render the frame again, windowed on the CPU.
+      cShaderSupported = false;
+      renderAgain = true;
+      }
+    }
+  // The overlay is already composited into the frame.
+  else if(cValidImData && cViewImData)
+    {
+    if(cWinTexture->isSupported(cWinDataSizeX, cWinDataSizeY))
+      {
+      // Only the pixels changed since the last repaint are uploaded.
+      cWinTexture->upload(cWinFrameData, cWinDataSizeX, cWinDataSizeY,
+                          cWinFrameDirty, visible);
+      cWinFrameDirty = QRect();
+      drawTexture = true;
+      }
+    else
+      {
+      glRasterPos2i(frameX, frameY);
+      glPixelZoom(frameScaleX, frameScaleY);
+      glDrawPixels(cWinDataSizeX, cWinDataSizeY,
+                    GL_RGBA, GL_UNSIGNED_BYTE,
+                    cWinFrameData);
+      }
+    }
+  }
+  if(drawTexture)
+    {
+    cWinTexture->draw(frameX, frameY, frameScaleX, frameScaleY, visible);
+    }
+  else if(drawShader)
+    {
+    cWinShader->draw(frameX, frameY, frameScaleX, frameScaleY, visible,
+                     drawOverlay);
+    }
+  else if(renderAgain)
+    {
+    cBaseLayerModified = true;
+    update();
+    }
 }
 
+
+bool QtGlSliceView::updateBaseLayer()
+{
+  if(!QGLFramebufferObject::hasOpenGLFramebufferObjects())
+    {
+    return false;
+    }
+  if(cBaseLayer != NULL && cBaseLayer->size() != this->size())
+    {
+    delete cBaseLayer;
+    cBaseLayer = NULL;
+    }
+  if(cBaseLayer == NULL)
+    {
+    cBaseLayer = new QGLFramebufferObject(this->size());
+    cBaseLayerModified = true;
+    }
+  return cBaseLayer->isValid();
+}
+
+
+void QtGlSliceView::drawBaseLayer() const
+{
+  glPushAttrib(GL_ENABLE_BIT | GL_TEXTURE_BIT);
+  glDisable(GL_BLEND);
+  glEnable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, cBaseLayer->texture());
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+  glBegin(GL_QUADS);
+  glTexCoord2f(0, 0);
+  glVertex2i(0, 0);
+  glTexCoord2f(1, 0);
+  glVertex2i(this->width(), 0);
+  glTexCoord2f(1, 1);
+  glVertex2i(this->width(), this->height());
+  glTexCoord2f(0, 1);
+  glVertex2i(0, this->height());
+  glEnd();
+  glPopAttrib();
+}
+
+
+void QtGlSliceView::updateClickedPointVertices()
+{
+  const int slice = this->sliceNum();
+  if(!cClickedPointsModified && cClickedPointsSlice == slice
+     && cClickedPointsAxis == cWinOrder[2])
+    {
+    return;
+    }
+  cClickedPointsModified = false;
+  cClickedPointsSlice = slice;
+  cClickedPointsAxis = cWinOrder[2];
+  cClickedPointVertices.resize(0);
+  ClickPointListType::const_iterator point;
+  for(point = cClickedPoints.begin(); point != cClickedPoints.end(); ++point)
+    {
+    const double pts[3] = { point->x, point->y, point->z };
+    if(static_cast<int>(pts[cWinOrder[2]]) == slice)
+      {
+      cClickedPointVertices.append(static_cast<GLfloat>(pts[cWinOrder[0]]));
+      cClickedPointVertices.append(static_cast<GLfloat>(pts[cWinOrder[1]]));
+      }
+    }
+}
+
+
+void QtGlSliceView::drawVertices(GLenum mode,
+                                 const QVector<GLfloat>& vertices)
+{
+  if(vertices.isEmpty())
+    {
+    return;
+    }
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(2, GL_FLOAT, 0, vertices.constData());
+  glDrawArrays(mode, 0, vertices.size() / 2);
+  glPopClientAttrib();
+}
+
+
 /** Draw */
 void QtGlSliceView::paintGL(void)
 {
+  ++cPaintedFrames;
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   glMatrixMode(GL_MODELVIEW);    //clear previous 3D draw params
   glLoadIdentity();
@@ -1540,160 +2484,635 @@ void QtGlSliceView::paintGL(void)
       originY = (int)((this->cH-scale1*this->cDimSize[this->cWinOrder[1]])/2.0);
       }
     }
-  glRasterPos2i((isXFlipped())?cW:0,
-     (isYFlipped())?cH:0);
-    
-  glPixelZoom((isXFlipped())?-scale0:scale0,
-     (isYFlipped())?-scale1:scale1);
-    
-  if(cValidImData && cViewImData)
+  const int frameX = (isXFlipped())?cW:0;
+  const int frameY = (isYFlipped())?cH:0;
+  const double frameScaleX = (isXFlipped())?-scale0:scale0;
+  const double frameScaleY = (isYFlipped())?-scale1:scale1;
+  // The base layer, the slice and its overlay, is drawn into cBaseLayer
+  // only when it changes. The annotations are drawn over it each time,
+  // e.g. when the mouse moves.
+  if(this->updateBaseLayer())
+    {
+    bool modified = cBaseLayerModified;
     {
-    glDrawPixels(cWinDataSizeX, cWinDataSizeY,
-                  GL_LUMINANCE, GL_UNSIGNED_BYTE, 
-                  cWinImData);
+    QMutexLocker locker(&cWinDataMutex);
+    modified = modified || !cWinFrameDirty.isEmpty();
     }
-    
-  if(cValidOverlayData && viewOverlayData())
+    if(modified)
+      {
+      cBaseLayerModified = false;
+      cBaseLayer->bind();
+      glClear(GL_COLOR_BUFFER_BIT);
+      this->paintBaseLayer(frameX, frameY, frameScaleX, frameScaleY);
+      cBaseLayer->release();
+      }
+    this->drawBaseLayer();
+    }
+  else
     {
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glDrawPixels(cWinDataSizeX, cWinDataSizeY, GL_RGBA, 
-       GL_UNSIGNED_BYTE, cWinOverlayData);
-    glDisable(GL_BLEND);
+    this->paintBaseLayer(frameX, frameY, frameScaleX, frameScaleY);
     }
 
   if(viewClickedPoints())
     {
+    this->updateClickedPointVertices();
+    // The points are in voxels of the window axes.
+    const double pointScaleX = (isXFlipped())?-scale0:scale0;
+    const double pointScaleY = (isYFlipped())?-scale1:scale1;
+    const double pointX = (isXFlipped())?
+      this->cW - originX + this->cWinMinX * scale0 :
+      originX - this->cWinMinX * scale0;
+    const double pointY = (isYFlipped())?
+      this->cH - originY + this->cWinMinY * scale1 :
+      originY - this->cWinMinY * scale1;
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glTranslated(pointX, pointY, 0);
+    glScaled(pointScaleX, pointScaleY, 1);
     glColor3f( 0.8, 0.4, 0.4 );
     glPointSize( 3.0 );
-    glBegin(GL_POINTS);
-    for( int ii = 0; ii < clickedPointsStored(); ii++ )
+    this->drawVertices(GL_POINTS, cClickedPointVertices);
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    }
+    
+  // The text is laid out again only when it changes, and drawn in one
+  // batch per font.
+  cLabelAtlas->setFont(widgetFont);
+  cTextAtlas->setFont(this->font());
+  if(viewAxisLabel())
+    {
+    const QColor labelColor(51, 51, 199, 191);
+    cLabelAtlas->layout(cAxisLabels[0], cAxisLabelX[cWinOrientation]);
+    cLabelAtlas->layout(cAxisLabels[1], cAxisLabelY[cWinOrientation]);
+    // The labels are placed in window coordinates, y down.
+    int posY = static_cast<int>(this->cH/2 - h/2 );
+    if(isXFlipped() == false)
+      {
+      cLabelAtlas->add(cAxisLabels[0],
+                       this->cW - (widgetFont.pointSize())/2 -2, posY,
+                       labelColor);
+      }
+    else
       {
-      ClickPoint pointClicked(cClickSelect[0], cClickSelect[1], cClickSelect[2], cClickSelectV);
-      clickedPoint( ii, pointClicked );
-      double pts[3] = { pointClicked.x, pointClicked.y, pointClicked.z };
+      cLabelAtlas->add(cAxisLabels[0], (widgetFont.pointSize())/2, posY,
+                       labelColor);
+      }
 
-      if( static_cast<int>( pts[this->cWinOrder[2]] ) ==
-          sliceNum() )
-        {
-        float xx;
-        if(isXFlipped())
-          {
-          xx = this->cW - (pts[this->cWinOrder[0]]
-            - this->cWinMinX) * scale0 - originX;
-          }
-        else
-          {
-          xx = (pts[this->cWinOrder[0]] - this->cWinMinX) * scale0
-            + originX;
-          }
+    if(isYFlipped() == false)
+      {
+      posY = static_cast<int>(h +10) ;
+      cLabelAtlas->add(cAxisLabels[1],
+                       this->cW/2 - (widgetFont.pointSize())/2, posY,
+                       labelColor);
+      }
+    else
+      {
+      posY = static_cast<int>(this->cH - h -10);
+      cLabelAtlas->add(cAxisLabels[1],
+                       this->cW/2 + (widgetFont.pointSize())/2, posY,
+                       labelColor);
+      }
+    }
 
-        float yy;
-        if(isYFlipped())
-          {
-          yy = this->cH - (pts[this->cWinOrder[1]]
-               - this->cWinMinY) * scale1 - originY;
-          }
-        else
-          {
-          yy = (pts[this->cWinOrder[1]] - this->cWinMinY) * scale1
-               + originY;
-          }
-        glVertex2f( xx, yy );
+  if(viewValue())
+    {
+    if(this->updateValueText() || !cTextAtlas->isLaidOut(cValueLabel))
+      {
+      cTextAtlas->layout(cValueLabel, cValueText);
+      }
+    cTextAtlas->add(cValueLabel, this->cW /2, this->cH,
+                    QColor(26, 163, 51, 191));
+    }
+
+  if(this->updateDetails())
+    {
+    cDetailLabelsModified = true;
+    }
+  if(this->cDisplayState & 0x01)
+    {
+    const QColor detailColor(230, 102, 26, 191);
+    const bool detailsModified = cDetailLabelsModified;
+    cDetailLabelsModified = false;
+    cDetailLabels.resize(cDetailLines.size());
+    int i = 5;
+    for(int line=0; line<cDetailLines.size(); line++)
+      {
+      int posX = 2;
+      int posY = this->cH - (i--) * (h + 2);
+      if(detailsModified || !cTextAtlas->isLaidOut(cDetailLabels[line]))
+        {
+        cTextAtlas->layout(cDetailLabels[line], cDetailLines[line]);
         }
+      cTextAtlas->add(cDetailLabels[line], posX, posY, detailColor);
       }
-    glEnd();
     }
-    
-  if(viewAxisLabel())
+  cLabelAtlas->draw(this->width(), this->height());
+  cTextAtlas->draw(this->width(), this->height());
+  if(viewCrosshairs()
+    && static_cast<int>(cClickSelect[cWinOrder[2]]) ==
+       static_cast<int>(sliceNum()))
     {
-    glLoadIdentity();
-    glOrtho( 0.0, (double)width(), 0.0, (double)height(), 0.0, 1.0 );
-    glMatrixMode( GL_PROJECTION );
-    glViewport( 0,0 , width(), height() );
-
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glColor4f(0.2, 0.2, 0.78, 0.75);
-
-    if(isXFlipped() == false)
+    glColor4f(0.1, 0.64, 0.2, 0.75);
+    int posX;
+    if(isXFlipped())
       {
-      int posY = static_cast<int>(this->cH/2 - h/2 );
-      glRasterPos2i(width(), -posY);
-      glCallLists(strlen(cAxisLabelX[cWinOrientation]), GL_UNSIGNED_BYTE, cAxisLabelX[cWinOrientation]);
-      renderText( this->cW - (widgetFont.pointSize())/2 -2 , posY, cAxisLabelX[cWinOrientation], widgetFont);
+      posX = (int)(cW - (cClickSelect[cWinOrder[0]] - cWinMinX) * scale0);
       }
     else
       {
-      int posY = static_cast<int>(this->cH/2 - h/2 );
-      glRasterPos2i(width(), -posY);
-      glCallLists(strlen(cAxisLabelX[cWinOrientation]), GL_UNSIGNED_BYTE, cAxisLabelX[cWinOrientation]);
-      renderText((widgetFont.pointSize())/2, posY, cAxisLabelX[cWinOrientation], widgetFont);
+      posX = (int)((cClickSelect[cWinOrder[0]] - cWinMinX) * scale0);
       }
-      
-    if(isYFlipped() == false)
+    int posY;
+    if(isYFlipped())
       {
-      int posY = static_cast<int>(h +10) ;
-      glRasterPos2i(this->width()/2, -posY);
-      glCallLists(strlen(cAxisLabelY[cWinOrientation]), GL_UNSIGNED_BYTE, cAxisLabelY[cWinOrientation]);
-      renderText(this->cW/2 - (widgetFont.pointSize())/2, posY, cAxisLabelY[cWinOrientation], widgetFont);
+      posY = (int)(cH - (cClickSelect[cWinOrder[1]] - cWinMinY) * scale1);
       }
     else
       {
-      int posY = static_cast<int>(this->cH - h -10);
-      glRasterPos2i(this->width()/2, -posY);
-      glCallLists(strlen(cAxisLabelY[cWinOrientation]), GL_UNSIGNED_BYTE, cAxisLabelY[cWinOrientation]);
-      renderText(this->cW/2 + (widgetFont.pointSize())/2, posY, cAxisLabelY[cWinOrientation], widgetFont);
+      posY = (int)((cClickSelect[cWinOrder[1]] - cWinMinY) * scale1);
       }
-    
+    const GLfloat x = static_cast<GLfloat>(posX);
+    const GLfloat y = static_cast<GLfloat>(posY);
+    const GLfloat lines[16] = {
+      0, y,  x-2, y,
+      x+2, y,  static_cast<GLfloat>(this->width()-1), y,
+      x, 0,  x, y-2,
+      x, y+2,  x, static_cast<GLfloat>(this->height()-1)};
+    cCrosshairVertices.resize(0);
+    for(int i = 0; i < 16; i++)
+      {
+      cCrosshairVertices.append(lines[i]);
+      }
+    this->drawVertices(GL_LINES, cCrosshairVertices);
     glDisable(GL_BLEND);
     }
-    
-  if(viewValue())
+}
+
+
+void QtGlSliceView::mouseIndex(const QMouseEvent* mouseEvent,
+                               double p[3]) const
+{
+  double scale0 = this->width()/(double)cDimSize[0] * zoom()
+    * fabs(cSpacing[cWinOrder[0]])/fabs(cSpacing[0]);
+  double scale1 = this->height()/(double)cDimSize[1] * zoom()
+    * fabs(cSpacing[cWinOrder[1]])/fabs(cSpacing[0]);
+
+  p[cWinOrder[0]] = cWinMinX + ((1-isXFlipped())*(mouseEvent->x())
+                   + (isXFlipped())*(this->width()-mouseEvent->x()))
+                   / scale0;
+  if(p[cWinOrder[0]]<cWinMinX) 
+    {
+    p[cWinOrder[0]] = cWinMinX;
+    }
+  if(p[cWinOrder[0]]>cWinMaxX) 
+    {
+    p[cWinOrder[0]] = cWinMaxX;
+    }
+  p[cWinOrder[1]] = cWinMinY + (isYFlipped()*mouseEvent->y()
+                   + (1-isYFlipped())*(this->height()-mouseEvent->y()))
+                   / scale1;
+  if(p[cWinOrder[1]]<cWinMinY) 
+    {
+    p[cWinOrder[1]] = cWinMinY;
+    }
+  if(p[cWinOrder[1]]>cWinMaxY) 
+    {
+    p[cWinOrder[1]] = cWinMaxY;
+    }
+  if(imageMode() != IMG_MIP)
+    {
+    p[cWinOrder[2]] = cWinCenter[cWinOrder[2]];
+    }
+  else
     {
-    glLoadIdentity();
-    glOrtho( 0.0, (double)width(), 0.0, (double)height(), 0.0, 1.0 );
-    glMatrixMode( GL_PROJECTION );
-    glViewport( 0,0 , width(), height() );
+    QMutexLocker locker(&cWinDataMutex);
+    p[cWinOrder[2]] = cWinZBuffer[(int)p[cWinOrder[0]]
+                      - cWinMinX 
+                     + ((int)p[cWinOrder[1]]
+                    - cWinMinY)
+                    * cWinDataSizeX];
+    }
+}
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glColor4f(0.1, 0.64, 0.2, (double)0.75);
-    char s[80];
-    double px, py, pz, val = this->cClickSelectV;
-    ClickPoint point(cClickSelect[0], cClickSelect[1], cClickSelect[2], cClickSelectV);
-    px = point.x;
-    py = point.y;
-    pz = point.z;
-    const char * suffix = "";
-    if(viewValuePhysicalUnits())
+
+void QtGlSliceView::mouseMoveEvent(QMouseEvent* mouseEvent)
+{
+  if(!cImData)
+    {
+    return;
+    }
+  if(cPainting)
+    {
+    double p[3];
+    this->mouseIndex(mouseEvent, p);
+    this->paintTo(p);
+    return;
+    }
+  if(cGrowPreview)
+    {
+    double p[3];
+    this->mouseIndex(mouseEvent, p);
+    this->hoverPoint(p[0], p[1], p[2]);
+    IndexType seed;
+    for (int i = 0; i < 3; ++i)
+      {
+      seed[i] = static_cast<itk::IndexValueType>(cClickSelect[i]);
+      }
+    this->queueRegionPreview(seed);
+    return;
+    }
+  if(cClickMode == CM_SELECT || cClickMode == CM_BOX) 
+    {
+    double p[3];
+    this->mouseIndex(mouseEvent, p);
+    if(cClickMode == CM_SELECT)
       {
-      IndexType index;
-      index[0] = static_cast< itk::IndexValueType >( this->cClickSelect[0] );
-      index[1] = static_cast< itk::IndexValueType >( this->cClickSelect[1] );
-      index[2] = static_cast< itk::IndexValueType >( this->cClickSelect[2] );
+      // The point is selected when the button is released.
+      this->hoverPoint(p[0], p[1], p[2]);
+      return;
+      }
+    }
+  this->schedulePaint();
+}
 
-      suffix = this->cPhysicalUnitsName;
+/** catches the mouse press to react appropriate
+ *  Overriden to catch mousePressEvents. In the CM_PAINT mode the buttons
+ *  paint, erase or pick the labels of the current overlay layer. */
+void QtGlSliceView::mousePressEvent(QMouseEvent* mouseEvent)
+{
+  if (cClickMode == CM_SELECT && cImData)
+    {
+    double p[3];
+    this->mouseIndex(mouseEvent, p);
+    this->hoverPoint(p[0], p[1], p[2]);
+    return;
+    }
+  if ((cClickMode != CM_PAINT && cClickMode != CM_GROW) || !cImData ||
+      imageMode() == IMG_MIP)
+    {
+    this->schedulePaint();
+    return;
+    }
+  this->finishRegionGrowing();
+  double p[3];
+  this->mouseIndex(mouseEvent, p);
+  if (cClickMode == CM_GROW)
+    {
+    if ((mouseEvent->button() & Qt::LeftButton) &&
+        this->makeOverlayPaintable())
+      {
+      selectPoint(p[0], p[1], p[2]);
+      IndexType seed;
+      for (int i = 0; i < 3; ++i)
+        {
+        seed[i] = static_cast<itk::IndexValueType>(cClickSelect[i]);
+        }
+      cGrowPreview = true;
+      this->queueRegionPreview(seed);
+      }
+    return;
+    }
+  if (mouseEvent->button() & Qt::LeftButton)
+    {
+    // Brush, eraser with Shift.
+    cPaintValue = (mouseEvent->modifiers() & Qt::ShiftModifier) ?
+      0 : cPaintLabel;
+    cPainting = this->makeOverlayPaintable();
+    }
+  else if (mouseEvent->button() & Qt::MidButton)
+    {
+    // Pick the label of the brush.
+    QtOverlayLayer::IndexType index;
+    for (int i = 0; i < 3; ++i)
+      {
+      index[i] = static_cast<itk::IndexValueType>(p[i]);
       }
-    if((ImagePixelType)1.5==1.5)
+    QtOverlayLayer* layer = this->overlayLayer();
+    if (layer && layer->isLabelMap() && layer->valueAt(index) > 0)
       {
-      sprintf(s, "(%0.1f%s,  %0.1f%s,  %0.1f%s) = %0.3f",
-              px, suffix,
-              py, suffix,
-              pz, suffix,
-              val);
+      this->setPaintLabel(layer->valueAt(index));
       }
-    else
+    }
+  else if (mouseEvent->button() & Qt::RightButton)
+    {
+    // Eraser.
+    cPaintValue = 0;
+    cPainting = this->makeOverlayPaintable();
+    }
+  if (cPainting)
+    {
+    for (int i = 0; i < 3; ++i)
+      {
+      cPaintLast[i] = p[i];
+      }
+    cOverlayHistory->beginEdit(cOverlayData);
+    this->paintTo(p);
+    }
+}
+
+
+void QtGlSliceView::mouseReleaseEvent(QMouseEvent* mouseEvent)
+{
+  if (cClickMode == CM_SELECT && cImData && !cGrowPreview)
+    {
+    double p[3];
+    this->mouseIndex(mouseEvent, p);
+    this->selectPoint(p[0], p[1], p[2]);
+    this->schedulePaint();
+    return;
+    }
+  if (cGrowPreview)
+    {
+    if (cGrowPreviewQueued)
+      {
+      // The edit of the preview must be open before the region is grown.
+      cGrowPreviewQueued = false;
+      cRenderer->wait();
+      this->previewRegion(cGrowSeed);
+      }
+    IndexType seed;
+    for (int i = 0; i < 3; ++i)
+      {
+      seed[i] = static_cast<itk::IndexValueType>(cClickSelect[i]);
+      }
+    this->startRegionGrowing(seed);
+    return;
+    }
+  if (!cPainting)
+    {
+    return;
+    }
+  if (!cPaintPoints.isEmpty())
+    {
+    // The edit is complete once the whole stroke is painted.
+    cRenderer->wait();
+    this->paintQueuedStroke();
+    }
+  cPainting = false;
+  if (cOverlayHistory->endEdit())
+    {
+    emit overlayPainted();
+    }
+}
+
+
+bool QtGlSliceView::makeOverlayPaintable()
+{
+  if (cOverlayData)
+    {
+    return true;
+    }
+  QtOverlayLayer* layer = this->overlayLayer();
+  if (!layer || !layer->isLabelMap() || layer->labelCount() > 256)
+    {
+    qWarning() << "Only overlays of less than 256 labels can be painted.";
+    return false;
+    }
+  // Decode the layer, e.g. run-length encoded, into an 8-bit image.
+  OverlayPointer image = OverlayType::New();
+  image->CopyInformation(layer->image());
+  image->SetRegions(layer->image()->GetLargestPossibleRegion());
+  image->Allocate();
+  const QtOverlayLayer::SizeType size = layer->size();
+  QVector<unsigned int> values(size[0]);
+  unsigned char* voxel = image->GetBufferPointer();
+  QtOverlayLayer::IndexType index;
+  index[0] = 0;
+  for (unsigned int z = 0; z < size[2]; ++z)
+    {
+    index[2] = z;
+    for (unsigned int y = 0; y < size[1]; ++y, voxel += size[0])
+      {
+      index[1] = y;
+      values.fill(0);
+      layer->sampleRow(index, 0, size[0], NULL, 0, values.data());
+      for (unsigned int x = 0; x < size[0]; ++x)
+        {
+        voxel[x] = static_cast<unsigned char>(values[x]);
+        }
+      }
+    }
+  // A streamed layer only knows its labels once all its slabs are read.
+  if (layer->labelCount() > 256)
+    {
+    qWarning() << "Only overlays of less than 256 labels can be painted.";
+    return false;
+    }
+  cOverlayLayers[cCurrentOverlayLayer].Layer =
+    QSharedPointer<QtOverlayLayer>(new QtLabel8OverlayLayer(image));
+  cOverlayData = image;
+  return true;
+}
+
+
+void QtGlSliceView::paintTo(const double p[3])
+{
+  for (int i = 0; i < 3; ++i)
+    {
+    cPaintPoints.append(p[i]);
+    }
+  // A frame in progress may be sampling the overlay: the stroke is then
+  // painted when the renderer is idle rather than waiting for it here.
+  if (!cRenderer->isBusy())
+    {
+    this->paintQueuedStroke();
+    }
+}
+
+
+void QtGlSliceView::paintQueuedStroke()
+{
+  // The renderer is idle, the analysis may still read the overlay.
+  cOverlayAnalysis->cancel();
+  const QVector<double> points = cPaintPoints;
+  cPaintPoints.clear();
+  for (int i = 0; i + 2 < points.size(); i += 3)
+    {
+    this->paintSegmentTo(points.constData() + i);
+    }
+}
+
+
+void QtGlSliceView::paintSegmentTo(const double p[3])
+{
+  if (!cOverlayData)
+    {
+    // The current layer changed during the stroke.
+    cPainting = false;
+    return;
+    }
+  const int axisJ = cWinOrder[0];
+  const int axisK = cWinOrder[1];
+  const double j0 = cPaintLast[axisJ];
+  const double k0 = cPaintLast[axisK];
+  const double dj = p[axisJ] - j0;
+  const double dk = p[axisK] - k0;
+  for (int i = 0; i < 3; ++i)
+    {
+    cPaintLast[i] = p[i];
+    }
+
+  // Box of the voxels within the radius of the segment.
+  const int radius = cPaintRadius;
+  const int minJ = qMax(static_cast<int>(qMin(j0, j0 + dj)) - radius, 0);
+  const int maxJ = qMin(static_cast<int>(qMax(j0, j0 + dj)) + radius,
+                        static_cast<int>(cDimSize[axisJ]) - 1);
+  const int minK = qMax(static_cast<int>(qMin(k0, k0 + dk)) - radius, 0);
+  const int maxK = qMin(static_cast<int>(qMax(k0, k0 + dk)) + radius,
+                        static_cast<int>(cDimSize[axisK]) - 1);
+  if (minJ > maxJ || minK > maxK)
+    {
+    return;
+    }
+
+  const double length2 = dj*dj + dk*dk;
+  const double radius2 = (radius + 0.5) * (radius + 0.5);
+  const unsigned char value = static_cast<unsigned char>(cPaintValue);
+  const itk::OffsetValueType* offsets = cOverlayData->GetOffsetTable();
+  const itk::OffsetValueType strideJ = offsets[axisJ];
+  OverlayType::IndexType first;
+  first[axisJ] = minJ;
+  first[axisK] = minK;
+  first[cWinOrder[2]] = cWinCenter[cWinOrder[2]];
+  OverlayType::IndexType last = first;
+  last[axisJ] = maxJ;
+  last[axisK] = maxK;
+  OverlayType::IndexType index = first;
+  for (int k = minK; k <= maxK; ++k)
+    {
+    index[axisK] = k;
+    itk::OffsetValueType offset = cOverlayData->ComputeOffset(index);
+    for (int j = minJ; j <= maxJ; ++j, offset += strideJ)
       {
-      sprintf(s, "(%0.1f%s,  %0.1f%s,  %0.1f%s) = %d",
-              px, suffix,
-              py, suffix,
-              pz, suffix,
-              (int)val);
+      // Distance from the center of the voxel to the segment.
+      const double vj = j + 0.5 - j0;
+      const double vk = k + 0.5 - k0;
+      const double t = length2 > 0 ?
+        qBound(0., (vj*dj + vk*dk) / length2, 1.) : 0.;
+      const double ej = vj - t*dj;
+      const double ek = vk - t*dk;
+      if (ej*ej + ek*ek <= radius2)
+        {
+        cOverlayHistory->setVoxel(offset, strideJ, value);
+        }
       }
-    renderText(this->cW /2, this->cH, s);
-    glDisable(GL_BLEND);    
     }
+  this->updateEditedOverlay(cOverlayData, first, last, value);
+}
+
+
+void QtGlSliceView::updateEditedOverlay(OverlayType* image,
+                                        const IndexType& first,
+                                        const IndexType& last,
+                                        unsigned int label)
+{
+  QtLabel8OverlayLayer* layer = NULL;
+  for (int i = 0; i < cOverlayLayers.size() && !layer; ++i)
+    {
+    layer = dynamic_cast<QtLabel8OverlayLayer*>(this->overlayLayer(i));
+    if (layer && layer->overlayImage() != image)
+      {
+      layer = NULL;
+      }
+    }
+  if (!layer)
+    {
+    return;
+    }
+  layer->boxModified(first, last, label);
+  // The statistics are those of the labels before the edit.
+  this->clearOverlayStatistics();
+  const int sliceAxis = cWinOrder[2];
+  if (imageMode() != IMG_MIP &&
+      (cWinCenter[sliceAxis] < first[sliceAxis] ||
+       cWinCenter[sliceAxis] > last[sliceAxis]))
+    {
+    // The current slice is unchanged.
+    return;
+    }
+  // Only the edited box of the frame is updated, the whole frame is
+  // rendered again if the current one cannot be reused.
+  if (cRenderer->renderOverlayBox(this->renderState(), layer,
+                                  first[cWinOrder[0]], last[cWinOrder[0]],
+                                  first[cWinOrder[1]], last[cWinOrder[1]]))
+    {
+    this->schedulePaint();
+    }
+  else
+    {
+    this->update();
+    }
+}
+
+
+QtOverlayEditHistory* QtGlSliceView::overlayEditHistory() const
+{
+  return cOverlayHistory;
+}
+
+
+void QtGlSliceView::undoOverlayEdit()
+{
+  this->finishRegionGrowing();
+  if (cPainting || !cOverlayHistory->canUndo())
+    {
+    return;
+    }
+  // The frame in progress, or the analysis, may be reading the overlay.
+  this->waitForOverlayReaders();
+  const QtOverlayEditHistory::Edit* edit = cOverlayHistory->undo();
+  this->updateEditedOverlay(edit->Image, edit->First, edit->Last,
+                            edit->MaxOldValue);
+  emit overlayPainted();
+}
+
+
+void QtGlSliceView::redoOverlayEdit()
+{
+  this->finishRegionGrowing();
+  if (cPainting || !cOverlayHistory->canRedo())
+    {
+    return;
+    }
+  this->waitForOverlayReaders();
+  const QtOverlayEditHistory::Edit* edit = cOverlayHistory->redo();
+  this->updateEditedOverlay(edit->Image, edit->First, edit->Last,
+                            edit->MaxNewValue);
+  emit overlayPainted();
+}
+
+
+const QtOverlayAnalysis* QtGlSliceView::overlayAnalysis() const
+{
+  return cOverlayAnalysis;
+}
+
+
+bool QtGlSliceView::updateDetails()
+{
+  const double key[17] = {
+    static_cast<double>(this->cWinOrientation),
+    static_cast<double>(this->cWinCenter[0]),
+    static_cast<double>(this->cWinCenter[1]),
+    static_cast<double>(this->cWinCenter[2]),
+    static_cast<double>(this->cDimSize[0]),
+    static_cast<double>(this->cDimSize[1]),
+    static_cast<double>(this->cDimSize[2]),
+    this->cSpacing[0], this->cSpacing[1], this->cSpacing[2],
+    this->cDataMin, this->cDataMax,
+    this->cIWMin, this->cIWMax,
+    static_cast<double>(this->cIWModeMin),
+    static_cast<double>(this->cIWModeMax),
+    static_cast<double>(this->cImageMode)};
+  if(!cDetailsModified && std::equal(key, key + 17, cDetailsKey))
+    {
+    return false;
+    }
+  cDetailsModified = false;
+  std::copy(key, key + 17, cDetailsKey);
 
   QStringList details;
   if(this->orientation() == X_AXIS)
@@ -1725,165 +3144,362 @@ void QtGlSliceView::paintGL(void)
     .arg(this->cIWMax, 0, 'f')
     .arg(IWModeTypeName[this->cIWModeMax]);
   details << QString("View Mode: %1").arg(ImageModeTypeName[this->cImageMode]);
+  cDetailLines = details;
 
-  if(this->cDisplayState & 0x01)
+  if (!cOverlayStatistics.isEmpty())
     {
-    glLoadIdentity();
-    glOrtho(0.0, (double)width(), 0.0, (double)height(), 0.0, 1.0);
-    glMatrixMode(GL_PROJECTION);
-    glViewport(0,0 , width(), height());
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glColor4f(0.9, 0.4, 0.1, (double)0.75);
-
-    int i = 5;
-    foreach(QString text, details)
-      {
-      int posX = 2;
-      int posY = this->cH - (i--) * (h + 2);
-      this->renderText(posX, posY, text);
-      }
-    glDisable(GL_BLEND);
+    details << cOverlayStatistics;
     }
   QString str = details.join("\n");
-  emit detailsChanged(str);
+  if(str != cDetails)
+    {
+    cDetails = str;
+    emit detailsChanged(str);
+    }
+  return true;
+}
 
-  if(viewCrosshairs()
-    && static_cast<int>(cClickSelect[cWinOrder[2]]) ==
-       static_cast<int>(sliceNum()))
+
+bool QtGlSliceView::updateValueText()
+{
+  const double key[5] = {
+    cClickSelect[0], cClickSelect[1], cClickSelect[2], cClickSelectV,
+    viewValuePhysicalUnits() ? 1. : 0.};
+  if(!cValueText.isEmpty() && std::equal(key, key + 5, cValueKey))
     {
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glColor4f(0.1, 0.64, 0.2, 0.75);
-    int posX;
-    if(isXFlipped())
-      {
-      posX = (int)(cW - (cClickSelect[cWinOrder[0]] - cWinMinX) * scale0);
-      }
-    else
-      {
-      posX = (int)((cClickSelect[cWinOrder[0]] - cWinMinX) * scale0);
-      }
-    int posY;
-    if(isYFlipped())
-      {
-      posY = (int)(cH - (cClickSelect[cWinOrder[1]] - cWinMinY) * scale1);
-      }
-    else
-      {
-      posY = (int)((cClickSelect[cWinOrder[1]] - cWinMinY) * scale1);
-      }
-    glBegin(GL_LINES);
-    glVertex2d(0, posY);
-    glVertex2d(posX-2, posY);
-    glVertex2d(posX+2, posY);
-    glVertex2d(this->width()-1, posY);
-    glVertex2d(posX, 0);
-    glVertex2d(posX, posY-2);
-    glVertex2d(posX, posY+2);
-    glVertex2d(posX, this->height()-1);
-    glEnd();
-    glDisable(GL_BLEND);
+    return false;
+    }
+  std::copy(key, key + 5, cValueKey);
+
+  double px, py, pz, val = this->cClickSelectV;
+  ClickPoint point(cClickSelect[0], cClickSelect[1], cClickSelect[2], cClickSelectV);
+  px = point.x;
+  py = point.y;
+  pz = point.z;
+  QString suffix;
+  if(viewValuePhysicalUnits())
+    {
+    suffix = this->cPhysicalUnitsName;
+    }
+  cValueText = QString("(%1%2,  %3%2,  %4%2) = ")
+    .arg(px, 0, 'f', 1)
+    .arg(suffix)
+    .arg(py, 0, 'f', 1)
+    .arg(pz, 0, 'f', 1);
+  if((ImagePixelType)1.5==1.5)
+    {
+    cValueText += QString::number(val, 'f', 3);
     }
+  else
+    {
+    cValueText += QString::number((int)val);
+    }
+  return true;
 }
 
 
-void QtGlSliceView::mouseMoveEvent(QMouseEvent* mouseEvent)
+void QtGlSliceView::analyzeOverlay()
 {
-  if(!cImData)
+  if (cCurrentOverlayLayer < 0)
     {
     return;
     }
-  double scale0 = this->width()/(double)cDimSize[0] * zoom()
-    * fabs(cSpacing[cWinOrder[0]])/fabs(cSpacing[0]);
-  double scale1 = this->height()/(double)cDimSize[1] * zoom()
-    * fabs(cSpacing[cWinOrder[1]])/fabs(cSpacing[0]);
+  if (cOverlayAnalysisPending && cOverlayAnalysis->isRunning())
+    {
+    // The labels have not been edited since it started.
+    return;
+    }
+  cOverlayAnalysisPending = true;
+  cOverlayAnalysisRequest = cOverlayAnalysis->start(cOverlayLayers[cCurrentOverlayLayer].Layer,
+                          cValidImData ? cImData.GetPointer() : NULL,
+                          cSpacing);
+}
 
-  if(cClickMode == CM_SELECT || cClickMode == CM_BOX) 
+
+void QtGlSliceView::onOverlayAnalyzed(int request, const QString& summary)
+{
+  if (!cOverlayAnalysisPending || request != cOverlayAnalysisRequest)
     {
-    double p[3];
-    p[cWinOrder[0]] = cWinMinX + ((1-isXFlipped())*(mouseEvent->x())
-                     + (isXFlipped())*(this->width()-mouseEvent->x()))
-                     / scale0;
-    if(p[cWinOrder[0]]<cWinMinX) 
-      {
-      p[cWinOrder[0]] = cWinMinX;
-      }
-    if(p[cWinOrder[0]]>cWinMaxX) 
-      {
-      p[cWinOrder[0]] = cWinMaxX;
-      }
-    p[cWinOrder[1]] = cWinMinY + (isYFlipped()*mouseEvent->y()
-                     + (1-isYFlipped())*(this->height()-mouseEvent->y()))
-                     / scale1;
-    if(p[cWinOrder[1]]<cWinMinY) 
-      {
-      p[cWinOrder[1]] = cWinMinY;
-      }
-    if(p[cWinOrder[1]]>cWinMaxY) 
+    // The labels have been edited or replaced since.
+    return;
+    }
+  cOverlayAnalysisPending = false;
+  cOverlayStatistics = summary;
+  cDetailsModified = true;
+  this->schedulePaint();
+  if (cSaveOverlayStatistics)
+    {
+    cSaveOverlayStatistics = false;
+    this->saveOverlayStatistics();
+    }
+}
+
+
+void QtGlSliceView::clearOverlayStatistics()
+{
+  cOverlayAnalysisPending = false;
+  cSaveOverlayStatistics = false;
+  cOverlayStatistics.clear();
+  cDetailsModified = true;
+}
+
+
+void QtGlSliceView::waitForOverlayReaders()
+{
+  cRenderer->wait();
+  // Its result would be of the labels before the edit.
+  cOverlayAnalysis->cancel();
+}
+
+
+void QtGlSliceView::saveOverlayStatistics()
+{
+  if (cOverlayStatistics.isEmpty() || cOverlayAnalysis->isRunning())
+    {
+    // Saved once analyzed, the analysis in progress may be of edited
+    // labels.
+    cSaveOverlayStatistics = true;
+    this->analyzeOverlay();
+    return;
+    }
+  QString fileName = QFileDialog::getSaveFileName(
+    this, "Please select a file name", "*.csv", "");
+  if (fileName.isNull())
+    {
+    return;
+    }
+  if (!cOverlayAnalysis->write(fileName))
+    {
+    qWarning() << "Cannot write the overlay statistics to" << fileName;
+    }
+}
+
+
+ClickModeType QtGlSliceView::clickMode() const
+{
+  return cClickMode;
+}
+
+
+void QtGlSliceView::setClickMode(ClickModeType newClickMode)
+{
+  cClickMode = newClickMode;
+  cPainting = false;
+  cPaintPoints.clear();
+}
+
+
+int QtGlSliceView::paintLabel() const
+{
+  return cPaintLabel;
+}
+
+
+void QtGlSliceView::setPaintLabel(int label)
+{
+  cPaintLabel = qBound(1, label, 255);
+}
+
+
+int QtGlSliceView::paintRadius() const
+{
+  return cPaintRadius;
+}
+
+
+void QtGlSliceView::setPaintRadius(int radius)
+{
+  cPaintRadius = qMax(radius, 0);
+}
+
+
+double QtGlSliceView::growMinimum() const
+{
+  return cGrowMin > cGrowMax ? cIWMin : cGrowMin;
+}
+
+
+double QtGlSliceView::growMaximum() const
+{
+  return cGrowMin > cGrowMax ? cIWMax : cGrowMax;
+}
+
+
+bool QtGlSliceView::isGrowingRegion() const
+{
+  return cGrowPending;
+}
+
+
+void QtGlSliceView::setGrowInterval(double minimum, double maximum)
+{
+  cGrowMin = minimum;
+  cGrowMax = maximum;
+}
+
+
+void QtGlSliceView::growRegion()
+{
+  if (!cImData || imageMode() == IMG_MIP)
+    {
+    return;
+    }
+  this->finishRegionGrowing();
+  if (!this->makeOverlayPaintable())
+    {
+    return;
+    }
+  IndexType seed;
+  for (int i = 0; i < 3; ++i)
+    {
+    seed[i] = static_cast<itk::IndexValueType>(cClickSelect[i]);
+    }
+  cRenderer->wait();
+  this->previewRegion(seed);
+  this->startRegionGrowing(seed);
+}
+
+
+void QtGlSliceView::queueRegionPreview(const IndexType& seed)
+{
+  cGrowSeed = seed;
+  if (!cGrowPreviewQueued)
+    {
+    cGrowPreviewQueued = true;
+    QMetaObject::invokeMethod(this, "applyRegionPreview",
+                              Qt::QueuedConnection);
+    }
+}
+
+
+void QtGlSliceView::applyRegionPreview()
+{
+  if (!cGrowPreviewQueued || !cGrowPreview)
+    {
+    cGrowPreviewQueued = false;
+    return;
+    }
+  if (cRenderer->isBusy())
+    {
+    // Previewed by onRendererIdle().
+    return;
+    }
+  cGrowPreviewQueued = false;
+  this->previewRegion(cGrowSeed);
+}
+
+
+void QtGlSliceView::previewRegion(const IndexType& seed)
+{
+  // The analysis may be reading the overlay.
+  cOverlayAnalysis->cancel();
+  IndexType first = cGrowFirst;
+  IndexType last = cGrowLast;
+  if (cOverlayHistory->isEditing())
+    {
+    cOverlayHistory->cancelEdit();
+    }
+  else
+    {
+    cGrowOverlay = cOverlayData;
+    }
+  cOverlayHistory->beginEdit(cGrowOverlay);
+  const int axes[2] = {cWinOrder[0], cWinOrder[1]};
+  QtRegionGrowing::Region region;
+  QtRegionGrowing::grow(cImData, seed, growMinimum(), growMaximum(),
+                        axes, 2, region);
+  foreach (const QtRegionGrowing::Span& span, region.Spans)
+    {
+    for (int i = 0; i < span.Length; ++i)
       {
-      p[cWinOrder[1]] = cWinMaxY;
+      cOverlayHistory->setVoxel(span.Offset + i * region.Stride,
+                                region.Stride, cPaintLabel);
       }
-    if(imageMode() != IMG_MIP)
+    }
+  cGrowFirst = region.First;
+  cGrowLast = region.Last;
+  // Both the old and the new preview are rendered again.
+  for (int i = 0; i < 3; ++i)
+    {
+    if (first[i] > last[i])
       {
-      p[cWinOrder[2]] = cWinCenter[cWinOrder[2]];
+      first[i] = cGrowFirst[i];
+      last[i] = cGrowLast[i];
       }
-    else
+    else if (cGrowFirst[i] <= cGrowLast[i])
       {
-      p[cWinOrder[2]] = cWinZBuffer[(int)p[cWinOrder[0]]
-                        - cWinMinX 
-                       + ((int)p[cWinOrder[1]]
-                      - cWinMinY)
-                      * cWinDataSizeX];
+      first[i] = qMin(first[i], cGrowFirst[i]);
+      last[i] = qMax(last[i], cGrowLast[i]);
       }
-    if(cClickMode == CM_SELECT)
+    }
+  if (first[0] <= last[0])
+    {
+    this->updateEditedOverlay(cGrowOverlay, first, last, cPaintLabel);
+    }
+}
+
+
+void QtGlSliceView::startRegionGrowing(const IndexType& seed)
+{
+  cGrowPreview = false;
+  cGrowPending = true;
+  if (!cRegionGrowing->start(cImData, seed, growMinimum(), growMaximum()))
+    {
+    qWarning() << "The volume is too large to grow a region in,"
+               << "only the region of the slice is kept.";
+    this->finishRegionGrowing();
+    }
+}
+
+
+void QtGlSliceView::onRegionGrown()
+{
+  if (!cGrowPending || cRegionGrowing->isRunning())
+    {
+    // A newer region is being grown, or the region has been finished.
+    return;
+    }
+  cGrowPending = false;
+  this->waitForOverlayReaders();
+  // The voxels of the preview are already set.
+  const QtRegionGrowing::Region& region = cRegionGrowing->region();
+  foreach (const QtRegionGrowing::Span& span, region.Spans)
+    {
+    for (int i = 0; i < span.Length; ++i)
       {
-      selectPoint(p[0], p[1], p[2]);
+      cOverlayHistory->setVoxel(span.Offset + i * region.Stride,
+                                region.Stride, cPaintLabel);
       }
     }
-  updateGL();
+  cGrowFirst.Fill(0);
+  cGrowLast.Fill(-1);
+  if (cOverlayHistory->endEdit())
+    {
+    this->updateEditedOverlay(cGrowOverlay, region.First, region.Last,
+                              cPaintLabel);
+    emit overlayPainted();
+    }
+  cGrowOverlay = NULL;
 }
 
-/** catches the mouse press to react appropriate
- *  Overriden to catch mousePressEvents and to start an internal
- *  timer, which calls the appropriate interaction routine */
-void QtGlSliceView::mousePressEvent(QMouseEvent* mouseEvent)
+
+void QtGlSliceView::finishRegionGrowing()
 {
-   if (mouseEvent->button() & Qt::LeftButton)
-     {
-      if (mouseEvent->button() & Qt::ShiftModifier)
-        {
-         // left mouse mouse and shift button
-         /*this->mouseEventActive = true;
-         QObject::connect(this->stepTimer, SIGNAL(timeout()),
-                           this->shiftLeftButtonFunction);*/
-        }
-     }
-   else if (mouseEvent->button() & Qt::MidButton)
-     {
-      // middle mouse button
-      //this->mouseEventActive = true;
-      //QObject::connect(this->stepTimer, SIGNAL(timeout()),
-      //                  this->middleButtonFunction);
-     }
-   else if (mouseEvent->button() & Qt::RightButton)
-     {
-      // right mouse button
-      //this->mouseEventActive = true;
-      //QObject::connect(this->stepTimer, SIGNAL(timeout()),
-      //                  this, this->rightButtonFunction);
-     }
-/*
-   if(this->mouseEventActive) {
-      this->currentMousePos[0] = event->x();
-      this->currentMousePos[1] = event->y();
-      this->lastMousePos[0] = event->x();
-      this->lastMousePos[1] = event->y();
-      this->firstCall = true;
-      this->stepTimer->start(this->interactionTime);
-   }*/
-
-   this->updateGL();
+  if (!cGrowPreview && !cGrowPending)
+    {
+    return;
+    }
+  cRegionGrowing->cancel();
+  cGrowPreview = false;
+  cGrowPending = false;
+  cGrowPreviewQueued = false;
+  cGrowFirst.Fill(0);
+  cGrowLast.Fill(-1);
+  cGrowOverlay = NULL;
+  if (cOverlayHistory->endEdit())
+    {
+    emit overlayPainted();
+    }
 }
 
 
@@ -1891,7 +3507,34 @@ void QtGlSliceView::changeSlice(int value)
 {
   this->setSliceNum(value);
   this->update();
-  this->paintGL();
+}
+
+
+void QtGlSliceView::stepSlice(int step)
+{
+  if(!cSliceStepPending)
+    {
+    cSliceStepPending = true;
+    cSliceStepTarget = this->sliceNum();
+    QMetaObject::invokeMethod(this, "applySliceStep", Qt::QueuedConnection);
+    }
+  cSliceStepTarget = qBound(0, cSliceStepTarget + step,
+                            static_cast<int>(cDimSize[cWinOrder[2]]) - 1);
+}
+
+
+void QtGlSliceView::applySliceStep()
+{
+  if(!cSliceStepPending)
+    {
+    return;
+    }
+  cSliceStepPending = false;
+  if(cSliceStepTarget != this->sliceNum())
+    {
+    this->setSliceNum(cSliceStepTarget);
+    this->update();
+    }
 }
 
 
@@ -1928,8 +3571,8 @@ int QtGlSliceView::maxSliceNum() const
 }
 
 
-void QtGlSliceView::selectPoint(double newX, double newY, double newZ)
-  {    
+void QtGlSliceView::setClickSelect(double newX, double newY, double newZ)
+{
   cClickSelect[0] = newX;
   if(cClickSelect[0]<0)
     cClickSelect[0] = 0;
@@ -1947,7 +3590,68 @@ void QtGlSliceView::selectPoint(double newX, double newY, double newZ)
     cClickSelect[2] = 0;
   if(cClickSelect[2] >= cDimSize[2])
     cClickSelect[2] = cDimSize[2]-1;
-  
+}
+
+
+void QtGlSliceView::hoverPoint(double newX, double newY, double newZ)
+{
+  this->setClickSelect(newX, newY, newZ);
+  cClickSelectV = this->frameValue(cClickSelect);
+  if(!cHoverPending)
+    {
+    cHoverPending = true;
+    QMetaObject::invokeMethod(this, "paintHoveredPoint",
+                              Qt::QueuedConnection);
+    }
+}
+
+
+void QtGlSliceView::paintHoveredPoint()
+{
+  if(!cHoverPending)
+    {
+    // selectPoint() has emitted the position since.
+    return;
+    }
+  cHoverPending = false;
+  emit positionChanged(cClickSelect[0], cClickSelect[1], cClickSelect[2],
+                       cClickSelectV);
+  this->schedulePaint();
+}
+
+
+double QtGlSliceView::frameValue(const double p[3]) const
+{
+  const int x = static_cast<int>(p[cWinOrder[0]]);
+  const int y = static_cast<int>(p[cWinOrder[1]]);
+  {
+  QMutexLocker locker(&cWinDataMutex);
+  // The intensities are sampled as such in these modes only.
+  if(cWinValueFrame
+     && (cWinValueMode == IMG_VAL || cWinValueMode == IMG_INV
+         || cWinValueMode == IMG_LOG)
+     && cWinValueAxis == cWinOrder[2]
+     && cWinValueSlice == static_cast<int>(p[cWinOrder[2]])
+     && cWinValueBox.contains(x - cWinValueMinX, y - cWinValueMinY))
+    {
+    return cWinValueData[(x - cWinValueMinX)
+                         + (y - cWinValueMinY) * cWinDataSizeX]
+      * cWinValueScale + cWinValueOffset;
+    }
+  }
+  ImageType::IndexType ind;
+  ind[0] = (unsigned long)p[0];
+  ind[1] = (unsigned long)p[1];
+  ind[2] = (unsigned long)p[2];
+  return cImData->GetPixel(ind);
+}
+
+
+void QtGlSliceView::selectPoint(double newX, double newY, double newZ)
+  {    
+  this->setClickSelect(newX, newY, newZ);
+  cHoverPending = false;
+
   ImageType::IndexType ind;
   
   ind[0] = (unsigned long)cClickSelect[0];
@@ -1962,6 +3666,7 @@ void QtGlSliceView::selectPoint(double newX, double newY, double newZ)
     }
   ClickPoint pointClicked(cClickSelect[0], cClickSelect[1], cClickSelect[2], cClickSelectV);
   cClickedPoints.push_front(pointClicked);
+  cClickedPointsModified = true;
 
   if(cClickSelectCallBack != NULL)
     {
@@ -2058,7 +3763,7 @@ void QtGlSliceView::setIWMin(double value)
     return;
     }
   cIWMin = value;
-  update();
+  this->updateIntensityWindow();
   emit iwMinChanged(cIWMin);
 }
 
@@ -2071,7 +3776,7 @@ void QtGlSliceView::setIWMax(double value)
     return;
     }
   cIWMax = value;
-  update();
+  this->updateIntensityWindow();
   emit iwMaxChanged(cIWMax);
 }
 
@@ -2082,10 +3787,7 @@ bool QtGlSliceView::clickedPoint(int index, ClickPoint& point)
     {
     return false;
     }
-  ClickPointListType::const_iterator j = cClickedPoints.begin();
-
-  std::advance (j,static_cast<int>(index));
-  point = *j;
+  point = cClickedPoints.at(index);
   return true;
 
 }
@@ -2106,12 +3808,14 @@ int QtGlSliceView::maxClickedPointsStored() const
 void QtGlSliceView::clearClickedPointsStored()
 {
   cClickedPoints.clear();
+  cClickedPointsModified = true;
 }
 
 
 void QtGlSliceView::deleteLastClickedPointsStored()
 {
   cClickedPoints.pop_front();
+  cClickedPointsModified = true;
 }
 
 
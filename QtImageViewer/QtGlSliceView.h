@@ -24,28 +24,52 @@ limitations under the License.
 #define __QtGlSliceView_h
 
 // Qt includes
+#include <QColor>
 #include <QGLWidget>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QRect>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVector>
 #include <QtOpenGL/qgl.h>
 
 // ITK includes
 #include "itkImage.h"
 #include "itkColorTable.h"
+#include "itkRGBAPixel.h"
+#include "itkRGBPixel.h"
 
 // ImageViewer includes
+#include "QtGlyphAtlas.h"
 #include "QtImageViewer_Export.h"
+class QGLFramebufferObject;
+class QtOverlayLayer;
+class QtOverlayAnalysis;
+class QtOverlayEditHistory;
+class QtRegionGrowing;
+class QtSliceRenderer;
+class QtSliceShader;
+class QtSliceTexture;
+struct QtSliceRenderState;
 
 using namespace itk;
 
 /*! Clicking in a window will cause different events
 *  NOP = nothing
 *  SELECT = report pixel info
+*  PAINT = paint the labels of the current overlay layer
+*  GROW = grow a region of the current overlay layer from the clicked point
 */
-const int NUM_ClickModeTypes = 3;
-typedef enum {CM_NOP, CM_SELECT, CM_BOX} ClickModeType;
-const char ClickModeTypeName[3][7] =
+const int NUM_ClickModeTypes = 5;
+typedef enum {CM_NOP, CM_SELECT, CM_BOX, CM_PAINT, CM_GROW} ClickModeType;
+const char ClickModeTypeName[5][7] =
   {{'N', 'O', 'P', '\0', ' ', ' ', ' '},
   {'S', 'e', 'l', 'e', 'c', 't', '\0'},
-  {'B', 'o', 'x', '\0', ' ', ' ', ' '}};
+  {'B', 'o', 'x', '\0', ' ', ' ', ' '},
+  {'P', 'a', 'i', 'n', 't', '\0', ' '},
+  {'G', 'r', 'o', 'w', '\0', ' ', ' '}};
 
   /*! Handling of values outside intensity window range - values above 
   *    and below can be handled separately
@@ -73,6 +97,16 @@ const char IWModeTypeName[3][5] =
   {'M', 'a', 'x', '\0', ' '},
   {'F', 'l', 'i', 'p', '\0'}};
 
+  /*! Display of the overlay
+  *  OVERLAY_FILLED = labels are filled with their color
+  *  OVERLAY_OUTLINE = only the boundaries of the labels are drawn
+*/
+const int NUM_OverlayModeTypes = 2;
+typedef enum {OVERLAY_FILLED, OVERLAY_OUTLINE} OverlayModeType;
+const char OverlayModeTypeName[2][8] =
+  {{'F', 'i', 'l', 'l', 'e', 'd', '\0', ' '},
+  {'O', 'u', 't', 'l', 'i', 'n', 'e', '\0'}};
+
 const int NUM_cWinOrientation = 3;
 enum OrientationType{
   X_AXIS=0,
@@ -117,6 +151,7 @@ class QtImageViewer_EXPORT QtGlSliceView :
   Q_PROPERTY(double iwMin READ iwMin WRITE setIWMin NOTIFY iwMinChanged);
   Q_PROPERTY(double iwMax READ iwMax WRITE setIWMax NOTIFY iwMaxChanged);
   Q_PROPERTY(double overlayOpacity READ overlayOpacity WRITE setOverlayOpacity NOTIFY overlayOpacityChanged);
+  Q_PROPERTY(OverlayModeType overlayMode READ overlayMode WRITE setOverlayMode);
   Q_PROPERTY(int sliceNum READ sliceNum WRITE setSliceNum NOTIFY sliceNumChanged);
   Q_PROPERTY(bool viewCrosshairs READ viewCrosshairs WRITE setViewCrosshairs);
   Q_PROPERTY(bool viewValue READ viewValue WRITE setViewValue);
@@ -142,6 +177,19 @@ class QtImageViewer_EXPORT QtGlSliceView :
   /// \sa maxDisplayStates, setMaxDisplayStates(),
   /// displayState
   Q_PROPERTY(int maxDisplayStates READ maxDisplayStates WRITE setMaxDisplayStates);
+  /// Maximum number of threads used by the viewers and ITK, 0 for one per
+  /// core. It is shared by all the views of the process.
+  /// \sa adaptiveThreadCount, threadAffinity()
+  Q_PROPERTY(int maxThreadCount READ maxThreadCount WRITE setMaxThreadCount);
+  /// If true, fewer threads are used when the machine is loaded.
+  /// \sa maxThreadCount
+  Q_PROPERTY(bool adaptiveThreadCount READ adaptiveThreadCount WRITE setAdaptiveThreadCount);
+  /// If true, the intensities are windowed by a fragment shader when the
+  /// GL context supports it, so that changing the intensity window does
+  /// not reslice the image. The MIP is always windowed on the CPU.
+  /// True by default.
+  /// \sa isWindowedByShader()
+  Q_PROPERTY(bool shaderWindowing READ shaderWindowing WRITE setShaderWindowing);
 
 public:
   typedef QGLWidget                        Superclass;
@@ -149,6 +197,9 @@ public:
   typedef unsigned char                    OverlayPixelType;
   typedef itk::Image<ImagePixelType,3>     ImageType;
   typedef itk::Image<OverlayPixelType,3>   OverlayType;
+  typedef itk::Image<unsigned short,3>     Label16OverlayType;
+  typedef itk::Image<itk::RGBPixel<unsigned char>,3>  RGBOverlayType;
+  typedef itk::Image<itk::RGBAPixel<unsigned char>,3> RGBAOverlayType;
   typedef ImageType::Pointer      ImagePointer;
   typedef OverlayType::Pointer    OverlayPointer;
   typedef ImageType::RegionType   RegionType;
@@ -160,15 +211,81 @@ public:
 public:
 
   QtGlSliceView(QWidget *parent = 0);
+  virtual ~QtGlSliceView();
 
   virtual const ImagePointer & inputImage(void) const;
 
   /*! Return a pointer to the overlay data */
+  /// Return the 8-bit label overlay, NULL if the overlay is not stored as
+  /// an 8-bit image.
+  /// \sa overlayLayer()
   const OverlayPointer &inputOverlay(void) const;
 
-  /*! Get the opacity of the overlay */
+  /// Return the current overlay layer, whatever its type.
+  /// \sa currentOverlayLayer()
+  QtOverlayLayer* overlayLayer() const;
+
+  /// Return the number of overlay layers.
+  int overlayLayerCount() const;
+
+  /// Return the overlay layer at index, NULL if there is none.
+  QtOverlayLayer* overlayLayer(int index) const;
+
+  /// Return the index of the layer that the overlay opacity, colors and
+  /// keys apply to, -1 if there is no overlay.
+  int currentOverlayLayer() const;
+
+  /// Return the opacity of the overlay layer at index.
+  double overlayLayerOpacity(int index) const;
+
+  /// Return whether the overlay layer at index is drawn.
+  bool isOverlayLayerVisible(int index) const;
+
+  /// Return the colors of the labels of the overlay layer at index.
+  ColorTableType* overlayColorTable(int index) const;
+
+  /// Return whether the label of the current overlay layer is drawn.
+  bool isLabelVisible(int label) const;
+
+  /// Return the color of the label of the current overlay layer.
+  QColor labelColor(int label) const;
+
+  /// Return the label of the current overlay layer at the last clicked
+  /// point, 0 if there is none.
+  int clickedLabel() const;
+
+  /// Return what clicking in the window does.
+  ClickModeType clickMode() const;
+
+  /// Return the label painted by the brush.
+  int paintLabel() const;
+
+  /// Return the radius of the brush and the eraser, in voxels.
+  int paintRadius() const;
+
+  /// Return the undo history of the paint strokes, e.g. to change its
+  /// memory limit.
+  QtOverlayEditHistory* overlayEditHistory() const;
+
+  /// Return the intensity interval of the region growing, the intensity
+  /// window unless set by setGrowInterval().
+  double growMinimum() const;
+  double growMaximum() const;
+
+  /// Return true while a region is being grown in the background.
+  bool isGrowingRegion() const;
+
+  /// Return the statistics of the labels computed by analyzeOverlay().
+  const QtOverlayAnalysis* overlayAnalysis() const;
+
+  /*! Get the opacity of the current overlay layer */
   double overlayOpacity(void) const;
 
+  /// Return whether the labels are filled or outlined.
+  OverlayModeType overlayMode(void) const;
+
+  /// Return the colors of the labels of the current overlay layer.
+  /// updateOverlayLUT() is called before each frame to pick up any change.
   ColorTableType *colorTable(void) const;
 
   virtual QSize minimumSizeHint()const;
@@ -177,8 +294,23 @@ public:
   virtual bool hasHeightForWidth()const;
   virtual int heightForWidth(int width)const;
 
+  /// Reslice the current slice in the background and repaint the view
+  /// when the new frame is available. The slice is resliced once per
+  /// turn of the event loop however many times it is called.
   virtual void update();
 
+  /// Number of frames whose rendering has been requested, and number of
+  /// repaints, since the view was created or resetFrameCounts() was
+  /// called. Each action on the view should add one of each at most.
+  int renderedFrames() const;
+  int paintedFrames() const;
+  /// Number of rendered frames that have been displayed, and of frames
+  /// skipped because a newer one was requested before they were rendered,
+  /// or rendered before they were repainted.
+  int displayedFrames() const;
+  int droppedFrames() const;
+  void resetFrameCounts();
+
   /*! What slice is being viewed */
   int sliceNum(void) const;
 
@@ -186,6 +318,8 @@ public:
 
   virtual void mouseMoveEvent(QMouseEvent *event) ;
 
+  virtual void mouseReleaseEvent(QMouseEvent *event);
+
   virtual void keyPressEvent(QKeyEvent* event);
 
   virtual void resizeEvent(QResizeEvent *event);
@@ -293,6 +427,34 @@ public:
   /// \sa maxDisplayStates, maxDisplayStates()
   void setMaxDisplayStates(int stateNumber);
 
+  /// Return the maxThreadCount property value.
+  /// \sa maxThreadCount, setMaxThreadCount()
+  int maxThreadCount() const;
+
+  /// Return the adaptiveThreadCount property value.
+  /// \sa adaptiveThreadCount, setAdaptiveThreadCount()
+  bool adaptiveThreadCount() const;
+
+  /// Return the shaderWindowing property value.
+  /// \sa shaderWindowing, setShaderWindowing()
+  bool shaderWindowing() const;
+
+  /// Return true if the frames are windowed by the fragment shader: the
+  /// shaderWindowing property is set, the GL context supports the shader
+  /// and the image mode is not the MIP.
+  bool isWindowedByShader() const;
+
+  /// Return a copy of the last composited frame: opaque RGBA8 pixels
+  /// (premultiplied gray levels and overlays), row by row as uploaded by
+  /// paintGL(). The frame is frameSize() large. If it is windowed by the
+  /// fragment shader, it is windowed on the CPU as the shader does.
+  QVector<unsigned int> frame() const;
+  QSize frameSize() const;
+
+  /// Return the cores the threads are bound to, empty if not bound.
+  /// \sa setThreadAffinity()
+  QList<int> threadAffinity() const;
+
 public slots:
   /// Set the displayState property value.
   /// \sa displayState, displayState()
@@ -300,6 +462,23 @@ public slots:
 
   void setSingleStep(double step);
 
+  /// Set the maxThreadCount property value.
+  /// \sa maxThreadCount, maxThreadCount()
+  void setMaxThreadCount(int count);
+
+  /// Set the adaptiveThreadCount property value.
+  /// \sa adaptiveThreadCount, adaptiveThreadCount()
+  void setAdaptiveThreadCount(bool adaptive);
+
+  /// Set the shaderWindowing property value.
+  /// \sa shaderWindowing, shaderWindowing()
+  void setShaderWindowing(bool enable);
+
+  /// Bind the threads of the viewers to the given cores, and the ITK
+  /// threads started afterwards. Only supported on Linux.
+  /// \sa threadAffinity()
+  void setThreadAffinity(const QList<int>& cpus);
+
   void setValidOverlayData(bool validOverlayData);
 
   void clearClickedPointsStored();
@@ -320,14 +499,55 @@ public slots:
   /*! Specify the slice to view */
   void setSliceNum(int newSliceNum);
 
-  /*! Specify the opacity of the overlay */
+  /*! Specify the opacity of the current overlay layer */
   void  setOverlayOpacity(double newOverlayOpacity);
 
+  /*! Fill the labels of the overlay or only draw their boundaries */
+  void setOverlayMode(OverlayModeType newOverlayMode);
+  void setOverlayMode(const char* newOverlayMode);
+
   /*! Specify the 3D image to view slice by slice */
   virtual void setInputImage(ImageType * newImData);
 
   /*! Specify the 3D image to view as an overlay */
   void setInputOverlay(OverlayType * newOverlayData);
+  void setInputOverlay(Label16OverlayType * newOverlayData);
+  void setInputOverlay(RGBOverlayType * newOverlayData);
+  void setInputOverlay(RGBAOverlayType * newOverlayData);
+
+  /// Specify the overlay to view, replacing the current layer. The view
+  /// takes ownership of the layer.
+  void setOverlayLayer(QtOverlayLayer * newOverlayLayer);
+
+  /// Add an overlay layer over the others and make it the current one.
+  /// The view takes ownership of the layer. Return its index, -1 if its
+  /// size does not match the image.
+  int addOverlayLayer(QtOverlayLayer * newOverlayLayer);
+
+  /// Remove the overlay layer at index.
+  void removeOverlayLayer(int index);
+
+  /// Select the layer that the overlay opacity, colors and keys apply to.
+  void setCurrentOverlayLayer(int index);
+
+  /// Set the opacity of the overlay layer at index.
+  void setOverlayLayerOpacity(int index, double opacity);
+
+  /// Show or hide the overlay layer at index.
+  void setOverlayLayerVisible(int index, bool visible);
+
+  /// Show or hide a label of the current overlay layer. Only the colors
+  /// of the overlay are updated, the slice is not resampled.
+  void setLabelVisible(int label, bool visible);
+
+  /// Override the color of a label of the current overlay layer.
+  void setLabelColor(int label, const QColor& color);
+
+  /// Hide all the labels of the current overlay layer but label.
+  void isolateLabel(int label);
+
+  /// Show all the labels of the current overlay layer.
+  void showAllLabels();
 
   void setOverlay(bool newOverlay);
   void setIWModeMin(IWModeType newIWModeMin);
@@ -398,8 +618,48 @@ public slots:
   void zoomOut();
   void showHelp();
 
+  /// Select the voxel: its value is read from the image, it is added to
+  /// the clicked points, and the callbacks and positionChanged() are
+  /// called.
   void selectPoint(double newX, double newY, double newZ);
 
+  /// In the CM_PAINT mode, the left button paints the label of the brush
+  /// into the current slice, the right button (or Shift + left) erases and
+  /// the middle button picks the label of the brush.
+  void setClickMode(ClickModeType newClickMode);
+
+  /// Set the label painted by the brush, in [1, 255].
+  void setPaintLabel(int label);
+
+  /// Set the radius of the brush and the eraser, in voxels.
+  void setPaintRadius(int radius);
+
+  /// Set the intensity interval of the voxels added to a grown region.
+  /// If minimum is greater than maximum, the intensity window is used.
+  void setGrowInterval(double minimum, double maximum);
+
+  /// Fill the region of the voxels within the grow interval connected to
+  /// the last clicked point with the label of the brush: at once in the
+  /// current slice, then in the volume in the background.
+  /// In the CM_GROW mode, pressing the left button previews the region of
+  /// the point under the mouse in the slice, and releasing it grows it.
+  void growRegion();
+
+  /// Undo the last paint stroke.
+  void undoOverlayEdit();
+
+  /// Redo the last undone paint stroke.
+  void redoOverlayEdit();
+
+  /// Compute the connected components and the statistics of the labels of
+  /// the current overlay layer in the background. They are shown in the
+  /// details once computed.
+  void analyzeOverlay();
+
+  /// Write the statistics of the labels to a comma separated values file,
+  /// once they are computed.
+  void saveOverlayStatistics();
+
 signals:
 
   void imageChanged();
@@ -411,11 +671,48 @@ signals:
   void detailsChanged(QString s);
   void orientationChanged(int maximum);
   void overlayOpacityChanged(double opacity);
+  void currentOverlayLayerChanged(int index);
+  /// Emitted when labels of the current overlay layer are shown, hidden
+  /// or recolored.
+  void labelsChanged();
+  /// Emitted when the voxels of an overlay have been edited: at the end of
+  /// each paint stroke, and when a stroke is undone or redone.
+  void overlayPainted();
   void validOverlayDataChanged(bool valid);
   void maxClickedPointsStoredChanged(int max);
   void displayStateChanged(int state);
 
+protected slots:
+  /// Called when the renderer has swapped a new frame into the front
+  /// buffers.
+  void onSliceRendered();
+
+  /// Called when the renderer has no frame left to render: the queued
+  /// stroke is painted and the queued region previewed.
+  void onRendererIdle();
+
+  /// Preview the region of the seed queued by queueRegionPreview().
+  void applyRegionPreview();
+
+  /// Request the rendering of the frame scheduled by scheduleRender().
+  void renderScheduledFrame();
+
+  /// Move to the slice targeted by the steps of stepSlice().
+  void applySliceStep();
+
+  /// Emit positionChanged() for the voxel of hoverPoint(), then schedule
+  /// a repaint.
+  void paintHoveredPoint();
+
+  /// Called when the region has been grown in the volume: its voxels
+  /// are written into the overlay.
+  void onRegionGrown();
+
+  /// Called when the analysis started by analyzeOverlay() is done.
+  void onOverlayAnalyzed(int request, const QString& summary);
+
 protected:
+  friend class QtSliceRenderer;
 
   void initializeGL();
   void resizeGL(int w, int h);
@@ -425,17 +722,183 @@ protected:
   /// \sa displayState
   virtual int nextDisplayState(int state)const;
 
+  /// Return the box of the frame drawn from (x, y) with the scales that
+  /// is visible in the view.
+  QRect visibleFrameBox(double x, double y,
+                        double scaleX, double scaleY) const;
+
+  /// Draw the base layer, the frame with its overlay, from (frameX,
+  /// frameY) with the scales, uploading the pixels changed since the last
+  /// call. The annotations are drawn over it by paintGL().
+  void paintBaseLayer(int frameX, int frameY,
+                      double frameScaleX, double frameScaleY);
+
+  /// (Re)create cBaseLayer at the size of the view. Return false if the
+  /// base layer cannot be cached, in which case paintGL() draws it each
+  /// time.
+  bool updateBaseLayer();
+
+  /// Draw the cached base layer over the whole view.
+  void drawBaseLayer() const;
+
+  /// Rebuild cClickedPointVertices if the clicked points or the slice
+  /// changed since it was last built.
+  void updateClickedPointVertices();
+
+  /// Draw the 2D vertices as primitives of mode with one glDrawArrays().
+  static void drawVertices(GLenum mode, const QVector<GLfloat>& vertices);
+
+  /// Return a copy of the state needed to reslice the current frame.
+  QtSliceRenderState renderState() const;
+
+  /// Rebuild the LUT of each overlay layer from its color table and its
+  /// opacity if either has changed.
+  void updateOverlayLUT();
+
+  /// Set p to the index of the voxel under the mouse.
+  void mouseIndex(const QMouseEvent* event, double p[3]) const;
+
+  /// Make the current overlay layer an 8-bit label image that can be
+  /// painted, decoding it if needed. Return false if it cannot be.
+  bool makeOverlayPaintable();
+
+  /// Queue the segment from the last point of the stroke to p, and paint
+  /// the queued segments unless the renderer is busy.
+  void paintTo(const double p[3]);
+
+  /// Paint the segments queued by paintTo(). The renderer must be idle.
+  void paintQueuedStroke();
+
+  /// Paint cPaintValue along the segment from cPaintLast to p in the
+  /// current slice.
+  void paintSegmentTo(const double p[3]);
+
+  /// Update the overlay layer of image, and the frame, after the voxels of
+  /// the box [first, last] have been set to label or cleared. Only the box
+  /// of the current slice is rendered again.
+  void updateEditedOverlay(OverlayType* image, const IndexType& first,
+                           const IndexType& last, unsigned int label);
+
+  /// Preview the region of seed on the next turn of the event loop, once
+  /// the renderer is idle. The seeds queued meanwhile replace each other.
+  void queueRegionPreview(const IndexType& seed);
+
+  /// Replace the region previewed in the current slice by the region of
+  /// seed in the current slice. The renderer must be idle.
+  void previewRegion(const IndexType& seed);
+
+  /// Start growing the region of seed in the volume, in the background.
+  void startRegionGrowing(const IndexType& seed);
+
+  /// Stop growing the region, keeping what has been written into the
+  /// overlay, i.e. the preview if it is not done in the volume.
+  void finishRegionGrowing();
+
+  /// Forget the statistics of the labels, and the analysis in progress,
+  /// after the labels have changed.
+  void clearOverlayStatistics();
+
+  /// Block until no frame reads the overlay layers, and cancel the
+  /// analysis, before they are edited.
+  void waitForOverlayReaders();
+
+  /// Build the details again if the state they show has changed, and emit
+  /// detailsChanged() if they differ. Return true if they were built.
+  bool updateDetails();
+
+  /// Build the value text again if the clicked point has changed. Return
+  /// true if it was built.
+  bool updateValueText();
+
+  /// Recomposite the overlay of the current frame after a change of its
+  /// colors, opacity or visibility. Unlike update(), the window is kept.
+  void updateOverlay();
+
+  /// Mark the frame as modified: it is rendered once, on the next turn of
+  /// the event loop, however many times this is called in between.
+  void scheduleRender();
+
+  /// Repaint the view on the next turn of the event loop, with the
+  /// current frame. The repaints are coalesced by Qt.
+  void schedulePaint();
+
+  /// Clamp the voxel into the image and make it cClickSelect.
+  void setClickSelect(double newX, double newY, double newZ);
+
+  /// Show the voxel under the mouse while the button is held in the
+  /// CM_SELECT mode, the voxel being selected when it is released: unlike
+  /// selectPoint(), its value is read from the current frame when it holds
+  /// the intensities, the clicked points and the callbacks are left alone,
+  /// and the moves until the next turn of the event loop are collapsed
+  /// into a single positionChanged(). The repaint is coalesced with the
+  /// others by schedulePaint().
+  void hoverPoint(double newX, double newY, double newZ);
+
+  /// Return the intensity of the voxel p, from the values of the current
+  /// frame if they hold it, otherwise from the image.
+  double frameValue(const double p[3]) const;
+
+  /// Move step slices, on the next turn of the event loop. The steps
+  /// queued until then, e.g. by auto-repeated keys, are summed into a
+  /// single move, and the frames of the slices in between are never
+  /// requested. As the renderer completes the frame in progress and then
+  /// renders the last slice requested, the slice displayed is never more
+  /// than two frames behind the keys.
+  void stepSlice(int step);
+
+  /// Apply the thread limit of the scheduler to the ITK global thread
+  /// counts.
+  void updateITKThreadCount();
+
+  /// (Re)allocate the front and back slice buffers. The renderer must be
+  /// idle.
+  void allocateWinData();
+
+  /// Swap the back buffers written by the renderer with the front buffers
+  /// read by paintGL(), which then hold the frame of state.
+  void swapWinData(const QtSliceRenderState& state);
+
+  /// Repaint after a change of the intensity window or of the IW modes:
+  /// only the shader uniforms change if it windows the frames, otherwise
+  /// the slice is rendered again.
+  void updateIntensityWindow();
+
   int cDisplayState;
   int cMaxDisplayStates;
   bool cValidOverlayData;
   double cSingleStep;
-  double cOverlayOpacity;
+  OverlayModeType cOverlayMode;
 
+  /// 8-bit image of the current overlay layer, if it is one.
   OverlayPointer cOverlayData;
 
+  struct OverlayLayerType
+    {
+    /// Shared with the frames being rendered.
+    QSharedPointer<QtOverlayLayer> Layer;
+    ColorTablePointer ColorTable;
+    double            Opacity;
+    bool              Visible;
+    /// Packed RGBA8 color of each label, premultiplied by Opacity: label m
+    /// uses the color m-1 of ColorTable unless overridden by LabelColors,
+    /// label 0 and the hidden labels are transparent. It has an entry per
+    /// label of the layer, and at least 256.
+    QVector<unsigned int> LUT;
+    unsigned long     LUTMTime;
+    double            LUTOpacity;
+    /// True for the hidden labels. Labels past its end are shown.
+    QVector<bool>     HiddenLabels;
+    /// Colors overriding ColorTable for some labels.
+    QHash<int, QColor> LabelColors;
+    };
+  /// Overlay layers, from the bottom one to the top one.
+  QList<OverlayLayerType> cOverlayLayers;
+  int cCurrentOverlayLayer;
+
   unsigned char *cWinOverlayData;
   QDialog* cHelpDialog;
 
+  /// Colors of the first overlay layer.
   ColorTablePointer cColorTable;
 
   void (*cSliceNumCallBack)(void);
@@ -450,6 +913,29 @@ protected:
   double cSpacing[3];
 
   ClickModeType cClickMode;
+  int    cPaintLabel;
+  int    cPaintRadius;
+  /// True during a paint stroke, which paints cPaintValue.
+  bool   cPainting;
+  int    cPaintValue;
+  double cPaintLast[3];
+  /// Points of the stroke queued while the renderer is busy, x, y and z.
+  QVector<double> cPaintPoints;
+  /// Grow interval, the intensity window if cGrowMin > cGrowMax.
+  double cGrowMin;
+  double cGrowMax;
+  /// True while the left button previews a region, then while the region
+  /// is grown in the background. The edit of the preview remains open.
+  bool   cGrowPreview;
+  bool   cGrowPending;
+  /// Set while the preview of cGrowSeed is queued.
+  bool   cGrowPreviewQueued;
+  IndexType cGrowSeed;
+  /// Overlay the region is written into.
+  OverlayPointer cGrowOverlay;
+  /// Box of the previewed region, empty if cGrowFirst > cGrowLast.
+  IndexType cGrowFirst;
+  IndexType cGrowLast;
   double cClickSelect[3];
   double cClickSelectV;
   void (*cClickSelectCallBack)(double x,double y,double z,
@@ -517,6 +1003,102 @@ protected:
   unsigned char *cWinImData;
   unsigned short *cWinZBuffer;
 
+  /* values of the slice windowed by cWinShader, instead of cWinImData,
+     when cWinValueFrame is set. See QtSliceRenderState::ShaderWindow */
+  float *cWinValueData;
+
+  /* back buffers written by the renderer, swapped with the front buffers
+     cWinImData, cWinValueData, cWinOverlayData, cWinFrameData and
+     cWinZBuffer under cWinDataMutex */
+  unsigned char *cWinImBackData;
+  float *cWinValueBackData;
+  unsigned char *cWinOverlayBackData;
+  unsigned short *cWinZBackBuffer;
+  /* opaque RGBA frame composited from cWinImData and cWinOverlayData,
+     uploaded by paintGL() */
+  unsigned char *cWinFrameData;
+  unsigned char *cWinFrameBackData;
+  /* box of cWinFrameData modified since it was last uploaded into
+     cWinTexture */
+  QRect cWinFrameDirty;
+  QtSliceTexture *cWinTexture;
+  /* frame of the front buffers: the image mode and range of cWinValueData
+     if it holds values, the box of the window they cover and whether
+     cWinOverlayData holds the overlay */
+  bool cWinValueFrame;
+  ImageModeType cWinValueMode;
+  double cWinValueOffset;
+  double cWinValueScale;
+  QRect cWinValueBox;
+  bool cWinValueOverlay;
+  /* origin of the window of the frame, and its slice */
+  int cWinValueMinX;
+  int cWinValueMinY;
+  int cWinValueAxis;
+  int cWinValueSlice;
+  /* fragment shader windowing cWinValueData, used if cShaderWindowing is
+     set and cShaderSupported, which is known once the GL context is
+     initialized */
+  QtSliceShader *cWinShader;
+  bool cShaderWindowing;
+  bool cShaderSupported;
+  /* base layer drawn by paintBaseLayer(), cached so that the annotations
+     can be repainted alone; cBaseLayerModified is set when it must be
+     drawn again though the frame has not been swapped, e.g. after a change
+     of the window of cWinShader */
+  QGLFramebufferObject *cBaseLayer;
+  bool cBaseLayerModified;
+  /* set by scheduleRender(), cleared when renderScheduledFrame() runs */
+  bool cRenderPending;
+  bool cFrameScheduled;
+  int cRenderedFrames;
+  int cPaintedFrames;
+  /* frames swapped in by the renderer, numbered under cWinDataMutex, and
+     the last one repainted */
+  int cWinFrameNumber;
+  int cDisplayedFrameNumber;
+  int cDisplayedFrames;
+  int cOverwrittenFrames;
+  /* slice targeted by the steps queued by stepSlice() */
+  bool cSliceStepPending;
+  int cSliceStepTarget;
+  /* set by hoverPoint() until positionChanged() is emitted */
+  bool cHoverPending;
+  mutable QMutex cWinDataMutex;
+  QtSliceRenderer *cRenderer;
+  QtOverlayEditHistory *cOverlayHistory;
+  QtOverlayAnalysis *cOverlayAnalysis;
+  QtRegionGrowing *cRegionGrowing;
+  /* summary of cOverlayAnalysis appended to the details, empty if the
+     overlay has not been analyzed */
+  QString cOverlayStatistics;
+  /* set while the statistics of the request started by analyzeOverlay()
+     are awaited, and if they are to be saved then */
+  bool cOverlayAnalysisPending;
+  int cOverlayAnalysisRequest;
+  bool cSaveOverlayStatistics;
+  /* glyphs of the text drawn over the slice: the details and the value in
+     the font of the view, the axis labels in a smaller one; and the text
+     laid out with them */
+  QtGlyphAtlas *cTextAtlas;
+  QtGlyphAtlas *cLabelAtlas;
+  QtGlyphLabel cValueLabel;
+  QtGlyphLabel cAxisLabels[2];
+  QVector<QtGlyphLabel> cDetailLabels;
+  /* details last emitted by detailsChanged(), the lines drawn, and the
+     state they were built from: orientation, window center, dimensions,
+     spacing, data range, intensity window and modes, image mode. Built
+     again when the state differs or when cDetailsModified is set */
+  QString cDetails;
+  QStringList cDetailLines;
+  double cDetailsKey[17];
+  bool cDetailsModified;
+  /* set when the details are built until their labels are laid out */
+  bool cDetailLabelsModified;
+  /* value drawn, and the point, value and units it was built from */
+  QString cValueText;
+  double cValueKey[5];
+
   double cDataMax;
   double cDataMin;
 
@@ -524,6 +1106,15 @@ protected:
   typedef QList<ClickPoint> ClickPointListType;
   ClickPointListType cClickedPoints;
   int maxClickPoints;
+  /* clicked points in slice cClickedPointsSlice of axis cClickedPointsAxis,
+     as voxels of the window axes, drawn as a single array; rebuilt when
+     cClickedPointsModified is set or the slice changes */
+  QVector<GLfloat> cClickedPointVertices;
+  int cClickedPointsSlice;
+  int cClickedPointsAxis;
+  bool cClickedPointsModified;
+  /* lines of the crosshair, in the coordinates of the view */
+  QVector<GLfloat> cCrosshairVertices;
   int cX, cY, cW, cH;
   int cfastMovVal; //fast moving pace
   int cfastMovThresh;
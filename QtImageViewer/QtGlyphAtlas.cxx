@@ -0,0 +1,291 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+
+//QtImageViewer includes
+#include "QtGlyphAtlas.h"
+
+// Qt includes
+#include <QPainter>
+
+
+namespace
+{
+
+/// Pixels around each glyph, for the glyphs overhanging their advance.
+const int Padding = 2;
+
+} // end namespace
+
+
+QtGlyphLabel::QtGlyphLabel()
+  : Generation(-1)
+{
+}
+
+
+const int QtGlyphAtlas::AtlasSize;
+
+
+QtGlyphAtlas::QtGlyphAtlas()
+  : Metrics(QFont())
+  , Image(AtlasSize, AtlasSize, QImage::Format_ARGB32)
+  , CursorX(0)
+  , CursorY(0)
+  , Generation(0)
+  , ImageModified(true)
+  , Texture(0)
+{
+  this->Image.fill(0);
+}
+
+
+QtGlyphAtlas::~QtGlyphAtlas()
+{
+}
+
+
+void QtGlyphAtlas::setFont(const QFont& font)
+{
+  if (font == this->Font)
+    {
+    return;
+    }
+  this->Font = font;
+  this->Metrics = QFontMetrics(font);
+  this->clear();
+}
+
+
+const QFont& QtGlyphAtlas::font() const
+{
+  return this->Font;
+}
+
+
+void QtGlyphAtlas::clear()
+{
+  this->Glyphs.clear();
+  this->Image.fill(0);
+  this->CursorX = 0;
+  this->CursorY = 0;
+  ++this->Generation;
+  this->ImageModified = true;
+}
+
+
+const QtGlyphAtlas::Glyph* QtGlyphAtlas::glyph(QChar character)
+{
+  QHash<ushort, Glyph>::const_iterator found =
+    this->Glyphs.constFind(character.unicode());
+  if (found != this->Glyphs.constEnd())
+    {
+    return &found.value();
+    }
+  const int advance = this->Metrics.width(character);
+  const int width = advance + 2 * Padding;
+  const int height = this->Metrics.height();
+  if (this->CursorX + width > AtlasSize)
+    {
+    // Next shelf.
+    this->CursorX = 0;
+    this->CursorY += height;
+    }
+  if (width > AtlasSize || this->CursorY + height > AtlasSize)
+    {
+    return NULL;
+    }
+  Glyph glyph;
+  glyph.Box = QRect(this->CursorX, this->CursorY, width, height);
+  glyph.Advance = advance;
+  this->CursorX += width;
+
+  QPainter painter(&this->Image);
+  painter.setFont(this->Font);
+  painter.setPen(QColor(255, 255, 255));
+  painter.drawText(glyph.Box.x() + Padding,
+                   glyph.Box.y() + this->Metrics.ascent(),
+                   QString(character));
+  painter.end();
+  this->ImageModified = true;
+  return &this->Glyphs.insert(character.unicode(), glyph).value();
+}
+
+
+bool QtGlyphAtlas::isLaidOut(const QtGlyphLabel& label) const
+{
+  return label.Generation == this->Generation;
+}
+
+
+bool QtGlyphAtlas::layout(QtGlyphLabel& label, const QString& text)
+{
+  if (this->isLaidOut(label) && label.Text == text)
+    {
+    return false;
+    }
+  label.Text = text;
+  label.Generation = this->Generation;
+  label.Vertices.clear();
+  const GLfloat scale = 1.f / AtlasSize;
+  const int ascent = this->Metrics.ascent();
+  int penX = 0;
+  for (int i = 0; i < text.size(); ++i)
+    {
+    const Glyph* glyph = this->glyph(text.at(i));
+    if (!glyph)
+      {
+      continue;
+      }
+    const QRect& box = glyph->Box;
+    const GLfloat x0 = static_cast<GLfloat>(penX - Padding);
+    const GLfloat x1 = x0 + box.width();
+    const GLfloat y0 = static_cast<GLfloat>(-ascent);
+    const GLfloat y1 = y0 + box.height();
+    const GLfloat s0 = box.x() * scale;
+    const GLfloat s1 = (box.x() + box.width()) * scale;
+    const GLfloat t0 = box.y() * scale;
+    const GLfloat t1 = (box.y() + box.height()) * scale;
+    const GLfloat quad[16] = {x0, y0, s0, t0,  x1, y0, s1, t0,
+                              x1, y1, s1, t1,  x0, y1, s0, t1};
+    for (int v = 0; v < 16; ++v)
+      {
+      label.Vertices.append(quad[v]);
+      }
+    penX += glyph->Advance;
+    }
+  return true;
+}
+
+
+void QtGlyphAtlas::add(const QtGlyphLabel& label, double x, double y,
+                       const QColor& color)
+{
+  const GLubyte rgba[4] = {
+    static_cast<GLubyte>(color.red()), static_cast<GLubyte>(color.green()),
+    static_cast<GLubyte>(color.blue()), static_cast<GLubyte>(color.alpha())};
+  const GLfloat* vertex = label.Vertices.constData();
+  const int vertexCount = label.Vertices.size() / 4;
+  for (int v = 0; v < vertexCount; ++v, vertex += 4)
+    {
+    this->Vertices.append(static_cast<GLfloat>(vertex[0] + x));
+    this->Vertices.append(static_cast<GLfloat>(vertex[1] + y));
+    this->Vertices.append(vertex[2]);
+    this->Vertices.append(vertex[3]);
+    for (int c = 0; c < 4; ++c)
+      {
+      this->Colors.append(rgba[c]);
+      }
+    }
+}
+
+
+void QtGlyphAtlas::draw(int width, int height)
+{
+  if (this->Vertices.isEmpty())
+    {
+    return;
+    }
+  if (!this->Texture)
+    {
+    glGenTextures(1, &this->Texture);
+    glBindTexture(GL_TEXTURE_2D, this->Texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    this->ImageModified = true;
+    }
+  else
+    {
+    glBindTexture(GL_TEXTURE_2D, this->Texture);
+    }
+  if (this->ImageModified)
+    {
+    // The glyphs are white: only their coverage is uploaded.
+    const QImage& image = this->Image;
+    QVector<GLubyte> alpha(AtlasSize * AtlasSize);
+    for (int y = 0; y < AtlasSize; ++y)
+      {
+      const QRgb* line = reinterpret_cast<const QRgb*>(image.scanLine(y));
+      for (int x = 0; x < AtlasSize; ++x)
+        {
+        alpha[y * AtlasSize + x] = static_cast<GLubyte>(qAlpha(line[x]));
+        }
+      }
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA8, AtlasSize, AtlasSize, 0,
+                 GL_ALPHA, GL_UNSIGNED_BYTE, alpha.constData());
+    this->ImageModified = false;
+    }
+
+  glPushAttrib(GL_ENABLE_BIT | GL_TEXTURE_BIT | GL_COLOR_BUFFER_BIT |
+               GL_VIEWPORT_BIT | GL_TRANSFORM_BIT);
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+  glViewport(0, 0, width, height);
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glOrtho(0.0, width, height, 0.0, -1.0, 1.0);
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+
+  glEnable(GL_TEXTURE_2D);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+  const GLfloat* vertices = this->Vertices.constData();
+  glVertexPointer(2, GL_FLOAT, 4 * sizeof(GLfloat), vertices);
+  glTexCoordPointer(2, GL_FLOAT, 4 * sizeof(GLfloat), vertices + 2);
+  glColorPointer(4, GL_UNSIGNED_BYTE, 0, this->Colors.constData());
+  glDrawArrays(GL_QUADS, 0, this->Vertices.size() / 4);
+
+  glMatrixMode(GL_MODELVIEW);
+  glPopMatrix();
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glPopClientAttrib();
+  glPopAttrib();
+  glBindTexture(GL_TEXTURE_2D, 0);
+  this->Vertices.resize(0);
+  this->Colors.resize(0);
+}
+
+
+void QtGlyphAtlas::release()
+{
+  if (this->Texture)
+    {
+    glDeleteTextures(1, &this->Texture);
+    this->Texture = 0;
+    }
+  this->ImageModified = true;
+}
+
+
+int QtGlyphAtlas::glyphCount() const
+{
+  return this->Glyphs.size();
+}
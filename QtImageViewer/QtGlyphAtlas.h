@@ -0,0 +1,131 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+#ifndef __QtGlyphAtlas_h
+#define __QtGlyphAtlas_h
+
+// Qt includes
+#include <QColor>
+#include <QFont>
+#include <QFontMetrics>
+#include <QHash>
+#include <QImage>
+#include <QRect>
+#include <QString>
+#include <QVector>
+#include <QtOpenGL/qgl.h>
+
+// ImageViewer includes
+#include "QtImageViewer_Export.h"
+
+/// String laid out by QtGlyphAtlas::layout().
+struct QtImageViewer_EXPORT QtGlyphLabel
+{
+  QtGlyphLabel();
+
+  QString          Text;
+  /// Quads of the glyphs from the start of the baseline, y down: x, y, s
+  /// and t for each vertex.
+  QVector<GLfloat> Vertices;
+  /// Generation of the atlas the texture coordinates refer to.
+  int              Generation;
+};
+
+/// Texture holding the glyphs of a font, which draws text as textured
+/// quads instead of QGLWidget::renderText().
+/// The glyphs are rendered into the atlas the first time they are laid
+/// out. The labels are laid out again only when their text changes, and
+/// all the labels queued with add() are drawn with a single glDrawArrays()
+/// by draw().
+/// The GL methods must be called with the GL context of the view current.
+class QtImageViewer_EXPORT QtGlyphAtlas
+{
+public:
+  /// Size of the texture of the atlas.
+  static const int AtlasSize = 512;
+
+  QtGlyphAtlas();
+  /// The GL objects must have been released beforehand.
+  ~QtGlyphAtlas();
+
+  /// Set the font of the glyphs. The atlas is cleared if it changes.
+  void setFont(const QFont& font);
+  const QFont& font() const;
+
+  /// Lay text out into label if it is not its text or if the atlas has
+  /// been cleared since it was laid out. Return true if label changed.
+  /// The glyphs that do not fit in the atlas are skipped.
+  bool layout(QtGlyphLabel& label, const QString& text);
+
+  /// Return false if the atlas has been cleared since label was laid out.
+  bool isLaidOut(const QtGlyphLabel& label) const;
+
+  /// Queue label to be drawn with its baseline starting at (x, y), in
+  /// the coordinates of the widget (origin at the top left corner).
+  void add(const QtGlyphLabel& label, double x, double y,
+           const QColor& color);
+
+  /// Draw the queued labels in the widget of width x height, blended with
+  /// the alpha of their color, and clear the queue.
+  void draw(int width, int height);
+
+  /// Delete the GL objects.
+  void release();
+
+  /// Number of glyphs rendered into the atlas since it was last cleared.
+  int glyphCount() const;
+
+protected:
+  struct Glyph
+    {
+    /// Box of the glyph in the atlas; its origin is Ascent above the
+    /// baseline and Padding before the pen position.
+    QRect Box;
+    int   Advance;
+    };
+
+  /// Return the glyph of character, rendering it if needed. Return NULL
+  /// if it does not fit in the atlas.
+  const Glyph* glyph(QChar character);
+
+  /// Remove the glyphs and invalidate the labels.
+  void clear();
+
+  QFont                  Font;
+  QFontMetrics           Metrics;
+  QImage                 Image;
+  QHash<ushort, Glyph>   Glyphs;
+  /// Position of the next glyph, on a shelf Metrics.height() high.
+  int                    CursorX;
+  int                    CursorY;
+  int                    Generation;
+  bool                   ImageModified;
+  GLuint                 Texture;
+  /// Queued quads: x, y, s and t, and the RGBA color, for each vertex.
+  QVector<GLfloat>       Vertices;
+  QVector<GLubyte>       Colors;
+
+private:
+  Q_DISABLE_COPY(QtGlyphAtlas);
+};
+
+#endif
@@ -33,10 +33,14 @@ limitations under the License.
 #include "QtImageViewer.h"
 #include "QtSliceControlsWidget.h"
 #include "QtGlSliceView.h"
+#include "QtOverlayLayer.h"
 #include "ui_QtImageViewer.h"
 
 // ITK includes
 #include <itkImageFileReader.h>
+#include <itkImageIOFactory.h>
+#include <itkRGBAPixel.h>
+#include <itkRGBPixel.h>
 
 // STD includes
 #include <iostream>
@@ -58,10 +62,31 @@ public:
 
   virtual void setupUi(QDialog* widgetToSetup);
 
+  /// Prompt a file dialog if filePath is empty and check that the file
+  /// exists. Return false if there is no file to load.
+  bool selectFile(QString& filePath, const QString& imageType = QString());
+
   template <class PixelType>
   typename itk::Image<PixelType,3>::Pointer loadImage(QString& filePath,
     const QString& imageType = QString());
 
+  /// Read filePath as an overlay, with the pixel type of the file, and
+  /// pass it to the view as a new layer if add is true, in place of the
+  /// current one otherwise.
+  bool loadOverlayFile(QString& filePath, bool add);
+
+  /// Read filePath as an overlay of PixelType and pass it to the view.
+  template <class PixelType>
+  bool loadOverlay(const QString& filePath, bool add);
+
+  /// Read filePath as a label map of PixelType and pass it to the view,
+  /// run-length encoded.
+  template <class PixelType>
+  bool loadLabelOverlay(const QString& filePath, bool add);
+
+  /// Pass the overlay layer to the view.
+  void setOverlayLayer(QtOverlayLayer* layer, bool add);
+
   template <class PixelType>
   typename itk::Image<PixelType,3>::Pointer readImage(const QString &
     filePath);
@@ -78,6 +103,10 @@ public:
 
   QDialog* HelpDialog;
   bool IsRedirectingEvent;
+  /// Stream the label maps from their files instead of reading them.
+  bool LazyOverlays;
+  /// Size of the slab cache of each streamed overlay, in MB.
+  int OverlayCacheSize;
 
 protected:
   QtImageViewer* const q_ptr;
@@ -87,6 +116,8 @@ protected:
 QtImageViewerPrivate::QtImageViewerPrivate(QtImageViewer& obj)
   : HelpDialog(0)
   , IsRedirectingEvent(false)
+  , LazyOverlays(false)
+  , OverlayCacheSize(256)
   , q_ptr(&obj)
 {
 }
@@ -119,12 +150,10 @@ void QtImageViewerPrivate::setupUi(QDialog* widgetToSetup)
     }
 }
 
-template <class PixelType>
-typename itk::Image<PixelType, 3>::Pointer QtImageViewerPrivate
-::loadImage(QString& filePath, const QString& imageType)
+bool QtImageViewerPrivate::selectFile(QString& filePath,
+                                      const QString& imageType)
 {
   Q_Q(QtImageViewer);
-  typename itk::Image<PixelType, 3>::Pointer res;
   // If the path is empty, prompt a dialog to give a chance to select the
   // image to load.
   if (filePath.isEmpty())
@@ -135,7 +164,7 @@ typename itk::Image<PixelType, 3>::Pointer QtImageViewerPrivate
   // Empty if the user cancelled the dialog.
   if (filePath.isEmpty())
     {
-    return res;
+    return false;
     }
   // Might be a non existing path.
   QFileInfo fileInfo(filePath);
@@ -145,6 +174,18 @@ typename itk::Image<PixelType, 3>::Pointer QtImageViewerPrivate
     const QString message = QString(
       "The file you have selected does not exist. %1").arg(filePath);
     QMessageBox::warning(q, messageTitle, message);
+    return false;
+    }
+  return true;
+}
+
+template <class PixelType>
+typename itk::Image<PixelType, 3>::Pointer QtImageViewerPrivate
+::loadImage(QString& filePath, const QString& imageType)
+{
+  typename itk::Image<PixelType, 3>::Pointer res;
+  if (!this->selectFile(filePath, imageType))
+    {
     return res;
     }
 
@@ -153,6 +194,124 @@ typename itk::Image<PixelType, 3>::Pointer QtImageViewerPrivate
   return res;
 }
 
+void QtImageViewerPrivate::setOverlayLayer(QtOverlayLayer* layer,
+                                           bool add)
+{
+  if (add)
+    {
+    this->OpenGlWindow->addOverlayLayer(layer);
+    }
+  else
+    {
+    this->OpenGlWindow->setOverlayLayer(layer);
+    }
+  this->updateSize();
+}
+
+template <class PixelType>
+bool QtImageViewerPrivate::loadOverlay(const QString& filePath, bool add)
+{
+  typename itk::Image<PixelType, 3>::Pointer image =
+    this->readImage<PixelType>(filePath);
+  if (image.IsNull())
+    {
+    return false;
+    }
+  this->setOverlayLayer(new QtImageOverlayLayer<PixelType>(image), add);
+  return true;
+}
+
+template <class PixelType>
+bool QtImageViewerPrivate::loadLabelOverlay(const QString& filePath,
+                                            bool add)
+{
+  typename itk::Image<PixelType, 3>::Pointer image =
+    this->readImage<PixelType>(filePath);
+  if (image.IsNull())
+    {
+    return false;
+    }
+  // Label maps are mostly background, the dense image is released once
+  // encoded.
+  if (image->GetLargestPossibleRegion().GetSize()[0] <= 65535)
+    {
+    this->setOverlayLayer(new QtRLEOverlayLayer(image), add);
+    }
+  else
+    {
+    this->setOverlayLayer(new QtImageOverlayLayer<PixelType>(image), add);
+    }
+  return true;
+}
+
+bool QtImageViewerPrivate::loadOverlayFile(QString& filePathToLoad,
+                                           bool add)
+{
+  if (!this->selectFile(filePathToLoad))
+    {
+    return false;
+    }
+
+  // Pick the overlay type from the pixel type of the file.
+  unsigned int numberOfComponents = 1;
+  itk::ImageIOBase::IOComponentType componentType = itk::ImageIOBase::UCHAR;
+  bool canStreamRead = false;
+  itk::ImageIOBase::Pointer imageIO = itk::ImageIOFactory::CreateImageIO(
+    filePathToLoad.toLatin1().data(), itk::ImageIOFactory::ReadMode);
+  if (imageIO.IsNotNull())
+    {
+    try
+      {
+      imageIO->SetFileName(filePathToLoad.toLatin1().data());
+      imageIO->ReadImageInformation();
+      numberOfComponents = imageIO->GetNumberOfComponents();
+      componentType = imageIO->GetComponentType();
+      canStreamRead = imageIO->CanStreamRead();
+      }
+    catch (itk::ExceptionObject &)
+      {
+      // The reader reports the error.
+      }
+    }
+
+  if (numberOfComponents == 3)
+    {
+    return this->loadOverlay<itk::RGBPixel<unsigned char> >(
+      filePathToLoad, add);
+    }
+  if (numberOfComponents == 4)
+    {
+    return this->loadOverlay<itk::RGBAPixel<unsigned char> >(
+      filePathToLoad, add);
+    }
+  if (this->LazyOverlays && canStreamRead && numberOfComponents == 1 &&
+      (componentType == itk::ImageIOBase::UCHAR ||
+       componentType == itk::ImageIOBase::USHORT))
+    {
+    // Shown at once, the slabs are read as the slices are viewed.
+    try
+      {
+      this->setOverlayLayer(new QtStreamedOverlayLayer(
+        filePathToLoad,
+        static_cast<size_t>(this->OverlayCacheSize) * 1024 * 1024), add);
+      return true;
+      }
+    catch (itk::ExceptionObject & e)
+      {
+      std::cerr << "Exception when streaming overlay" << std::endl;
+      std::cerr << e << std::endl;
+      }
+    }
+  if (componentType == itk::ImageIOBase::UCHAR ||
+      componentType == itk::ImageIOBase::CHAR)
+    {
+    return this->loadLabelOverlay<QtImageViewer::OverlayPixelType>(
+      filePathToLoad, add);
+    }
+  // Label maps with more than 255 labels.
+  return this->loadLabelOverlay<unsigned short>(filePathToLoad, add);
+}
+
 template <class PixelType>
 typename itk::Image<PixelType, 3>::Pointer QtImageViewerPrivate::readImage(
   const QString& filePath )
@@ -272,6 +431,27 @@ QtGlSliceView* QtImageViewer::sliceView()const
 }
 
 
+void QtImageViewer::setMaxThreadCount(int count)
+{
+  Q_D(QtImageViewer);
+  d->OpenGlWindow->setMaxThreadCount(count);
+}
+
+
+void QtImageViewer::setAdaptiveThreadCount(bool adaptive)
+{
+  Q_D(QtImageViewer);
+  d->OpenGlWindow->setAdaptiveThreadCount(adaptive);
+}
+
+
+void QtImageViewer::setThreadAffinity(const QList<int>& cpus)
+{
+  Q_D(QtImageViewer);
+  d->OpenGlWindow->setThreadAffinity(cpus);
+}
+
+
 void QtImageViewer::setInputImage(ImageType* newImData)
 {
   Q_D(QtImageViewer);
@@ -327,13 +507,42 @@ bool QtImageViewer::loadInputImage(QString filePathToLoad)
 bool QtImageViewer::loadOverlayImage(QString filePathToLoad)
 {
   Q_D(QtImageViewer);
+  return d->loadOverlayFile(filePathToLoad, false);
+}
 
-  OverlayImageType::Pointer image = d->loadImage<OverlayPixelType>(filePathToLoad);
-  if (image.IsNotNull())
-    {
-    this->setOverlayImage( image );
-    }
-  return image.IsNotNull();
+
+bool QtImageViewer::addOverlayImage(QString filePathToLoad)
+{
+  Q_D(QtImageViewer);
+  return d->loadOverlayFile(filePathToLoad, true);
+}
+
+
+void QtImageViewer::setLazyOverlayLoading(bool lazy)
+{
+  Q_D(QtImageViewer);
+  d->LazyOverlays = lazy;
+}
+
+
+bool QtImageViewer::lazyOverlayLoading() const
+{
+  Q_D(const QtImageViewer);
+  return d->LazyOverlays;
+}
+
+
+void QtImageViewer::setOverlayCacheSize(int megabytes)
+{
+  Q_D(QtImageViewer);
+  d->OverlayCacheSize = qMax(megabytes, 1);
+}
+
+
+int QtImageViewer::overlayCacheSize() const
+{
+  Q_D(const QtImageViewer);
+  return d->OverlayCacheSize;
 }
 
 
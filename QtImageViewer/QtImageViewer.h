@@ -25,6 +25,7 @@ limitations under the License.
 
 // Qt includes
 #include <QDialog>
+#include <QList>
 
 // ITK includes
 #include <itkImage.h>
@@ -60,6 +61,11 @@ public slots:
   //// \sa loadInputImage(), setOverlayImage()
   bool loadOverlayImage(QString filePath = QString());
 
+  /// Load an image from a file path and add it as an overlay layer over
+  /// the others.
+  /// \sa loadOverlayImage()
+  bool addOverlayImage(QString filePath = QString());
+
   /// Set the image to view.
   /// \sa setOverlayImage(), loadInputImage()
   virtual void setInputImage(ImageType * newImData);
@@ -69,6 +75,30 @@ public slots:
 
   virtual void showHelp();
 
+  /// If true, the label maps loaded afterwards by loadOverlayImage() and
+  /// addOverlayImage() are not read up front: only the slabs of the viewed
+  /// slices are read from the file, when the file format can be streamed.
+  /// False by default.
+  /// \sa QtStreamedOverlayLayer
+  void setLazyOverlayLoading(bool lazy);
+  bool lazyOverlayLoading() const;
+
+  /// Size in MB of the slabs of each lazily loaded overlay kept in
+  /// memory, 256 by default.
+  void setOverlayCacheSize(int megabytes);
+  int overlayCacheSize() const;
+
+  /// Cap the number of threads used to load, reslice and analyze the
+  /// images, 0 for one per core.
+  /// \sa QtGlSliceView::setMaxThreadCount()
+  void setMaxThreadCount(int count);
+  /// Use fewer threads when the machine is loaded.
+  /// \sa QtGlSliceView::setAdaptiveThreadCount()
+  void setAdaptiveThreadCount(bool adaptive);
+  /// Bind the threads to the given cores.
+  /// \sa QtGlSliceView::setThreadAffinity()
+  void setThreadAffinity(const QList<int>& cpus);
+
 protected slots:
   virtual void onDisplayStateChanged(int details);
   void releaseFixedSize();
@@ -0,0 +1,666 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+
+//QtImageViewer includes
+#include "QtOverlayAnalysis.h"
+#include "QtOverlayLayer.h"
+#include "QtTaskScheduler.h"
+
+// Qt includes
+#include <QFile>
+#include <QHash>
+#include <QMap>
+#include <QMutexLocker>
+#include <QStringList>
+#include <QTextStream>
+#include <QTime>
+
+//std includes
+#include <limits>
+
+
+namespace
+{
+
+/// Voxels [Begin, End) of a row with the same label.
+struct Run
+{
+  int          Begin;
+  int          End;
+  unsigned int Label;
+};
+
+
+/// Sums of the voxels of a label.
+struct Accumulator
+{
+  Accumulator()
+    : Count(0)
+    , IntensitySum(0.)
+    , Minimum(std::numeric_limits<double>::max())
+    , Maximum(-std::numeric_limits<double>::max())
+    {
+    for (int i = 0; i < 3; ++i)
+      {
+      this->Sum[i] = 0.;
+      this->First[i] = std::numeric_limits<int>::max();
+      this->Last[i] = -1;
+      }
+    }
+
+  /// Add the voxels [begin, end) of the row (y, z), intensities being the
+  /// row of the image or NULL.
+  void add(int begin, int end, int y, int z, const double* intensities)
+    {
+    const int length = end - begin;
+    this->Count += length;
+    this->Sum[0] += 0.5 * length * (begin + end - 1);
+    this->Sum[1] += static_cast<double>(length) * y;
+    this->Sum[2] += static_cast<double>(length) * z;
+    const int index[3] = {begin, y, z};
+    const int last[3] = {end - 1, y, z};
+    for (int i = 0; i < 3; ++i)
+      {
+      this->First[i] = qMin(this->First[i], index[i]);
+      this->Last[i] = qMax(this->Last[i], last[i]);
+      }
+    for (int x = begin; intensities && x < end; ++x)
+      {
+      const double value = intensities[x];
+      this->IntensitySum += value;
+      this->Minimum = qMin(this->Minimum, value);
+      this->Maximum = qMax(this->Maximum, value);
+      }
+    }
+
+  void merge(const Accumulator& other)
+    {
+    this->Count += other.Count;
+    this->IntensitySum += other.IntensitySum;
+    this->Minimum = qMin(this->Minimum, other.Minimum);
+    this->Maximum = qMax(this->Maximum, other.Maximum);
+    for (int i = 0; i < 3; ++i)
+      {
+      this->Sum[i] += other.Sum[i];
+      this->First[i] = qMin(this->First[i], other.First[i]);
+      this->Last[i] = qMax(this->Last[i], other.Last[i]);
+      }
+    }
+
+  quint64 Count;
+  double  Sum[3];
+  double  IntensitySum;
+  double  Minimum;
+  double  Maximum;
+  int     First[3];
+  int     Last[3];
+};
+
+
+/// Runs of the slices [BeginZ, EndZ), and their components.
+struct Slab
+{
+  int                               BeginZ;
+  int                               EndZ;
+  /// Next slice to scan.
+  int                               NextZ;
+  QVector<Run>                      Runs;
+  /// Runs of row y + (z - BeginZ) * sizeY start at RowStarts[row].
+  QVector<int>                      RowStarts;
+  /// Union-find forest of the runs, in slab indices.
+  QVector<int>                      Parents;
+  QHash<unsigned int, Accumulator>  Labels;
+};
+
+
+int findRoot(int* parents, int i)
+{
+  while (parents[i] != i)
+    {
+    parents[i] = parents[parents[i]];
+    i = parents[i];
+    }
+  return i;
+}
+
+
+/// Merge the sets of a and b, the smallest index being the root.
+void unite(int* parents, int a, int b)
+{
+  a = findRoot(parents, a);
+  b = findRoot(parents, b);
+  if (a < b)
+    {
+    parents[b] = a;
+    }
+  else if (b < a)
+    {
+    parents[a] = b;
+    }
+}
+
+
+/// Unite the overlapping runs of the same label of two rows, whose first
+/// runs have the indices aFirst and bFirst in parents.
+void connectRows(const Run* a, const Run* aEnd, int aFirst,
+                 const Run* b, const Run* bEnd, int bFirst, int* parents)
+{
+  const Run* aBegin = a;
+  const Run* bBegin = b;
+  while (a < aEnd && b < bEnd)
+    {
+    if (a->Begin < b->End && b->Begin < a->End && a->Label == b->Label)
+      {
+      unite(parents, aFirst + (a - aBegin), bFirst + (b - bBegin));
+      }
+    if (a->End < b->End)
+      {
+      ++a;
+      }
+    else
+      {
+      ++b;
+      }
+    }
+}
+
+
+/// Analyze the slabs of a layer one slice at a time.
+class SlabAnalyzer
+{
+public:
+  SlabAnalyzer(const QtOverlayLayer* layer,
+               const QtOverlayAnalysis::ImageType* image)
+    : Layer(layer)
+    , Image(image)
+    {
+    }
+
+  /// Append the runs of the rows of the next slice of slab.
+  void scanSlice(Slab& slab) const
+    {
+    const QtOverlayLayer::SizeType size = this->Layer->size();
+    const int sizeX = size[0];
+    const int sizeY = size[1];
+    if (slab.NextZ == slab.BeginZ)
+      {
+      slab.RowStarts.resize((slab.EndZ - slab.BeginZ) * sizeY + 1);
+      }
+    const double* intensities =
+      this->Image ? this->Image->GetBufferPointer() : NULL;
+    QVector<unsigned int> values(sizeX);
+    QtOverlayLayer::IndexType index;
+    index[0] = 0;
+    const int z = slab.NextZ++;
+    index[2] = z;
+    int row = (z - slab.BeginZ) * sizeY;
+    for (int y = 0; y < sizeY; ++y, ++row)
+      {
+      slab.RowStarts[row] = slab.Runs.size();
+      index[1] = y;
+      values.fill(0);
+      this->Layer->sampleRow(index, 0, sizeX, NULL, 0, values.data());
+      const double* rowIntensities = intensities ?
+        intensities + (static_cast<qint64>(z) * sizeY + y) * sizeX : NULL;
+      int x = 0;
+      while (x < sizeX)
+        {
+        const unsigned int label = values[x];
+        int end = x + 1;
+        while (end < sizeX && values[end] == label)
+          {
+          ++end;
+          }
+        if (label != 0)
+          {
+          Run run;
+          run.Begin = x;
+          run.End = end;
+          run.Label = label;
+          slab.Runs.append(run);
+          slab.Labels[label].add(x, end, y, z, rowIntensities);
+          }
+        x = end;
+        }
+      }
+    }
+
+  /// Connect the runs of slab once all its slices are scanned.
+  void connectSlab(Slab& slab) const
+    {
+    const int sizeY = this->Layer->size()[1];
+    const int rowCount = (slab.EndZ - slab.BeginZ) * sizeY;
+    slab.RowStarts.resize(rowCount + 1);
+    slab.RowStarts[rowCount] = slab.Runs.size();
+
+    // Components within the slab.
+    slab.Parents.resize(slab.Runs.size());
+    int* parents = slab.Parents.data();
+    for (int i = 0; i < slab.Parents.size(); ++i)
+      {
+      parents[i] = i;
+      }
+    const Run* runs = slab.Runs.constData();
+    const int* rowStarts = slab.RowStarts.constData();
+    for (int row = 0; row < rowCount; ++row)
+      {
+      const int previousRows[2] = {row % sizeY ? row - 1 : -1,
+                                   row >= sizeY ? row - sizeY : -1};
+      for (int i = 0; i < 2; ++i)
+        {
+        const int other = previousRows[i];
+        if (other >= 0)
+          {
+          connectRows(runs + rowStarts[row], runs + rowStarts[row + 1],
+                      rowStarts[row],
+                      runs + rowStarts[other], runs + rowStarts[other + 1],
+                      rowStarts[other], parents);
+          }
+        }
+      }
+    }
+
+protected:
+  const QtOverlayLayer*               Layer;
+  const QtOverlayAnalysis::ImageType* Image;
+};
+
+
+/// Task analyzing one slab. It gives way to the urgent tasks, e.g. the
+/// visible frames, between its slices.
+class SlabTask : public QtTask
+{
+public:
+  SlabTask(const SlabAnalyzer& analyzer, Slab& slab,
+           const QAtomicInt& canceled)
+    : QtTask(QtTask::Background)
+    , Analyzer(analyzer)
+    , AnalyzedSlab(slab)
+    , Canceled(canceled)
+    {
+    }
+  virtual bool run()
+    {
+    while (this->AnalyzedSlab.NextZ < this->AnalyzedSlab.EndZ)
+      {
+      if (this->Canceled)
+        {
+        return true;
+        }
+      this->Analyzer.scanSlice(this->AnalyzedSlab);
+      if (this->AnalyzedSlab.NextZ < this->AnalyzedSlab.EndZ &&
+          this->shouldYield())
+        {
+        return false;
+        }
+      }
+    this->Analyzer.connectSlab(this->AnalyzedSlab);
+    return true;
+    }
+protected:
+  const SlabAnalyzer& Analyzer;
+  Slab&               AnalyzedSlab;
+  const QAtomicInt&   Canceled;
+};
+
+} // end namespace
+
+
+/// Task running the background analysis of a QtOverlayAnalysis.
+class QtOverlayAnalysisTask : public QtTask
+{
+public:
+  QtOverlayAnalysisTask(QtOverlayAnalysis* analysis)
+    : QtTask(QtTask::Background)
+    , Analysis(analysis)
+    {
+    }
+  virtual bool run()
+    {
+    this->Analysis->run();
+    return true;
+    }
+protected:
+  QtOverlayAnalysis* Analysis;
+};
+
+
+QtOverlayAnalysis::QtOverlayAnalysis(QObject* parent)
+  : Superclass(parent)
+  , Running(false)
+  , Request(0)
+  , Canceled(0)
+  , ComponentCount(0)
+  , Duration(0)
+  , HasIntensities(false)
+{
+  for (int i = 0; i < 3; ++i)
+    {
+    this->Spacing[i] = 1.;
+    }
+}
+
+
+QtOverlayAnalysis::~QtOverlayAnalysis()
+{
+  this->cancel();
+}
+
+
+int QtOverlayAnalysis::start(const QSharedPointer<QtOverlayLayer>& layer,
+                             const ImageType* image,
+                             const double spacing[3])
+{
+  this->cancel();
+  QMutexLocker locker(&this->Mutex);
+  this->Layer = layer;
+  this->Image = image;
+  for (int i = 0; i < 3; ++i)
+    {
+    this->Spacing[i] = spacing[i];
+    }
+  this->Running = true;
+  ++this->Request;
+  QtTaskScheduler::instance()->submit(new QtOverlayAnalysisTask(this));
+  return this->Request;
+}
+
+
+void QtOverlayAnalysis::wait()
+{
+  QMutexLocker locker(&this->Mutex);
+  while (this->Running)
+    {
+    this->IdleCondition.wait(&this->Mutex);
+    }
+}
+
+
+void QtOverlayAnalysis::cancel()
+{
+  this->Canceled = 1;
+  this->wait();
+  this->Canceled = 0;
+}
+
+
+bool QtOverlayAnalysis::isRunning() const
+{
+  QMutexLocker locker(&this->Mutex);
+  return this->Running;
+}
+
+
+void QtOverlayAnalysis::run()
+{
+  const bool done =
+    this->analyze(this->Layer.data(), this->Image, this->Spacing);
+  const QString statistics = done ? this->summary() : QString();
+  int request;
+  {
+  QMutexLocker locker(&this->Mutex);
+  request = this->Request;
+  this->Layer.clear();
+  this->Image = 0;
+  this->Running = false;
+  this->IdleCondition.wakeAll();
+  }
+  if (done)
+    {
+    emit analyzed(request, statistics);
+    }
+}
+
+
+bool QtOverlayAnalysis::analyze(const QtOverlayLayer* layer,
+                                const ImageType* image,
+                                const double spacing[3])
+{
+  QTime time;
+  time.start();
+  // The statistics are computed aside and published at once: the GUI
+  // thread may read the previous ones meanwhile.
+  QVector<LabelStatistics> labelStatistics;
+  int componentCount = 0;
+  const QtOverlayLayer::SizeType size = layer->size();
+  if (image &&
+      image->GetLargestPossibleRegion().GetSize() != size)
+    {
+    image = NULL;
+    }
+
+  // A few slabs per worker to balance the labeled areas.
+  QtTaskScheduler* scheduler = QtTaskScheduler::instance();
+  const int sizeY = size[1];
+  const int sizeZ = size[2];
+  const int slabCount = qBound(1, 4 * scheduler->threadCount(), sizeZ);
+  QVector<Slab> slabs(slabCount);
+  for (int s = 0; s < slabCount; ++s)
+    {
+    slabs[s].BeginZ = static_cast<qint64>(sizeZ) * s / slabCount;
+    slabs[s].EndZ = static_cast<qint64>(sizeZ) * (s + 1) / slabCount;
+    slabs[s].NextZ = slabs[s].BeginZ;
+    }
+  SlabAnalyzer analyzer(layer, image);
+  {
+  QtTaskGroup group;
+  for (int s = 0; s < slabCount; ++s)
+    {
+    group.run(new SlabTask(analyzer, slabs[s], this->Canceled));
+    }
+  group.wait();
+  }
+  if (this->Canceled)
+    {
+    return false;
+    }
+
+  // Merge the forests of the slabs, then the components across their
+  // boundaries.
+  QVector<int> offsets(slabCount + 1);
+  offsets[0] = 0;
+  for (int s = 0; s < slabCount; ++s)
+    {
+    offsets[s + 1] = offsets[s] + slabs[s].Runs.size();
+    }
+  QVector<int> parents(offsets[slabCount]);
+  for (int s = 0; s < slabCount; ++s)
+    {
+    for (int i = 0; i < slabs[s].Parents.size(); ++i)
+      {
+      parents[offsets[s] + i] = offsets[s] + slabs[s].Parents[i];
+      }
+    slabs[s].Parents.clear();
+    }
+  for (int s = 1; s < slabCount; ++s)
+    {
+    const Slab& slab = slabs[s];
+    const Slab& previous = slabs[s - 1];
+    const int previousLastSlice = (previous.EndZ - 1 - previous.BeginZ) * sizeY;
+    for (int y = 0; y < sizeY; ++y)
+      {
+      const int* rowStarts = slab.RowStarts.constData() + y;
+      const int* previousStarts =
+        previous.RowStarts.constData() + previousLastSlice + y;
+      connectRows(slab.Runs.constData() + rowStarts[0],
+                  slab.Runs.constData() + rowStarts[1],
+                  offsets[s] + rowStarts[0],
+                  previous.Runs.constData() + previousStarts[0],
+                  previous.Runs.constData() + previousStarts[1],
+                  offsets[s - 1] + previousStarts[0], parents.data());
+      }
+    }
+
+  // Count the roots of each label, and sum the labels of the slabs.
+  QHash<unsigned int, int> components;
+  QMap<unsigned int, Accumulator> labels;
+  for (int s = 0; s < slabCount; ++s)
+    {
+    const Slab& slab = slabs[s];
+    for (int i = 0; i < slab.Runs.size(); ++i)
+      {
+      const int run = offsets[s] + i;
+      if (findRoot(parents.data(), run) == run)
+        {
+        ++components[slab.Runs[i].Label];
+        ++componentCount;
+        }
+      }
+    QHash<unsigned int, Accumulator>::const_iterator it;
+    for (it = slab.Labels.constBegin(); it != slab.Labels.constEnd(); ++it)
+      {
+      labels[it.key()].merge(it.value());
+      }
+    }
+
+  const double voxelVolume = spacing[0] * spacing[1] * spacing[2];
+  QMap<unsigned int, Accumulator>::const_iterator it;
+  for (it = labels.constBegin(); it != labels.constEnd(); ++it)
+    {
+    const Accumulator& accumulator = it.value();
+    LabelStatistics statistics;
+    statistics.Label = it.key();
+    statistics.VoxelCount = accumulator.Count;
+    statistics.Volume = accumulator.Count * qAbs(voxelVolume);
+    statistics.ComponentCount = components.value(it.key());
+    for (int i = 0; i < 3; ++i)
+      {
+      statistics.First[i] = accumulator.First[i];
+      statistics.Last[i] = accumulator.Last[i];
+      statistics.Centroid[i] = accumulator.Sum[i] / accumulator.Count;
+      }
+    statistics.Mean = image ? accumulator.IntensitySum / accumulator.Count
+                            : 0.;
+    statistics.Minimum = image ? accumulator.Minimum : 0.;
+    statistics.Maximum = image ? accumulator.Maximum : 0.;
+    labelStatistics.append(statistics);
+    }
+  QMutexLocker locker(&this->Mutex);
+  this->Labels = labelStatistics;
+  this->ComponentCount = componentCount;
+  this->HasIntensities = image != NULL;
+  this->Duration = time.elapsed();
+  return true;
+}
+
+
+QVector<QtOverlayAnalysis::LabelStatistics>
+QtOverlayAnalysis::labels() const
+{
+  QMutexLocker locker(&this->Mutex);
+  return this->Labels;
+}
+
+
+int QtOverlayAnalysis::componentCount() const
+{
+  QMutexLocker locker(&this->Mutex);
+  return this->ComponentCount;
+}
+
+
+int QtOverlayAnalysis::duration() const
+{
+  QMutexLocker locker(&this->Mutex);
+  return this->Duration;
+}
+
+
+QString QtOverlayAnalysis::summary() const
+{
+  QVector<LabelStatistics> labelStatistics;
+  int componentCount;
+  int duration;
+  bool hasIntensities;
+  {
+  QMutexLocker locker(&this->Mutex);
+  labelStatistics = this->Labels;
+  componentCount = this->ComponentCount;
+  duration = this->Duration;
+  hasIntensities = this->HasIntensities;
+  }
+  QStringList lines;
+  lines << QString("Labels: %1, Components: %2 (%3 ms)")
+    .arg(labelStatistics.size())
+    .arg(componentCount)
+    .arg(duration);
+  foreach (const LabelStatistics& statistics, labelStatistics)
+    {
+    QString line = QString("Label %1: %2 voxels, volume %3, %4 comp., "
+                           "centroid (%5, %6, %7)")
+      .arg(statistics.Label)
+      .arg(statistics.VoxelCount)
+      .arg(statistics.Volume, 0, 'g', 6)
+      .arg(statistics.ComponentCount)
+      .arg(statistics.Centroid[0], 0, 'f', 1)
+      .arg(statistics.Centroid[1], 0, 'f', 1)
+      .arg(statistics.Centroid[2], 0, 'f', 1);
+    if (hasIntensities)
+      {
+      line += QString(", mean %1 [%2 - %3]")
+        .arg(statistics.Mean, 0, 'g', 6)
+        .arg(statistics.Minimum, 0, 'g', 6)
+        .arg(statistics.Maximum, 0, 'g', 6);
+      }
+    lines << line;
+    }
+  return lines.join("\n");
+}
+
+
+bool QtOverlayAnalysis::write(const QString& fileName) const
+{
+  const QVector<LabelStatistics> labelStatistics = this->labels();
+  QFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+    return false;
+    }
+  QTextStream text(&file);
+  text << "label,voxels,volume,components,"
+       << "min x,min y,min z,max x,max y,max z,"
+       << "centroid x,centroid y,centroid z,mean,min,max" << endl;
+  foreach (const LabelStatistics& statistics, labelStatistics)
+    {
+    text << statistics.Label << ","
+         << statistics.VoxelCount << ","
+         << statistics.Volume << ","
+         << statistics.ComponentCount;
+    for (int i = 0; i < 3; ++i)
+      {
+      text << "," << statistics.First[i];
+      }
+    for (int i = 0; i < 3; ++i)
+      {
+      text << "," << statistics.Last[i];
+      }
+    for (int i = 0; i < 3; ++i)
+      {
+      text << "," << statistics.Centroid[i];
+      }
+    text << "," << statistics.Mean
+         << "," << statistics.Minimum
+         << "," << statistics.Maximum << endl;
+    }
+  return true;
+}
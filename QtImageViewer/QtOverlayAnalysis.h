@@ -0,0 +1,148 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+#ifndef __QtOverlayAnalysis_h
+#define __QtOverlayAnalysis_h
+
+// Qt includes
+#include <QAtomicInt>
+#include <QMutex>
+#include <QObject>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+#include <QWaitCondition>
+
+// ITK includes
+#include <itkImage.h>
+
+// ImageViewer includes
+#include "QtImageViewer_Export.h"
+class QtOverlayLayer;
+
+/// Connected components and statistics of the labels of an overlay layer.
+/// The volume is split into slabs along z, analyzed in parallel by
+/// Background tasks of the QtTaskScheduler that yield between slices:
+/// each slab labels the runs of its rows with a union-find, then the
+/// components are merged across the slab boundaries.
+/// Memory scales with the number of runs, not with the volume.
+/// analyze() waits for the slabs; start() runs it as a Background task
+/// and emits analyzed() when it is done.
+class QtImageViewer_EXPORT QtOverlayAnalysis : public QObject
+{
+  Q_OBJECT
+public:
+  typedef QObject               Superclass;
+  typedef itk::Image<double, 3> ImageType;
+
+  struct LabelStatistics
+    {
+    unsigned int Label;
+    quint64      VoxelCount;
+    /// VoxelCount times the volume of a voxel.
+    double       Volume;
+    /// Number of 6-connected components.
+    int          ComponentCount;
+    /// Bounding box and centroid, in index coordinates.
+    int          First[3];
+    int          Last[3];
+    double       Centroid[3];
+    /// Intensities of the image under the label.
+    double       Mean;
+    double       Minimum;
+    double       Maximum;
+    };
+
+  QtOverlayAnalysis(QObject* parent = 0);
+  /// Wait for the background analysis.
+  virtual ~QtOverlayAnalysis();
+
+  /// Analyze the labels of layer. image, if not NULL, must have the size
+  /// of the layer and gives the intensities. spacing is the voxel size.
+  /// Return false, leaving the statistics alone, if cancel() is called
+  /// meanwhile.
+  bool analyze(const QtOverlayLayer* layer, const ImageType* image,
+               const double spacing[3]);
+
+  /// Analyze the labels of layer in the background, see analyze(), once
+  /// the analysis in progress is done. The statistics are valid after
+  /// analyzed() has been emitted, until the next start(). Return the
+  /// number of the request, passed to analyzed().
+  int start(const QSharedPointer<QtOverlayLayer>& layer,
+             const ImageType* image, const double spacing[3]);
+
+  /// Block until the background analysis is done. The labels must not be
+  /// modified while it reads them.
+  void wait();
+
+  /// Abort the background analysis, which emits nothing, and block until
+  /// it has stopped reading the labels. It stops within a slice.
+  void cancel();
+
+  /// Return true if a background analysis is in progress.
+  bool isRunning() const;
+
+  /// Analyze the requested layer. Run by the analysis task.
+  void run();
+
+  /// Statistics of each label present in the layer, sorted by label.
+  /// The statistics are those of the last analysis completed, and can be
+  /// read while another one is in progress.
+  QVector<LabelStatistics> labels() const;
+
+  /// Return the number of connected components of all the labels.
+  int componentCount() const;
+
+  /// Return the duration of the last analysis, in milliseconds.
+  int duration() const;
+
+  /// Return a summary of the statistics, one line per label.
+  QString summary() const;
+
+  /// Write the statistics as comma separated values, one row per label.
+  /// Return false if the file cannot be written.
+  bool write(const QString& fileName) const;
+
+signals:
+  /// Emitted from a worker thread when the background analysis of request
+  /// is done, with the summary() of the statistics.
+  void analyzed(int request, const QString& summary);
+
+protected:
+  mutable QMutex                 Mutex;
+  QWaitCondition                 IdleCondition;
+  bool                           Running;
+  int                            Request;
+  QAtomicInt                     Canceled;
+  /// Request of the background analysis.
+  QSharedPointer<QtOverlayLayer> Layer;
+  ImageType::ConstPointer        Image;
+  double                         Spacing[3];
+
+  /// Statistics of the last analysis, guarded by Mutex.
+  QVector<LabelStatistics> Labels;
+  int                      ComponentCount;
+  int                      Duration;
+  bool                     HasIntensities;
+};
+
+#endif
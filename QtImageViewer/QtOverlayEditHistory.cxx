@@ -0,0 +1,240 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+
+//QtImageViewer includes
+#include "QtOverlayEditHistory.h"
+
+
+size_t QtOverlayEditHistory::Edit::memory() const
+{
+  return sizeof(Edit) + this->Runs.size() * sizeof(Run) +
+    this->OldValues.size() + this->NewValues.size();
+}
+
+
+QtOverlayEditHistory::QtOverlayEditHistory()
+  : Editing(false)
+  , MemoryLimit(64 * 1024 * 1024)
+  , Memory(0)
+{
+}
+
+
+void QtOverlayEditHistory::beginEdit(ImageType* image)
+{
+  this->CurrentEdit = Edit();
+  this->CurrentEdit.Image = image;
+  this->CurrentEdit.MaxOldValue = 0;
+  this->CurrentEdit.MaxNewValue = 0;
+  this->Editing = image != NULL;
+}
+
+
+void QtOverlayEditHistory::setVoxel(OffsetType offset, OffsetType stride,
+                                    unsigned char value)
+{
+  if (!this->Editing)
+    {
+    return;
+    }
+  Edit& edit = this->CurrentEdit;
+  unsigned char& voxel = edit.Image->GetBufferPointer()[offset];
+  if (voxel == value)
+    {
+    return;
+    }
+  Run* run = edit.Runs.isEmpty() ? NULL : &edit.Runs.last();
+  if (!run || run->Stride != stride ||
+      run->Offset + run->Length * stride != offset)
+    {
+    Run newRun;
+    newRun.Offset = offset;
+    newRun.Stride = stride;
+    newRun.Length = 0;
+    edit.Runs.append(newRun);
+    run = &edit.Runs.last();
+    }
+  ++run->Length;
+  edit.OldValues.append(voxel);
+  edit.NewValues.append(value);
+  edit.MaxOldValue = qMax(edit.MaxOldValue, voxel);
+  edit.MaxNewValue = qMax(edit.MaxNewValue, value);
+  voxel = value;
+}
+
+
+bool QtOverlayEditHistory::endEdit()
+{
+  if (!this->Editing)
+    {
+    return false;
+    }
+  this->Editing = false;
+  Edit& edit = this->CurrentEdit;
+  if (edit.Runs.isEmpty())
+    {
+    edit = Edit();
+    return false;
+    }
+  // Runs are along an axis: their ends bound them.
+  for (int i = 0; i < edit.Runs.size(); ++i)
+    {
+    const Run& run = edit.Runs[i];
+    const IndexType begin = edit.Image->ComputeIndex(run.Offset);
+    const IndexType end = edit.Image->ComputeIndex(
+      run.Offset + (run.Length - 1) * run.Stride);
+    for (int axis = 0; axis < 3; ++axis)
+      {
+      const itk::IndexValueType first = qMin(begin[axis], end[axis]);
+      const itk::IndexValueType last = qMax(begin[axis], end[axis]);
+      edit.First[axis] = i ? qMin(edit.First[axis], first) : first;
+      edit.Last[axis] = i ? qMax(edit.Last[axis], last) : last;
+      }
+    }
+  edit.Runs.squeeze();
+  edit.OldValues.squeeze();
+  edit.NewValues.squeeze();
+  foreach (const Edit& redoEdit, this->RedoEdits)
+    {
+    this->Memory -= redoEdit.memory();
+    }
+  this->RedoEdits.clear();
+  this->Memory += edit.memory();
+  this->UndoEdits.append(edit);
+  edit = Edit();
+  this->trim();
+  return true;
+}
+
+
+void QtOverlayEditHistory::cancelEdit()
+{
+  if (!this->Editing)
+    {
+    return;
+    }
+  this->Editing = false;
+  apply(this->CurrentEdit, true);
+  this->CurrentEdit = Edit();
+}
+
+
+bool QtOverlayEditHistory::isEditing() const
+{
+  return this->Editing;
+}
+
+
+bool QtOverlayEditHistory::canUndo() const
+{
+  return !this->UndoEdits.isEmpty();
+}
+
+
+bool QtOverlayEditHistory::canRedo() const
+{
+  return !this->RedoEdits.isEmpty();
+}
+
+
+const QtOverlayEditHistory::Edit* QtOverlayEditHistory::undo()
+{
+  if (this->UndoEdits.isEmpty())
+    {
+    return NULL;
+    }
+  this->RedoEdits.append(this->UndoEdits.takeLast());
+  apply(this->RedoEdits.last(), true);
+  return &this->RedoEdits.last();
+}
+
+
+const QtOverlayEditHistory::Edit* QtOverlayEditHistory::redo()
+{
+  if (this->RedoEdits.isEmpty())
+    {
+    return NULL;
+    }
+  this->UndoEdits.append(this->RedoEdits.takeLast());
+  apply(this->UndoEdits.last(), false);
+  return &this->UndoEdits.last();
+}
+
+
+void QtOverlayEditHistory::clear()
+{
+  this->UndoEdits.clear();
+  this->RedoEdits.clear();
+  this->Memory = 0;
+}
+
+
+void QtOverlayEditHistory::setMemoryLimit(size_t bytes)
+{
+  this->MemoryLimit = bytes;
+  this->trim();
+}
+
+
+size_t QtOverlayEditHistory::memoryLimit() const
+{
+  return this->MemoryLimit;
+}
+
+
+size_t QtOverlayEditHistory::memory() const
+{
+  return this->Memory;
+}
+
+
+void QtOverlayEditHistory::apply(const Edit& edit, bool undo)
+{
+  unsigned char* buffer = edit.Image->GetBufferPointer();
+  const unsigned char* values = undo ? edit.OldValues.constData()
+                                     : edit.NewValues.constData();
+  foreach (const Run& run, edit.Runs)
+    {
+    unsigned char* voxel = buffer + run.Offset;
+    for (int i = 0; i < run.Length; ++i, voxel += run.Stride)
+      {
+      *voxel = *values++;
+      }
+    }
+  edit.Image->Modified();
+}
+
+
+void QtOverlayEditHistory::trim()
+{
+  // The oldest edits are the first ones to undo, then the last ones to
+  // redo.
+  while (this->Memory > this->MemoryLimit && !this->UndoEdits.isEmpty())
+    {
+    this->Memory -= this->UndoEdits.takeFirst().memory();
+    }
+  while (this->Memory > this->MemoryLimit && !this->RedoEdits.isEmpty())
+    {
+    this->Memory -= this->RedoEdits.takeFirst().memory();
+    }
+}
@@ -0,0 +1,127 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+#ifndef __QtOverlayEditHistory_h
+#define __QtOverlayEditHistory_h
+
+// Qt includes
+#include <QList>
+#include <QVector>
+
+// ITK includes
+#include <itkImage.h>
+
+// ImageViewer includes
+#include "QtImageViewer_Export.h"
+
+/// Undo and redo history of the edits of 8-bit overlay images.
+/// An edit only stores the voxels it changed, as runs of voxels along a
+/// row with their old and new values. The oldest edits are dropped when
+/// the history exceeds its memory limit.
+class QtImageViewer_EXPORT QtOverlayEditHistory
+{
+public:
+  typedef itk::Image<unsigned char, 3> ImageType;
+  typedef ImageType::IndexType         IndexType;
+  typedef itk::OffsetValueType         OffsetType;
+
+  /// Voxels Offset, Offset + Stride, ... Offset + (Length-1) * Stride of
+  /// the buffer of the image.
+  struct Run
+    {
+    OffsetType Offset;
+    OffsetType Stride;
+    int        Length;
+    };
+
+  struct Edit
+    {
+    ImageType::Pointer     Image;
+    QVector<Run>           Runs;
+    /// Values of the voxels of the runs, one after the other.
+    QVector<unsigned char> OldValues;
+    QVector<unsigned char> NewValues;
+    unsigned char          MaxOldValue;
+    unsigned char          MaxNewValue;
+    /// Box of the changed voxels.
+    IndexType              First;
+    IndexType              Last;
+
+    /// Return the number of bytes used by the edit.
+    size_t memory() const;
+    };
+
+  QtOverlayEditHistory();
+
+  /// Start recording an edit of image. The redo history is discarded when
+  /// the edit ends.
+  void beginEdit(ImageType* image);
+
+  /// Set the voxel at offset of the buffer of the edited image to value,
+  /// recording its old value if it changes. Voxels written one after the
+  /// other with the same stride share a run.
+  void setVoxel(OffsetType offset, OffsetType stride, unsigned char value);
+
+  /// Stop recording the edit. Return false if no voxel changed.
+  bool endEdit();
+
+  /// Stop recording the edit and restore the voxels it changed, e.g. to
+  /// discard a preview.
+  void cancelEdit();
+
+  bool isEditing() const;
+  bool canUndo() const;
+  bool canRedo() const;
+
+  /// Restore the old values of the last edit and return it, NULL if there
+  /// is none. The edit remains valid until the history is modified.
+  const Edit* undo();
+
+  /// Apply again the last undone edit and return it, NULL if there is none.
+  const Edit* redo();
+
+  /// Discard all the edits.
+  void clear();
+
+  /// Maximum number of bytes used by the edits, 64MB by default.
+  void setMemoryLimit(size_t bytes);
+  size_t memoryLimit() const;
+
+  /// Number of bytes used by the edits.
+  size_t memory() const;
+
+protected:
+  /// Write the old or new values of edit into its image.
+  static void apply(const Edit& edit, bool undo);
+
+  /// Drop the oldest edits until the memory limit is respected.
+  void trim();
+
+  QList<Edit> UndoEdits;
+  QList<Edit> RedoEdits;
+  Edit        CurrentEdit;
+  bool        Editing;
+  size_t      MemoryLimit;
+  size_t      Memory;
+};
+
+#endif
@@ -0,0 +1,740 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+
+//QtImageViewer includes
+#include "QtOverlayLayer.h"
+
+// Qt includes
+#include <QMutexLocker>
+
+//itk includes
+#include "itkImageFileReader.h"
+#include "itkMinimumMaximumImageCalculator.h"
+
+//std includes
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <iostream>
+
+
+namespace
+{
+
+/// Pack a color so that its bytes are in RGBA order in memory.
+inline unsigned int packRGBA(unsigned char r, unsigned char g,
+                             unsigned char b, unsigned char a)
+{
+  const unsigned char bytes[4] = {r, g, b, a};
+  unsigned int rgba;
+  memcpy(&rgba, bytes, 4);
+  return rgba;
+}
+
+template <class TImage>
+unsigned int computeLabelCount(const TImage* image)
+{
+  typedef itk::MinimumMaximumImageCalculator<TImage> CalculatorType;
+  typename CalculatorType::Pointer calculator = CalculatorType::New();
+  calculator->SetImage(image);
+  calculator->Compute();
+  return static_cast<unsigned int>(calculator->GetMaximum()) + 1;
+}
+
+/// Per pixel type kernels.
+template <class TPixel>
+struct OverlayPixelTraits;
+
+template <>
+struct OverlayPixelTraits<unsigned char>
+{
+  static const bool IsLabelMap = true;
+  template <class TImage>
+  static unsigned int labelCount(const TImage* image)
+    {
+    return computeLabelCount(image);
+    }
+  static inline bool isEmpty(unsigned char label)
+    {
+    return label == 0;
+    }
+  static inline unsigned int value(unsigned char label)
+    {
+    return label;
+    }
+};
+
+template <>
+struct OverlayPixelTraits<unsigned short>
+{
+  static const bool IsLabelMap = true;
+  template <class TImage>
+  static unsigned int labelCount(const TImage* image)
+    {
+    return computeLabelCount(image);
+    }
+  static inline bool isEmpty(unsigned short label)
+    {
+    return label == 0;
+    }
+  static inline unsigned int value(unsigned short label)
+    {
+    return label;
+    }
+};
+
+template <>
+struct OverlayPixelTraits<itk::RGBPixel<unsigned char> >
+{
+  static const bool IsLabelMap = false;
+  template <class TImage>
+  static unsigned int labelCount(const TImage*)
+    {
+    return 0;
+    }
+  static inline bool isEmpty(const itk::RGBPixel<unsigned char>& color)
+    {
+    return color[0] + color[1] + color[2] == 0;
+    }
+  static inline unsigned int value(const itk::RGBPixel<unsigned char>& color)
+    {
+    if (isEmpty(color))
+      {
+      return 0;
+      }
+    return packRGBA(color[0], color[1], color[2], 255);
+    }
+};
+
+template <>
+struct OverlayPixelTraits<itk::RGBAPixel<unsigned char> >
+{
+  static const bool IsLabelMap = false;
+  template <class TImage>
+  static unsigned int labelCount(const TImage*)
+    {
+    return 0;
+    }
+  static inline bool isEmpty(const itk::RGBAPixel<unsigned char>& color)
+    {
+    return color[0] + color[1] + color[2] == 0;
+    }
+  static inline unsigned int value(
+    const itk::RGBAPixel<unsigned char>& color)
+    {
+    if (isEmpty(color))
+      {
+      return 0;
+      }
+    return packRGBA(color[0], color[1], color[2], color[3]);
+    }
+};
+
+/// Order runs by their end, to find the first run ending after a voxel.
+bool runEndsBefore(const QtRLEOverlayLayer::Run& run, unsigned int x)
+{
+  return static_cast<unsigned int>(run.Begin) + run.Length <= x;
+}
+
+} // end of anonymous namespace
+
+
+QtOverlayLayer::~QtOverlayLayer()
+{
+}
+
+
+QtOverlayLayer::SizeType QtOverlayLayer::size() const
+{
+  return this->image()->GetLargestPossibleRegion().GetSize();
+}
+
+
+void QtOverlayLayer::clearOccupancy(const SizeType& size)
+{
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    this->SliceBounds[axis].resize(4 * size[axis]);
+    for (int i = 0; i < this->SliceBounds[axis].size(); i += 2)
+      {
+      this->SliceBounds[axis][i] = INT_MAX;
+      this->SliceBounds[axis][i + 1] = -1;
+      }
+    }
+}
+
+
+void QtOverlayLayer::addToOccupancy(int beginX, int endX, int y, int z)
+{
+  int* zBounds = this->SliceBounds[2].data() + 4 * z;
+  zBounds[0] = qMin(zBounds[0], beginX);
+  zBounds[1] = qMax(zBounds[1], endX - 1);
+  zBounds[2] = qMin(zBounds[2], y);
+  zBounds[3] = qMax(zBounds[3], y);
+  int* yBounds = this->SliceBounds[1].data() + 4 * y;
+  yBounds[0] = qMin(yBounds[0], beginX);
+  yBounds[1] = qMax(yBounds[1], endX - 1);
+  yBounds[2] = qMin(yBounds[2], z);
+  yBounds[3] = qMax(yBounds[3], z);
+  int* xBounds = this->SliceBounds[0].data() + 4 * beginX;
+  for (int x = beginX; x < endX; ++x, xBounds += 4)
+    {
+    xBounds[0] = qMin(xBounds[0], y);
+    xBounds[1] = qMax(xBounds[1], y);
+    xBounds[2] = qMin(xBounds[2], z);
+    xBounds[3] = qMax(xBounds[3], z);
+    }
+}
+
+
+unsigned int QtOverlayLayer::valueAt(const IndexType& index) const
+{
+  unsigned int value = 0;
+  this->sampleRow(index, 0, 1, NULL, 0, &value);
+  return value;
+}
+
+
+bool QtOverlayLayer::bounds(int axis, int firstSlice, int lastSlice,
+                            int bounds[4]) const
+{
+  bounds[0] = bounds[2] = INT_MAX;
+  bounds[1] = bounds[3] = -1;
+  firstSlice = qMax(firstSlice, 0);
+  lastSlice = qMin(lastSlice, this->SliceBounds[axis].size() / 4 - 1);
+  const int* sliceBounds = this->SliceBounds[axis].constData();
+  for (int slice = firstSlice; slice <= lastSlice; ++slice)
+    {
+    const int* b = sliceBounds + 4 * slice;
+    bounds[0] = qMin(bounds[0], b[0]);
+    bounds[1] = qMax(bounds[1], b[1]);
+    bounds[2] = qMin(bounds[2], b[2]);
+    bounds[3] = qMax(bounds[3], b[3]);
+    }
+  return bounds[0] <= bounds[1];
+}
+
+
+int QtOverlayLayer::nextLabeledSlice(int axis, int slice,
+                                     int direction) const
+{
+  const int step = direction < 0 ? -1 : 1;
+  const int sliceCount = this->SliceBounds[axis].size() / 4;
+  const int* sliceBounds = this->SliceBounds[axis].constData();
+  for (slice += step; slice >= 0 && slice < sliceCount; slice += step)
+    {
+    if (sliceBounds[4 * slice] <= sliceBounds[4 * slice + 1])
+      {
+      return slice;
+      }
+    }
+  return -1;
+}
+
+
+template <class TPixel>
+QtImageOverlayLayer<TPixel>::QtImageOverlayLayer(ImageType* image)
+  : Image(image)
+  , LabelCount(OverlayPixelTraits<TPixel>::labelCount(image))
+{
+  this->buildOccupancy();
+}
+
+
+template <class TPixel>
+void QtImageOverlayLayer<TPixel>::buildOccupancy()
+{
+  typedef OverlayPixelTraits<TPixel> Traits;
+  const SizeType size = this->size();
+  this->clearOccupancy(size);
+  const int sizeX = size[0];
+  const TPixel* voxel = this->Image->GetBufferPointer();
+  for (unsigned int z = 0; z < size[2]; ++z)
+    {
+    for (unsigned int y = 0; y < size[1]; ++y, voxel += sizeX)
+      {
+      int x = 0;
+      while (x < sizeX)
+        {
+        if (Traits::isEmpty(voxel[x]))
+          {
+          ++x;
+          continue;
+          }
+        const int begin = x;
+        while (x < sizeX && !Traits::isEmpty(voxel[x]))
+          {
+          ++x;
+          }
+        this->addToOccupancy(begin, x, y, z);
+        }
+      }
+    }
+}
+
+
+template <class TPixel>
+void QtImageOverlayLayer<TPixel>::boxModified(const IndexType& first,
+                                              const IndexType& last,
+                                              unsigned int label)
+{
+  if (label == 0)
+    {
+    return;
+    }
+  this->LabelCount = qMax(this->LabelCount, label + 1);
+  for (itk::IndexValueType z = first[2]; z <= last[2]; ++z)
+    {
+    for (itk::IndexValueType y = first[1]; y <= last[1]; ++y)
+      {
+      this->addToOccupancy(first[0], last[0] + 1, y, z);
+      }
+    }
+}
+
+
+template <class TPixel>
+typename QtImageOverlayLayer<TPixel>::ImageType*
+QtImageOverlayLayer<TPixel>::overlayImage() const
+{
+  return this->Image.GetPointer();
+}
+
+
+template <class TPixel>
+const QtOverlayLayer::ImageBaseType*
+QtImageOverlayLayer<TPixel>::image() const
+{
+  return this->Image.GetPointer();
+}
+
+
+template <class TPixel>
+bool QtImageOverlayLayer<TPixel>::isLabelMap() const
+{
+  return OverlayPixelTraits<TPixel>::IsLabelMap;
+}
+
+
+template <class TPixel>
+unsigned int QtImageOverlayLayer<TPixel>::labelCount() const
+{
+  return this->LabelCount;
+}
+
+
+template <class TPixel>
+void QtImageOverlayLayer<TPixel>::sampleRow(
+  IndexType index, int axis, int count,
+  const unsigned short* depths, int depthAxis,
+  unsigned int* values) const
+{
+  typedef OverlayPixelTraits<TPixel> Traits;
+  const itk::OffsetValueType* offsets = this->Image->GetOffsetTable();
+  const itk::OffsetValueType stride = offsets[axis];
+  if (depths)
+    {
+    index[depthAxis] = 0;
+    }
+  const TPixel* voxel = this->Image->GetBufferPointer() +
+    this->Image->ComputeOffset(index);
+  if (!depths)
+    {
+    for (int i = 0; i < count; ++i, voxel += stride)
+      {
+      values[i] = Traits::value(*voxel);
+      }
+    return;
+    }
+  const itk::OffsetValueType depthStride = offsets[depthAxis];
+  for (int i = 0; i < count; ++i, voxel += stride)
+    {
+    values[i] = Traits::value(voxel[depths[i] * depthStride]);
+    }
+}
+
+
+template class QtImageOverlayLayer<unsigned char>;
+template class QtImageOverlayLayer<unsigned short>;
+template class QtImageOverlayLayer<itk::RGBPixel<unsigned char> >;
+template class QtImageOverlayLayer<itk::RGBAPixel<unsigned char> >;
+
+
+QtRLEOverlayLayer::QtRLEOverlayLayer(
+  const itk::Image<unsigned char, 3>* image)
+  : LabelCount(0)
+{
+  this->encode(image);
+}
+
+
+QtRLEOverlayLayer::QtRLEOverlayLayer(
+  const itk::Image<unsigned short, 3>* image)
+  : LabelCount(0)
+{
+  this->encode(image);
+}
+
+
+template <class TImage>
+void QtRLEOverlayLayer::encode(const TImage* image)
+{
+  this->Geometry = ImageBaseType::New();
+  this->Geometry->CopyInformation(image);
+  this->Geometry->SetRegions(image->GetLargestPossibleRegion());
+
+  const SizeType size = image->GetLargestPossibleRegion().GetSize();
+  const unsigned int rowCount = size[1] * size[2];
+  const unsigned int rowLength = qMin<unsigned int>(size[0], 65535);
+  const typename TImage::PixelType* voxel = image->GetBufferPointer();
+  unsigned int maxLabel = 0;
+  this->clearOccupancy(size);
+  this->RowStarts.resize(rowCount + 1);
+  this->Runs.clear();
+  for (unsigned int row = 0; row < rowCount; ++row, voxel += size[0])
+    {
+    this->RowStarts[row] = this->Runs.size();
+    unsigned int x = 0;
+    while (x < rowLength)
+      {
+      const unsigned short label = voxel[x];
+      unsigned int end = x + 1;
+      while (end < rowLength && voxel[end] == label)
+        {
+        ++end;
+        }
+      if (label != 0)
+        {
+        Run run;
+        run.Begin = x;
+        run.Length = end - x;
+        run.Label = label;
+        this->Runs.append(run);
+        this->addToOccupancy(x, end, row % size[1], row / size[1]);
+        maxLabel = qMax<unsigned int>(maxLabel, label);
+        }
+      x = end;
+      }
+    }
+  this->RowStarts[rowCount] = this->Runs.size();
+  this->Runs.squeeze();
+  this->LabelCount = maxLabel + 1;
+}
+
+
+const QtOverlayLayer::ImageBaseType* QtRLEOverlayLayer::image() const
+{
+  return this->Geometry.GetPointer();
+}
+
+
+bool QtRLEOverlayLayer::isLabelMap() const
+{
+  return true;
+}
+
+
+unsigned int QtRLEOverlayLayer::labelCount() const
+{
+  return this->LabelCount;
+}
+
+
+int QtRLEOverlayLayer::runCount() const
+{
+  return this->Runs.size();
+}
+
+
+const QtRLEOverlayLayer::Run* QtRLEOverlayLayer::rowRuns(
+  const IndexType& index, const Run** end) const
+{
+  const SizeType size = this->size();
+  const unsigned int row = index[1] + index[2] * size[1];
+  const Run* runs = this->Runs.constData();
+  *end = runs + this->RowStarts[row + 1];
+  return runs + this->RowStarts[row];
+}
+
+
+unsigned short QtRLEOverlayLayer::label(const IndexType& index) const
+{
+  const Run* end;
+  const Run* run = this->rowRuns(index, &end);
+  run = std::lower_bound(run, end, static_cast<unsigned int>(index[0]),
+                         runEndsBefore);
+  if (run == end || run->Begin > index[0])
+    {
+    return 0;
+    }
+  return run->Label;
+}
+
+
+void QtRLEOverlayLayer::sampleRow(
+  IndexType index, int axis, int count,
+  const unsigned short* depths, int depthAxis,
+  unsigned int* values) const
+{
+  if (axis != 0 || depths)
+    {
+    // Each voxel is in a different row.
+    const itk::IndexValueType start = index[axis];
+    for (int i = 0; i < count; ++i)
+      {
+      index[axis] = start + i;
+      if (depths)
+        {
+        index[depthAxis] = depths[i];
+        }
+      values[i] = this->label(index);
+      }
+    return;
+    }
+  // Decode the runs of the row that overlap [begin, last).
+  const unsigned int begin = index[0];
+  const unsigned int last = begin + count;
+  const Run* end;
+  const Run* run = this->rowRuns(index, &end);
+  run = std::lower_bound(run, end, begin, runEndsBefore);
+  for (; run != end && run->Begin < last; ++run)
+    {
+    const unsigned int runBegin = qMax<unsigned int>(run->Begin, begin);
+    const unsigned int runEnd = qMin<unsigned int>(run->Begin + run->Length,
+                                                   last);
+    std::fill(values + runBegin - begin, values + runEnd - begin,
+              static_cast<unsigned int>(run->Label));
+    }
+}
+
+
+QtStreamedOverlayLayer::QtStreamedOverlayLayer(const QString& fileName,
+                                               size_t cacheSize)
+  : FileName(fileName)
+  , LabelCount(1)
+  , SlabDepth(1)
+  , CacheSize(cacheSize)
+  , SlabReadCount(0)
+{
+  typedef itk::ImageFileReader<itk::Image<unsigned short, 3> > ReaderType;
+  ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(fileName.toLatin1().data());
+  reader->UpdateOutputInformation();
+  this->Geometry = ImageBaseType::New();
+  this->Geometry->CopyInformation(reader->GetOutput());
+  this->Geometry->SetRegions(
+    reader->GetOutput()->GetLargestPossibleRegion());
+  const itk::ImageIOBase::IOComponentType componentType =
+    reader->GetImageIO()->GetComponentType();
+  if (componentType != itk::ImageIOBase::UCHAR &&
+      componentType != itk::ImageIOBase::USHORT)
+    {
+    // Negative labels would wrap around through the unsigned voxels.
+    itkGenericExceptionMacro(<< "Only unsigned 8-bit or 16-bit label maps "
+                             << "can be streamed: " << fileName.toStdString());
+    }
+
+  // Slabs of about 4MB, read at once.
+  const SizeType size = this->size();
+  const size_t sliceSize = size[0] * size[1] * sizeof(unsigned short);
+  this->SlabDepth = static_cast<int>(qBound<size_t>(
+    1, (4 * 1024 * 1024) / qMax<size_t>(sliceSize, 1), size[2]));
+
+  // Unknown until read: every voxel may be labeled.
+  this->clearOccupancy(size);
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    const int lower = axis == 0 ? 1 : 0;
+    const int higher = axis == 2 ? 1 : 2;
+    for (int i = 0; i < this->SliceBounds[axis].size(); i += 4)
+      {
+      this->SliceBounds[axis][i] = 0;
+      this->SliceBounds[axis][i + 1] = size[lower] - 1;
+      this->SliceBounds[axis][i + 2] = 0;
+      this->SliceBounds[axis][i + 3] = size[higher] - 1;
+      }
+    }
+}
+
+
+const QtOverlayLayer::ImageBaseType* QtStreamedOverlayLayer::image() const
+{
+  return this->Geometry.GetPointer();
+}
+
+
+bool QtStreamedOverlayLayer::isLabelMap() const
+{
+  return true;
+}
+
+
+unsigned int QtStreamedOverlayLayer::labelCount() const
+{
+  QMutexLocker locker(&this->Mutex);
+  return this->LabelCount;
+}
+
+
+void QtStreamedOverlayLayer::setCacheSize(size_t bytes)
+{
+  QMutexLocker locker(&this->Mutex);
+  this->CacheSize = bytes;
+  this->trim();
+}
+
+
+size_t QtStreamedOverlayLayer::cacheSize() const
+{
+  return this->CacheSize;
+}
+
+
+int QtStreamedOverlayLayer::slabDepth() const
+{
+  return this->SlabDepth;
+}
+
+
+int QtStreamedOverlayLayer::slabReadCount() const
+{
+  QMutexLocker locker(&this->Mutex);
+  return this->SlabReadCount;
+}
+
+
+QtStreamedOverlayLayer::SlabPointer
+QtStreamedOverlayLayer::slab(int slabIndex) const
+{
+  {
+  QMutexLocker locker(&this->Mutex);
+  SlabPointer cached = this->Slabs.value(slabIndex);
+  if (cached)
+    {
+    this->RecentSlabs.removeOne(slabIndex);
+    this->RecentSlabs.append(slabIndex);
+    return cached;
+    }
+  }
+  QMutexLocker readLocker(&this->ReadMutex);
+  {
+  // Read by another thread while waiting.
+  QMutexLocker locker(&this->Mutex);
+  SlabPointer cached = this->Slabs.value(slabIndex);
+  if (cached)
+    {
+    return cached;
+    }
+  }
+
+  const SizeType size = this->size();
+  typedef itk::Image<unsigned short, 3>      ImageType;
+  typedef itk::ImageFileReader<ImageType>    ReaderType;
+  ImageType::RegionType region = this->Geometry->GetLargestPossibleRegion();
+  const int firstSlice = slabIndex * this->SlabDepth;
+  const int sliceCount = qMin<int>(this->SlabDepth, size[2] - firstSlice);
+  region.SetIndex(2, region.GetIndex()[2] + firstSlice);
+  region.SetSize(2, sliceCount);
+  SlabPointer slab(new SlabType(size[0] * size[1] * sliceCount, 0));
+  try
+    {
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName(this->FileName.toLatin1().data());
+    reader->UpdateOutputInformation();
+    reader->GetOutput()->SetRequestedRegion(region);
+    reader->Update();
+    // The reader may return a larger region than requested.
+    const ImageType* image = reader->GetOutput();
+    const unsigned short* voxel =
+      image->GetBufferPointer() + image->ComputeOffset(region.GetIndex());
+    std::copy(voxel, voxel + slab->size(), slab->data());
+    }
+  catch (itk::ExceptionObject & e)
+    {
+    // The slab is left empty rather than read again for each row.
+    std::cerr << "Exception when reading overlay slab" << std::endl;
+    std::cerr << e << std::endl;
+    }
+
+  const unsigned int maxLabel = slab->isEmpty() ? 0 :
+    *std::max_element(slab->constBegin(), slab->constEnd());
+  QMutexLocker locker(&this->Mutex);
+  this->LabelCount = qMax(this->LabelCount, maxLabel + 1);
+  ++this->SlabReadCount;
+  this->Slabs.insert(slabIndex, slab);
+  this->RecentSlabs.append(slabIndex);
+  this->trim();
+  return slab;
+}
+
+
+void QtStreamedOverlayLayer::trim() const
+{
+  const SizeType size = this->size();
+  const size_t slabSize =
+    size[0] * size[1] * this->SlabDepth * sizeof(unsigned short);
+  // The last slab is the one being sampled.
+  while (this->RecentSlabs.size() > 1 &&
+         this->RecentSlabs.size() * slabSize > this->CacheSize)
+    {
+    this->Slabs.remove(this->RecentSlabs.takeFirst());
+    }
+}
+
+
+void QtStreamedOverlayLayer::sampleRow(
+  IndexType index, int axis, int count,
+  const unsigned short* depths, int depthAxis,
+  unsigned int* values) const
+{
+  const SizeType size = this->size();
+  const itk::OffsetValueType sizeX = size[0];
+  const itk::OffsetValueType sliceSize = sizeX * size[1];
+  const itk::OffsetValueType strides[3] = {1, sizeX, sliceSize};
+  if (depths)
+    {
+    index[depthAxis] = 0;
+    }
+  // The voxels are sampled from the same slab as long as possible.
+  SlabPointer slab;
+  const unsigned short* voxels = NULL;
+  int slabIndex = -1;
+  for (int i = 0; i < count; ++i, ++index[axis])
+    {
+    const itk::IndexValueType z =
+      index[2] + (depths && depthAxis == 2 ? depths[i] : 0);
+    if (z / this->SlabDepth != slabIndex)
+      {
+      slabIndex = z / this->SlabDepth;
+      slab = this->slab(slabIndex);
+      voxels = slab->constData();
+      }
+    itk::OffsetValueType offset = index[0] + index[1] * strides[1] +
+      (z - slabIndex * this->SlabDepth) * sliceSize;
+    if (depths && depthAxis != 2)
+      {
+      offset += depths[i] * strides[depthAxis];
+      }
+    values[i] = voxels[offset];
+    }
+}
@@ -0,0 +1,255 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+#ifndef __QtOverlayLayer_h
+#define __QtOverlayLayer_h
+
+// Qt includes
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+// ITK includes
+#include <itkImage.h>
+#include <itkImageBase.h>
+#include <itkRGBAPixel.h>
+#include <itkRGBPixel.h>
+
+// ImageViewer includes
+#include "QtImageViewer_Export.h"
+
+/// Overlay drawn over the slices of a QtGlSliceView.
+/// A layer is either a label map, whose labels are colored by the view
+/// through a lookup table of packed RGBA8 colors, or a color image.
+/// The layer is read from the render threads, it must not be modified while
+/// a frame is being rendered.
+class QtImageViewer_EXPORT QtOverlayLayer
+{
+public:
+  typedef itk::ImageBase<3>        ImageBaseType;
+  typedef ImageBaseType::IndexType IndexType;
+  typedef ImageBaseType::SizeType  SizeType;
+
+  virtual ~QtOverlayLayer();
+
+  virtual const ImageBaseType* image() const = 0;
+  SizeType size() const;
+
+  /// Return true if the voxels are labels, false if they are colors.
+  virtual bool isLabelMap() const = 0;
+
+  /// Return the largest label + 1, 0 for color overlays.
+  virtual unsigned int labelCount() const = 0;
+
+  /// Write the value of count voxels, starting at index and moving along
+  /// axis: the label for label maps, the packed RGBA8 color for color
+  /// overlays, 0 for the background. If depths is not NULL, voxel i is
+  /// taken at depths[i] along depthAxis, as for the MIP.
+  /// values must be cleared beforehand: background voxels may be skipped.
+  virtual void sampleRow(IndexType index, int axis, int count,
+                         const unsigned short* depths, int depthAxis,
+                         unsigned int* values) const = 0;
+
+  /// Return the value of the voxel at index, as written by sampleRow().
+  unsigned int valueAt(const IndexType& index) const;
+
+  /// Return false if the slices [firstSlice, lastSlice] along axis have no
+  /// visible voxel. Otherwise bounds receives the box of their visible
+  /// voxels: min and max along the lower, then the higher, of the other two
+  /// axes.
+  bool bounds(int axis, int firstSlice, int lastSlice, int bounds[4]) const;
+
+  /// Return the first slice after slice along axis (before it if direction
+  /// is negative) with a visible voxel, -1 if there is none.
+  int nextLabeledSlice(int axis, int slice, int direction) const;
+
+protected:
+  /// Empty the occupancy index for an overlay of the given size.
+  void clearOccupancy(const SizeType& size);
+
+  /// Add the visible voxels [beginX, endX) of the row (y, z) to the
+  /// occupancy index.
+  void addToOccupancy(int beginX, int endX, int y, int z);
+
+  /// Occupancy index: bounds of the visible voxels of each slice along
+  /// each axis, 4 values per slice as returned by bounds(). Empty slices
+  /// have a min greater than their max.
+  QVector<int> SliceBounds[3];
+};
+
+/// Overlay layer stored as an itk::Image. TPixel can be unsigned char or
+/// unsigned short for label maps, itk::RGBPixel<unsigned char> or
+/// itk::RGBAPixel<unsigned char> for colors. Each type has its own kernel.
+template <class TPixel>
+class QtImageViewer_EXPORT QtImageOverlayLayer : public QtOverlayLayer
+{
+public:
+  typedef TPixel                  PixelType;
+  typedef itk::Image<TPixel, 3>   ImageType;
+
+  QtImageOverlayLayer(ImageType* image);
+
+  ImageType* overlayImage() const;
+
+  /// Update the occupancy index and the label count after the voxels of
+  /// the box [first, last] have been set to label or cleared, label being
+  /// 0 then. Cleared voxels are kept in the index.
+  void boxModified(const IndexType& first, const IndexType& last,
+                   unsigned int label);
+
+  virtual const ImageBaseType* image() const;
+  virtual bool isLabelMap() const;
+  virtual unsigned int labelCount() const;
+  virtual void sampleRow(IndexType index, int axis, int count,
+                         const unsigned short* depths, int depthAxis,
+                         unsigned int* values) const;
+
+protected:
+  void buildOccupancy();
+
+  typename ImageType::Pointer Image;
+  unsigned int                LabelCount;
+};
+
+typedef QtImageOverlayLayer<unsigned char>  QtLabel8OverlayLayer;
+typedef QtImageOverlayLayer<unsigned short> QtLabel16OverlayLayer;
+typedef QtImageOverlayLayer<itk::RGBPixel<unsigned char> >
+  QtRGBOverlayLayer;
+typedef QtImageOverlayLayer<itk::RGBAPixel<unsigned char> >
+  QtRGBAOverlayLayer;
+
+/// Label map stored as runs of equal labels along the rows of the x axis.
+/// Background runs are not stored, so the memory and the sampling cost
+/// scale with the labeled area.
+class QtImageViewer_EXPORT QtRLEOverlayLayer : public QtOverlayLayer
+{
+public:
+  /// Encode a label map. The image is not referenced afterwards.
+  /// Images wider than 65535 voxels are not supported.
+  QtRLEOverlayLayer(const itk::Image<unsigned char, 3>* image);
+  QtRLEOverlayLayer(const itk::Image<unsigned short, 3>* image);
+
+  virtual const ImageBaseType* image() const;
+  virtual bool isLabelMap() const;
+  virtual unsigned int labelCount() const;
+  virtual void sampleRow(IndexType index, int axis, int count,
+                         const unsigned short* depths, int depthAxis,
+                         unsigned int* values) const;
+
+  /// Return the label at index.
+  unsigned short label(const IndexType& index) const;
+
+  /// Number of runs of labeled voxels.
+  int runCount() const;
+
+  struct Run
+    {
+    unsigned short Begin;
+    unsigned short Length;
+    unsigned short Label;
+    };
+
+protected:
+  template <class TImage>
+  void encode(const TImage* image);
+
+  /// Return the first run of the row of index, and in end the run after
+  /// its last one.
+  const Run* rowRuns(const IndexType& index, const Run** end) const;
+
+  ImageBaseType::Pointer  Geometry;
+  /// Runs of the row y + z * sizeY are Runs[RowStarts[row]] to
+  /// Runs[RowStarts[row + 1] - 1], sorted along x.
+  QVector<unsigned int>   RowStarts;
+  QVector<Run>            Runs;
+  unsigned int            LabelCount;
+};
+
+/// Label map read from its file on demand, by slabs of slices along z.
+/// Only the slabs holding sampled voxels are read, with the streaming of
+/// the ITK image IO, so that the first slices are shown without reading
+/// the whole file. The least recently used slabs are released once the
+/// cache exceeds its size; the views sampling every slab, e.g. across z
+/// or the MIP, then read the file again for each frame.
+/// The occupancy index is not known without reading the file: every slice
+/// is taken as labeled.
+class QtImageViewer_EXPORT QtStreamedOverlayLayer : public QtOverlayLayer
+{
+public:
+  /// Read the information of the label map of fileName, of unsigned 8-bit
+  /// or 16-bit voxels. Throw itk::ExceptionObject if it cannot be read or
+  /// is of another voxel type.
+  QtStreamedOverlayLayer(const QString& fileName,
+                         size_t cacheSize = 256 * 1024 * 1024);
+
+  virtual const ImageBaseType* image() const;
+  virtual bool isLabelMap() const;
+  /// Return the largest label of the slabs read so far + 1. It grows as
+  /// the slabs are read.
+  virtual unsigned int labelCount() const;
+  virtual void sampleRow(IndexType index, int axis, int count,
+                         const unsigned short* depths, int depthAxis,
+                         unsigned int* values) const;
+
+  /// Maximum number of bytes of the slabs kept in memory.
+  void setCacheSize(size_t bytes);
+  size_t cacheSize() const;
+
+  /// Number of slices along z read at once.
+  int slabDepth() const;
+
+  /// Number of slabs read from the file so far, including the ones read
+  /// again after they have been released.
+  int slabReadCount() const;
+
+protected:
+  typedef QVector<unsigned short>     SlabType;
+  typedef QSharedPointer<SlabType>    SlabPointer;
+
+  /// Return the voxels of the slab, reading them if they are not cached.
+  /// The slab remains valid while referenced, even once released.
+  SlabPointer slab(int slabIndex) const;
+
+  /// Release the least recently used slabs beyond the cache size.
+  /// Mutex must be locked.
+  void trim() const;
+
+  QString                       FileName;
+  ImageBaseType::Pointer        Geometry;
+  /// Guarded by Mutex.
+  mutable unsigned int          LabelCount;
+  int                           SlabDepth;
+  size_t                        CacheSize;
+  /// Guards the cache below.
+  mutable QMutex                Mutex;
+  mutable QHash<int, SlabPointer> Slabs;
+  /// Cached slabs, the most recently used last.
+  mutable QList<int>            RecentSlabs;
+  mutable int                   SlabReadCount;
+  /// Serializes the reads, so that a slab is only read once.
+  mutable QMutex                ReadMutex;
+};
+
+#endif
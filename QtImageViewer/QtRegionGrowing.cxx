@@ -0,0 +1,326 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+
+//QtImageViewer includes
+#include "QtRegionGrowing.h"
+#include "QtTaskScheduler.h"
+
+// Qt includes
+#include <QBitArray>
+#include <QMutexLocker>
+
+//std includes
+#include <limits>
+
+
+/// Task running the background fill of a QtRegionGrowing.
+class QtRegionGrowingTask : public QtTask
+{
+public:
+  QtRegionGrowingTask(QtRegionGrowing* growing)
+    : QtTask(QtTask::Refinement)
+    , Growing(growing)
+    {
+    }
+  virtual bool run()
+    {
+    // Give way to the visible frames between the batches of spans.
+    while (!this->Growing->run(SpansPerBatch))
+      {
+      if (this->shouldYield())
+        {
+        return false;
+        }
+      }
+    return true;
+    }
+  static const int SpansPerBatch = 1024;
+protected:
+  QtRegionGrowing* Growing;
+};
+
+
+QtRegionGrowing::Region::Region()
+  : Stride(1)
+{
+  this->First.Fill(0);
+  this->Last.Fill(-1);
+}
+
+
+QtRegionGrowing::Fill::Fill()
+  : Image(0)
+  , Minimum(0.)
+  , Maximum(0.)
+  , AxisCount(0)
+{
+}
+
+
+QtRegionGrowing::QtRegionGrowing(QObject* parent)
+  : Superclass(parent)
+  , Running(false)
+  , Canceled(0)
+{
+}
+
+
+QtRegionGrowing::~QtRegionGrowing()
+{
+  this->cancel();
+}
+
+
+bool QtRegionGrowing::grow(const ImageType* image, const IndexType& seed,
+                           double minimum, double maximum,
+                           const int* axes, int axisCount, Region& region,
+                           const QAtomicInt* canceled)
+{
+  region = Region();
+  Fill fill;
+  if (!startFill(image, seed, minimum, maximum, axes, axisCount, fill))
+    {
+    return false;
+    }
+  while (!fillSpans(fill, 1024))
+    {
+    if (canceled && *canceled)
+      {
+      return false;
+      }
+    }
+  region = fill.Grown;
+  return true;
+}
+
+
+bool QtRegionGrowing::startFill(const ImageType* image,
+                                const IndexType& seed,
+                                double minimum, double maximum,
+                                const int* axes, int axisCount, Fill& fill)
+{
+  fill = Fill();
+  const ImageType::SizeType size = image->GetLargestPossibleRegion().GetSize();
+  fill.Image = image;
+  fill.Minimum = minimum;
+  fill.Maximum = maximum;
+  fill.AxisCount = axisCount;
+  fill.Grown.Stride = image->GetOffsetTable()[axes[0]];
+
+  // The filled voxels are marked in a bit array over the axes only.
+  qint64 maskSize = 1;
+  for (int i = 0; i < axisCount; ++i)
+    {
+    fill.Axes[i] = axes[i];
+    fill.MaskStrides[i] = maskSize;
+    maskSize *= size[axes[i]];
+    }
+  if (maskSize > std::numeric_limits<int>::max())
+    {
+    return false;
+    }
+  fill.Filled = QBitArray(static_cast<int>(maskSize));
+  fill.Seeds.append(seed);
+  return true;
+}
+
+
+bool QtRegionGrowing::fillSpans(Fill& fill, int maxSpans)
+{
+  const ImageType* image = fill.Image;
+  const ImageType::SizeType size = image->GetLargestPossibleRegion().GetSize();
+  const OffsetType* offsetTable = image->GetOffsetTable();
+  const double* buffer = image->GetBufferPointer();
+  const double minimum = fill.Minimum;
+  const double maximum = fill.Maximum;
+  const int* axes = fill.Axes;
+  const int axisCount = fill.AxisCount;
+  const qint64* maskStrides = fill.MaskStrides;
+  const int spanAxis = axes[0];
+  const OffsetType stride = offsetTable[spanAxis];
+  const int spanSize = size[spanAxis];
+  QBitArray& filled = fill.Filled;
+  QVector<IndexType>& seeds = fill.Seeds;
+  Region& region = fill.Grown;
+
+  for (int spanCount = 0; !seeds.isEmpty(); ++spanCount)
+    {
+    if (spanCount == maxSpans)
+      {
+      return false;
+      }
+    IndexType index = seeds.last();
+    seeds.pop_back();
+    qint64 mask = 0;
+    OffsetType offset = 0;
+    for (int i = 0; i < axisCount; ++i)
+      {
+      mask += index[axes[i]] * maskStrides[i];
+      }
+    for (int i = 0; i < 3; ++i)
+      {
+      offset += index[i] * offsetTable[i];
+      }
+    const int x = index[spanAxis];
+    if (filled.testBit(mask) ||
+        buffer[offset] < minimum || buffer[offset] > maximum)
+      {
+      continue;
+      }
+
+    // Extend the span both ways along the first axis.
+    int begin = x;
+    while (begin > 0 && !filled.testBit(mask - (x - begin + 1)))
+      {
+      const double value = buffer[offset - (x - begin + 1) * stride];
+      if (value < minimum || value > maximum)
+        {
+        break;
+        }
+      --begin;
+      }
+    int end = x + 1;
+    while (end < spanSize && !filled.testBit(mask + (end - x)))
+      {
+      const double value = buffer[offset + (end - x) * stride];
+      if (value < minimum || value > maximum)
+        {
+        break;
+        }
+      ++end;
+      }
+    filled.fill(true, mask - (x - begin), mask + (end - x));
+    Span span;
+    span.Offset = offset - (x - begin) * stride;
+    span.Length = end - begin;
+    region.Spans.append(span);
+    for (int i = 0; i < 3; ++i)
+      {
+      const itk::IndexValueType first = i == spanAxis ? begin : index[i];
+      const itk::IndexValueType last = i == spanAxis ? end - 1 : index[i];
+      const bool empty = region.Spans.size() == 1;
+      region.First[i] = empty ? first : qMin(region.First[i], first);
+      region.Last[i] = empty ? last : qMax(region.Last[i], last);
+      }
+
+    // Queue a seed per run of voxels to fill in the neighboring rows.
+    for (int i = 1; i < axisCount; ++i)
+      {
+      const int axis = axes[i];
+      for (int step = -1; step <= 1; step += 2)
+        {
+        IndexType neighbor = index;
+        neighbor[axis] += step;
+        if (neighbor[axis] < 0 ||
+            neighbor[axis] >= static_cast<itk::IndexValueType>(size[axis]))
+          {
+          continue;
+          }
+        const qint64 neighborMask =
+          mask + step * maskStrides[i] - (x - begin);
+        const double* neighborVoxel =
+          buffer + offset + step * offsetTable[axis] - (x - begin) * stride;
+        bool inRun = false;
+        for (int n = begin; n < end; ++n, neighborVoxel += stride)
+          {
+          const bool fill = !filled.testBit(neighborMask + (n - begin)) &&
+            *neighborVoxel >= minimum && *neighborVoxel <= maximum;
+          if (fill && !inRun)
+            {
+            neighbor[spanAxis] = n;
+            seeds.append(neighbor);
+            }
+          inRun = fill;
+          }
+        }
+      }
+    }
+  return true;
+}
+
+
+bool QtRegionGrowing::start(const ImageType* image, const IndexType& seed,
+                            double minimum, double maximum)
+{
+  this->cancel();
+  QMutexLocker locker(&this->Mutex);
+  this->Image = image;
+  this->GrownRegion = Region();
+  this->Canceled = 0;
+  const int axes[3] = {0, 1, 2};
+  if (!startFill(image, seed, minimum, maximum, axes, 3, this->CurrentFill))
+    {
+    this->Image = 0;
+    return false;
+    }
+  this->Running = true;
+  QtTaskScheduler::instance()->submit(new QtRegionGrowingTask(this));
+  return true;
+}
+
+
+void QtRegionGrowing::cancel()
+{
+  QMutexLocker locker(&this->Mutex);
+  this->Canceled = 1;
+  while (this->Running)
+    {
+    this->IdleCondition.wait(&this->Mutex);
+    }
+}
+
+
+bool QtRegionGrowing::isRunning() const
+{
+  QMutexLocker locker(&this->Mutex);
+  return this->Running;
+}
+
+
+const QtRegionGrowing::Region& QtRegionGrowing::region() const
+{
+  return this->GrownRegion;
+}
+
+
+bool QtRegionGrowing::run(int maxSpans)
+{
+  const bool canceled = this->Canceled;
+  if (!canceled && !fillSpans(this->CurrentFill, maxSpans))
+    {
+    return false;
+    }
+  {
+  QMutexLocker locker(&this->Mutex);
+  this->GrownRegion = canceled ? Region() : this->CurrentFill.Grown;
+  this->CurrentFill = Fill();
+  this->Image = 0;
+  this->Running = false;
+  this->IdleCondition.wakeAll();
+  }
+  if (!canceled)
+    {
+    emit regionGrown();
+    }
+  return true;
+}
@@ -0,0 +1,157 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+#ifndef __QtRegionGrowing_h
+#define __QtRegionGrowing_h
+
+// Qt includes
+#include <QAtomicInt>
+#include <QBitArray>
+#include <QMutex>
+#include <QObject>
+#include <QVector>
+#include <QWaitCondition>
+
+// ITK includes
+#include <itkImage.h>
+
+// ImageViewer includes
+#include "QtImageViewer_Export.h"
+
+/// Seeded region growing: the voxels connected to a seed whose intensity
+/// is within [Minimum, Maximum].
+/// The region is filled span by span: a span is extended along the first
+/// axis, then scanned on the neighboring rows for the spans to fill next.
+/// A bit per voxel marks the filled voxels, so that each voxel is filled
+/// at most once.
+/// grow() fills the region on the calling thread, e.g. in a slice for a
+/// preview; start() fills it in the volume on the QtTaskScheduler and
+/// emits regionGrown() when it is done. The background fill is done by
+/// batches of spans, and gives way to more urgent tasks between them.
+class QtImageViewer_EXPORT QtRegionGrowing : public QObject
+{
+  Q_OBJECT
+public:
+  typedef QObject                     Superclass;
+  typedef itk::Image<double, 3>       ImageType;
+  typedef ImageType::IndexType        IndexType;
+  typedef itk::OffsetValueType        OffsetType;
+
+  /// Voxels Offset, Offset + Stride, ... Offset + (Length-1) * Stride of
+  /// the buffer of the image, Stride being the offset along the first axis.
+  struct Span
+    {
+    OffsetType Offset;
+    int        Length;
+    };
+
+  /// Filled voxels, and their bounding box.
+  struct Region
+    {
+    Region();
+
+    QVector<Span> Spans;
+    OffsetType    Stride;
+    IndexType     First;
+    IndexType     Last;
+    };
+
+  QtRegionGrowing(QObject* parent = 0);
+  /// Cancel the background fill.
+  virtual ~QtRegionGrowing();
+
+  /// Fill the region of seed along the axisCount axes: {0, 1, 2} for the
+  /// volume, the two axes of a slice for the slice of seed. The spans are
+  /// along axes[0]. Return false if canceled, which is polled if not NULL,
+  /// or if the axes hold more than 2^31 voxels.
+  /// The region is empty if the seed is outside the interval.
+  static bool grow(const ImageType* image, const IndexType& seed,
+                   double minimum, double maximum,
+                   const int* axes, int axisCount, Region& region,
+                   const QAtomicInt* canceled = 0);
+
+  /// Fill the region of seed in the volume in the background, canceling
+  /// the fill in progress. regionGrown() is emitted when it is done.
+  /// Return false, and emit nothing, if the volume holds more than 2^31
+  /// voxels.
+  bool start(const ImageType* image, const IndexType& seed,
+             double minimum, double maximum);
+
+  /// Stop the background fill and block until it returns.
+  void cancel();
+
+  /// Return true if a background fill is in progress.
+  bool isRunning() const;
+
+  /// Region filled by the last background fill. Valid after regionGrown()
+  /// has been emitted, until the next start().
+  const Region& region() const;
+
+  /// Fill at most maxSpans more spans of the requested region. Return
+  /// false if it is not done yet. Run by the fill task.
+  bool run(int maxSpans);
+
+signals:
+  /// Emitted from a worker thread when the background fill is done.
+  void regionGrown();
+
+protected:
+  /// Fill in progress: the spans of Grown are filled and marked in
+  /// Filled, and Seeds holds the voxels from which to fill the next ones.
+  struct Fill
+    {
+    Fill();
+
+    const ImageType*   Image;
+    double             Minimum;
+    double             Maximum;
+    int                Axes[3];
+    int                AxisCount;
+    qint64             MaskStrides[3];
+    QBitArray          Filled;
+    QVector<IndexType> Seeds;
+    Region             Grown;
+    };
+
+  /// Start the fill of the region of seed, see grow(). Return false if
+  /// the axes hold more than 2^31 voxels.
+  static bool startFill(const ImageType* image, const IndexType& seed,
+                        double minimum, double maximum,
+                        const int* axes, int axisCount, Fill& fill);
+
+  /// Fill at most maxSpans more spans. Return true if the fill is done.
+  static bool fillSpans(Fill& fill, int maxSpans);
+
+  mutable QMutex          Mutex;
+  QWaitCondition          IdleCondition;
+  bool                    Running;
+  QAtomicInt              Canceled;
+  ImageType::ConstPointer Image;
+  /// Background fill in progress.
+  Fill                    CurrentFill;
+  Region                  GrownRegion;
+
+private:
+  Q_DISABLE_COPY(QtRegionGrowing);
+};
+
+#endif
@@ -23,6 +23,7 @@ limitations under the License.
 
 // Qt includes
 #include <QAbstractSlider>
+#include <QColorDialog>
 #include <QDebug>
 #include <QSpinBox>
 
@@ -72,6 +73,14 @@ void QtSliceControlsWidgetPrivate::setupUi(QWidget* widgetToSetup)
                    q, SLOT(setMaxIntensity(int)));
   QObject::connect(this->IntensityMin, SIGNAL(sliderMoved(int)),
                    q, SLOT(setMinIntensity(int)));
+  QObject::connect(this->LabelNumber, SIGNAL(valueChanged(int)),
+                   q, SLOT(updateLabel()));
+  QObject::connect(this->LabelVisible, SIGNAL(toggled(bool)),
+                   q, SLOT(setLabelVisible(bool)));
+  QObject::connect(this->LabelColor, SIGNAL(clicked()),
+                   q, SLOT(pickLabelColor()));
+  QObject::connect(this->IsolateLabel, SIGNAL(clicked()),
+                   q, SLOT(isolateLabel()));
 }
 
 void QtSliceControlsWidgetPrivate::connectOrDisconnectSlider(bool connect)
@@ -235,6 +244,13 @@ void QtSliceControlsWidget::setSliceView(QtGlSliceView* sliceView)
   // Details
   QObject::connect(d->SliceView, SIGNAL(detailsChanged(QString)),
                    this, SLOT(setText(QString)));
+  // Labels
+  QObject::connect(d->ShowAllLabels, SIGNAL(clicked()),
+                   d->SliceView, SLOT(showAllLabels()));
+  QObject::connect(d->SliceView, SIGNAL(labelsChanged()),
+                   this, SLOT(updateLabel()));
+  QObject::connect(d->SliceView, SIGNAL(currentOverlayLayerChanged(int)),
+                   this, SLOT(updateLabel()));
   // Slider
   QObject::connect(d->SliceView, SIGNAL(orientationChanged(int)),
                    this, SLOT(updateSliceRange()));
@@ -242,6 +258,7 @@ void QtSliceControlsWidget::setSliceView(QtGlSliceView* sliceView)
   d->connectOrDisconnectSpinBox(true);
 
   this->updateImage();
+  this->updateLabel();
 }
 
 
@@ -415,3 +432,44 @@ void QtSliceControlsWidget::setMaxIntensity(int intensity)
   d->IntensityMaxDisplay->setValue(newMaxIntensity);
 }
 
+void QtSliceControlsWidget::updateLabel()
+{
+  Q_D(QtSliceControlsWidget);
+  if (!d->SliceView)
+    {
+    return;
+    }
+  const int label = d->LabelNumber->value();
+  bool blocked = d->LabelVisible->blockSignals(true);
+  d->LabelVisible->setChecked(d->SliceView->isLabelVisible(label));
+  d->LabelVisible->blockSignals(blocked);
+  const QColor color = d->SliceView->labelColor(label);
+  d->LabelColor->setStyleSheet(color.isValid() ?
+    QString("background-color: %1").arg(color.name()) : QString());
+}
+
+
+void QtSliceControlsWidget::setLabelVisible(bool visible)
+{
+  Q_D(QtSliceControlsWidget);
+  d->SliceView->setLabelVisible(d->LabelNumber->value(), visible);
+}
+
+
+void QtSliceControlsWidget::pickLabelColor()
+{
+  Q_D(QtSliceControlsWidget);
+  const int label = d->LabelNumber->value();
+  QColor color = QColorDialog::getColor(d->SliceView->labelColor(label), this);
+  if (color.isValid())
+    {
+    d->SliceView->setLabelColor(label, color);
+    }
+}
+
+
+void QtSliceControlsWidget::isolateLabel()
+{
+  Q_D(QtSliceControlsWidget);
+  d->SliceView->isolateLabel(d->LabelNumber->value());
+}
@@ -93,6 +93,18 @@ protected slots:
   //// \sa setMaxIntensity(), updateMinIntensity()
   void updateMaxIntensity(double value);
 
+  /// Update the label widgets from the selected label.
+  void updateLabel();
+
+  /// Show or hide the selected label.
+  void setLabelVisible(bool visible);
+
+  /// Pick a new color for the selected label.
+  void pickLabelColor();
+
+  /// Hide all the labels but the selected one.
+  void isolateLabel();
+
 protected:
   QScopedPointer<QtSliceControlsWidgetPrivate> d_ptr;
 
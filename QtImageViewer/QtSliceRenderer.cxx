@@ -0,0 +1,1060 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+
+//QtImageViewer includes
+#include "QtOverlayLayer.h"
+#include "QtSliceRenderer.h"
+#include "QtTaskScheduler.h"
+
+// Qt includes
+#include <QMutexLocker>
+#include <QVarLengthArray>
+
+//std includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+QtSliceOverlayState::QtSliceOverlayState()
+  : Opacity(0)
+  , Empty(true)
+{
+  for (unsigned int i = 0; i < 4; ++i)
+    {
+    Bounds[i] = 0;
+    }
+}
+
+
+QtSliceRenderState::QtSliceRenderState()
+  : ValidOverlayData(false)
+  , OverlayEmpty(true)
+  , OverlayMode(OVERLAY_FILLED)
+  , ImageMode(IMG_VAL)
+  , IWModeMin(IW_MIN)
+  , IWModeMax(IW_MAX)
+  , IWMin(0.0)
+  , IWMax(0.0)
+  , ShaderWindow(false)
+  , ValueOffset(0.0)
+  , ValueScale(1.0)
+  , ImageMTime(0)
+  , WinMinX(0)
+  , WinMaxX(0)
+  , WinMinY(0)
+  , WinMaxY(0)
+  , WinDataSizeX(0)
+  , WinDataSizeY(0)
+  , Generation(0)
+{
+  for (unsigned int i = 0; i < 3; ++i)
+    {
+    DimSize[i] = 0;
+    WinOrder[i] = i;
+    WinCenter[i] = 0;
+    }
+  for (unsigned int i = 0; i < 4; ++i)
+    {
+    OverlayBounds[i] = 0;
+    }
+}
+
+
+/// Task rendering the pending frames of a QtSliceRenderer.
+class QtSliceRenderTask : public QtTask
+{
+public:
+  QtSliceRenderTask(QtSliceRenderer* renderer)
+    : QtTask(QtTask::VisibleFrame)
+    , Renderer(renderer)
+    {
+    }
+  virtual bool run()
+    {
+    this->Renderer->renderPendingFrames();
+    return true;
+    }
+protected:
+  QtSliceRenderer* Renderer;
+};
+
+
+/// Overlay layer as read by QtSliceRenderer::composeRows().
+struct QtSliceComposeLayer
+{
+  const unsigned int* Values;
+  /// NULL for color overlays.
+  const unsigned int* LUT;
+  unsigned int        LUTSize;
+  unsigned char       Opacity;
+};
+
+
+/// Return value if it differs from one of its neighbors, 0 otherwise.
+/// Branchless so that the loops over the rows can be vectorized.
+static inline unsigned int outlinePixel(unsigned int value,
+                                        unsigned int left,
+                                        unsigned int right,
+                                        unsigned int up,
+                                        unsigned int down)
+{
+  const unsigned int boundary = (value != left) | (value != right) |
+    (value != up) | (value != down);
+  return value & (0u - boundary);
+}
+
+
+/// Return x / 255 rounded, for x in [0, 255 * 255].
+static inline unsigned int div255(unsigned int x)
+{
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+
+/// Return the packed RGBA8 color premultiplied by its alpha, itself scaled
+/// by opacity.
+static inline unsigned int premultiply(unsigned int rgba,
+                                       unsigned char opacity)
+{
+  unsigned char bytes[4];
+  memcpy(bytes, &rgba, 4);
+  const unsigned int alpha = div255(bytes[3] * opacity);
+  for (int c = 0; c < 3; ++c)
+    {
+    bytes[c] = (unsigned char)div255(bytes[c] * alpha);
+    }
+  bytes[3] = (unsigned char)alpha;
+  memcpy(&rgba, bytes, 4);
+  return rgba;
+}
+
+
+/// Return the premultiplied RGBA8 color of top drawn over bottom.
+static inline unsigned int blendOver(unsigned int top, unsigned int bottom)
+{
+  unsigned char t[4];
+  memcpy(t, &top, 4);
+  if (bottom == 0 || t[3] == 255)
+    {
+    return top;
+    }
+  unsigned char b[4];
+  memcpy(b, &bottom, 4);
+  const unsigned int transparency = 255 - t[3];
+  for (int c = 0; c < 4; ++c)
+    {
+    t[c] = (unsigned char)(t[c] + div255(b[c] * transparency));
+    }
+  unsigned int color;
+  memcpy(&color, t, 4);
+  return color;
+}
+
+
+/// Return the gray level of value, the intensity or the difference of
+/// intensities of the derivative modes, in the intensity window of state.
+static inline unsigned char windowValue(const QtSliceRenderState& state,
+                                        double value)
+{
+  const double iwMin = state.IWMin;
+  const double iwMax = state.IWMax;
+  double tf;
+  switch(state.ImageMode)
+    {
+    default:
+      tf = (value-iwMin)/(iwMax-iwMin)*255;
+      break;
+    case IMG_INV:
+      tf = (iwMax-value)/(iwMax-iwMin)*255;
+      break;
+    case IMG_LOG:
+      tf = log(value-iwMin+0.00000001)/log(iwMax-iwMin+0.00000001)*255;
+      break;
+    case IMG_DX:
+    case IMG_DY:
+    case IMG_DZ:
+      tf = value/(iwMax-iwMin)*255+128;
+      break;
+    }
+
+  if(tf > 255)
+    {
+    switch(state.IWModeMax)
+      {
+      case IW_MIN:
+        tf = 0;
+        break;
+      default:
+      case IW_MAX:
+        tf = 255;
+        break;
+      case IW_FLIP:
+        tf = 512-tf;
+        if(tf<0)
+          {
+          tf = 0;
+          }
+        break;
+      }
+    }
+  else
+    {
+    if(tf < 0)
+      {
+      switch(state.IWModeMin)
+        {
+        default:
+        case IW_MIN:
+          tf = 0;
+          break;
+        case IW_MAX:
+          tf = 255;
+          break;
+        case IW_FLIP:
+          tf = -tf;
+          if(tf>255)
+            {
+            tf = 255;
+            }
+          break;
+        }
+      }
+    }
+  return (unsigned char)tf;
+}
+
+
+/// Write count opaque pixels of the frame from the gray levels of the
+/// slice and the premultiplied overlay colors, NULL if there are none.
+static void composeFramePixels(const unsigned char* gray,
+                               const unsigned int* overlay,
+                               unsigned int* frame, int count)
+{
+  int x = 0;
+#ifdef __SSE2__
+  // 4 pixels at a time. SSE2 implies a little endian CPU: the alpha is the
+  // high byte of the packed colors.
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i opaque = _mm_set1_epi32(static_cast<int>(0xFF000000));
+  const __m128i full = _mm_set1_epi16(255);
+  const __m128i half = _mm_set1_epi16(128);
+  for (; x + 4 <= count; x += 4)
+    {
+    int grays;
+    memcpy(&grays, gray + x, 4);
+    __m128i pixels = _mm_cvtsi32_si128(grays);
+    pixels = _mm_unpacklo_epi8(pixels, pixels);
+    pixels = _mm_unpacklo_epi16(pixels, pixels);
+    pixels = _mm_or_si128(pixels, opaque);
+    if (overlay)
+      {
+      const __m128i colors =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(overlay + x));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi32(colors, zero)) != 0xFFFF)
+        {
+        // pixel = color + pixel * (255 - alpha) / 255, on 16-bit lanes.
+        __m128i halves[2];
+        for (int h = 0; h < 2; ++h)
+          {
+          const __m128i c = h ? _mm_unpackhi_epi8(colors, zero)
+                              : _mm_unpacklo_epi8(colors, zero);
+          const __m128i p = h ? _mm_unpackhi_epi8(pixels, zero)
+                              : _mm_unpacklo_epi8(pixels, zero);
+          __m128i alpha = _mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 3, 3));
+          alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+          __m128i t = _mm_mullo_epi16(p, _mm_sub_epi16(full, alpha));
+          t = _mm_add_epi16(t, half);
+          t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+          halves[h] = _mm_add_epi16(c, t);
+          }
+        pixels = _mm_packus_epi16(halves[0], halves[1]);
+        }
+      }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(frame + x), pixels);
+    }
+#endif
+  for (; x < count; ++x)
+    {
+    unsigned char rgba[4] = {gray[x], gray[x], gray[x], 255};
+    const unsigned int color = overlay ? overlay[x] : 0;
+    if (color != 0)
+      {
+      unsigned char c[4];
+      memcpy(c, &color, 4);
+      const unsigned int transparency = 255 - c[3];
+      for (int i = 0; i < 3; ++i)
+        {
+        rgba[i] = (unsigned char)(c[i] + div255(gray[x] * transparency));
+        }
+      }
+    memcpy(frame + x, rgba, 4);
+    }
+}
+
+
+/// Functor calling a rows method of a QtSliceRenderer, e.g.
+/// QtSliceRenderer::composeRows(), on the rows of a range of bands of the
+/// window, for QtTaskScheduler::parallelFor().
+class QtSliceBandsFunctor
+{
+public:
+  typedef void (QtSliceRenderer::*RowsMethod)(const QtSliceRenderState&,
+                                              int, int);
+
+  QtSliceBandsFunctor(QtSliceRenderer* renderer, RowsMethod method,
+                      const QtSliceRenderState& state,
+                      int origin, int begin, int end)
+    : Renderer(renderer)
+    , Method(method)
+    , State(state)
+    , Origin(origin)
+    , Begin(begin)
+    , End(end)
+    {
+    }
+  void operator()(int beginBand, int endBand)
+    {
+    const int beginRow = this->Origin + beginBand*QtSliceRenderer::BandHeight;
+    const int endRow = this->Origin + endBand*QtSliceRenderer::BandHeight;
+    (this->Renderer->*this->Method)(this->State,
+                                    qMax(beginRow, this->Begin),
+                                    qMin(endRow, this->End));
+    }
+protected:
+  QtSliceRenderer* Renderer;
+  RowsMethod Method;
+  const QtSliceRenderState& State;
+  int Origin;
+  int Begin;
+  int End;
+};
+
+
+/// Call method of renderer on the rows [begin, end) of the window in
+/// parallel, in whole bands of QtSliceRenderer::BandHeight rows counted
+/// from origin, the row of the first row of the window.
+static void parallelForBands(QtSliceRenderer* renderer,
+                             QtSliceBandsFunctor::RowsMethod method,
+                             const QtSliceRenderState& state,
+                             int origin, int begin, int end)
+{
+  if(end <= begin)
+    {
+    return;
+    }
+  QtSliceBandsFunctor bands(renderer, method, state, origin, begin, end);
+  QtTaskScheduler::instance()->parallelFor(
+    (begin - origin) / QtSliceRenderer::BandHeight,
+    (end - 1 - origin) / QtSliceRenderer::BandHeight + 1, 1,
+    QtTask::VisibleFrame, bands);
+}
+
+
+const int QtSliceRenderer::BandHeight;
+
+
+QtSliceRenderer::QtSliceRenderer(QtGlSliceView* view)
+  : View(view)
+  , HasPendingState(false)
+  , Busy(false)
+  , Generation(0)
+  , DroppedFrames(0)
+  , FrameValid(false)
+  , ResliceImage(true)
+  , OverlaySliceCached(false)
+{
+}
+
+
+QtSliceRenderer::~QtSliceRenderer()
+{
+  this->cancel();
+}
+
+
+void QtSliceRenderer::requestRender(const QtSliceRenderState& state)
+{
+  QMutexLocker locker(&this->Mutex);
+  if (this->HasPendingState)
+    {
+    ++this->DroppedFrames;
+    }
+  // The frame in progress is completed: aborting it on every request would
+  // display nothing as long as the requests come faster than the frames.
+  this->PendingState = state;
+  this->PendingState.Generation = this->Generation;
+  this->HasPendingState = true;
+  if (!this->Busy)
+    {
+    this->Busy = true;
+    QtTaskScheduler::instance()->submit(new QtSliceRenderTask(this));
+    }
+}
+
+
+void QtSliceRenderer::cancel()
+{
+  QMutexLocker locker(&this->Mutex);
+  this->HasPendingState = false;
+  this->Generation.ref();
+  while (this->Busy)
+    {
+    this->IdleCondition.wait(&this->Mutex);
+    }
+  // The buffers and the overlay layers may be replaced.
+  this->FrameValid = false;
+  this->FrameState = QtSliceRenderState();
+  this->OverlaySliceCached = false;
+  this->OverlaySliceState = QtSliceRenderState();
+  this->OverlaySlices.clear();
+}
+
+
+void QtSliceRenderer::wait()
+{
+  QMutexLocker locker(&this->Mutex);
+  while (this->Busy)
+    {
+    this->IdleCondition.wait(&this->Mutex);
+    }
+}
+
+
+bool QtSliceRenderer::isBusy() const
+{
+  QMutexLocker locker(&this->Mutex);
+  return this->Busy || this->HasPendingState;
+}
+
+
+int QtSliceRenderer::droppedFrames() const
+{
+  QMutexLocker locker(&this->Mutex);
+  return this->DroppedFrames;
+}
+
+
+void QtSliceRenderer::resetDroppedFrames()
+{
+  QMutexLocker locker(&this->Mutex);
+  this->DroppedFrames = 0;
+}
+
+
+bool QtSliceRenderer::isCanceled(const QtSliceRenderState& state) const
+{
+  return state.Generation != this->Generation;
+}
+
+
+void QtSliceRenderer::renderPendingFrames()
+{
+  forever
+    {
+    QtSliceRenderState state;
+    {
+    QMutexLocker locker(&this->Mutex);
+    if (!this->HasPendingState)
+      {
+      this->Busy = false;
+      this->IdleCondition.wakeAll();
+      locker.unlock();
+      emit idle();
+      return;
+      }
+    state = this->PendingState;
+    this->PendingState = QtSliceRenderState();
+    this->HasPendingState = false;
+    }
+
+    if (this->reslice(state))
+      {
+      this->View->swapWinData(state);
+      this->FrameState = state;
+      this->FrameValid = true;
+      emit sliceRendered();
+      }
+    else if (this->isCanceled(state))
+      {
+      // Aborted by cancel().
+      QMutexLocker locker(&this->Mutex);
+      ++this->DroppedFrames;
+      }
+    }
+}
+
+
+bool QtSliceRenderer::reslice(const QtSliceRenderState& state)
+{
+  if (state.Image.IsNull())
+    {
+    return false;
+    }
+  const bool drawOverlay = state.ValidOverlayData && !state.OverlayEmpty;
+  unsigned char* winImData = this->View->cWinImBackData;
+  unsigned char* winOverlayData = this->View->cWinOverlayBackData;
+
+  const int winDataSize = state.WinDataSizeX*state.WinDataSizeY;
+  // If only the overlay changed, copy the gray levels from the front
+  // buffers, which only the renderer swaps.
+  this->ResliceImage = !this->isImageSliceCached(state);
+  float* winValueData = this->View->cWinValueBackData;
+  if(this->ResliceImage && state.ShaderWindow)
+    {
+    memset(winValueData, 0, winDataSize*sizeof(float));
+    }
+  else if(this->ResliceImage)
+    {
+    memset(winImData, 0, winDataSize);
+    }
+  else if(state.ShaderWindow)
+    {
+    memcpy(winValueData, this->View->cWinValueData,
+           winDataSize*sizeof(float));
+    }
+  else
+    {
+    memcpy(winImData, this->View->cWinImData, winDataSize);
+    memcpy(this->View->cWinZBackBuffer, this->View->cWinZBuffer,
+           winDataSize*sizeof(unsigned short));
+    }
+  this->OverlayTargets.clear();
+  if(drawOverlay)
+    {
+    memset(winOverlayData, 0, winDataSize*4);
+    this->prepareOverlaySlices(state);
+    }
+
+  int startK = state.WinMinY;
+  if(startK<0)
+    startK = 0;
+  bool sample = false;
+  for(int i=0; i<this->OverlayTargets.size(); i++)
+    {
+    sample = sample || this->OverlayTargets[i];
+    }
+  if(this->ResliceImage || sample)
+    {
+    parallelForBands(this, &QtSliceRenderer::resliceRows, state,
+                     state.WinMinY, startK, state.WinMaxY + 1);
+    }
+  if(this->isCanceled(state))
+    {
+    return false;
+    }
+  if(drawOverlay)
+    {
+    this->OverlaySliceState = state;
+    this->OverlaySliceCached = true;
+    parallelForBands(this, &QtSliceRenderer::composeRows, state,
+                     state.WinMinY, qMax(startK, state.OverlayBounds[2]),
+                     qMin(state.WinMaxY, state.OverlayBounds[3]) + 1);
+    }
+  // The fragment shader of the view composites the values instead.
+  if(!state.ShaderWindow)
+    {
+    parallelForBands(this, &QtSliceRenderer::composeFrameRows, state,
+                     0, 0, state.WinDataSizeY);
+    }
+  return !this->isCanceled(state);
+}
+
+
+void QtSliceRenderer::prepareOverlaySlices(const QtSliceRenderState& state)
+{
+  // Reuse the slices of the layers sampled for a previous frame.
+  const int overlayCount = state.Overlays.size();
+  const bool cached = this->isOverlaySliceCached(state);
+  QVector<OverlaySlice> slices(overlayCount);
+  for(int i=0; i<overlayCount; i++)
+    {
+    slices[i].Layer = state.Overlays[i].Layer;
+    for(int c=0; cached && c<this->OverlaySlices.size(); c++)
+      {
+      if(this->OverlaySlices[c].Layer == slices[i].Layer)
+        {
+        slices[i].Values = this->OverlaySlices[c].Values;
+        break;
+        }
+      }
+    }
+  this->OverlaySliceCached = false;
+  this->OverlaySlices = slices;
+  slices.clear();
+  this->OverlayTargets.fill(0, overlayCount);
+  const int winDataSize = state.WinDataSizeX*state.WinDataSizeY;
+  for(int i=0; i<overlayCount; i++)
+    {
+    if(!state.Overlays[i].Empty && this->OverlaySlices[i].Values.isEmpty())
+      {
+      this->OverlaySlices[i].Values.fill(0, winDataSize);
+      // Detach here rather than from the workers.
+      this->OverlayTargets[i] = this->OverlaySlices[i].Values.data();
+      }
+    }
+}
+
+
+/// Return true if both states show the same slice through the same window.
+static bool isSameSlice(const QtSliceRenderState& state,
+                        const QtSliceRenderState& other)
+{
+  if(state.WinMinX != other.WinMinX || state.WinMaxX != other.WinMaxX ||
+     state.WinMinY != other.WinMinY || state.WinMaxY != other.WinMaxY ||
+     state.WinDataSizeX != other.WinDataSizeX ||
+     state.WinDataSizeY != other.WinDataSizeY)
+    {
+    return false;
+    }
+  for(int i=0; i<3; i++)
+    {
+    if(state.WinOrder[i] != other.WinOrder[i] ||
+       state.DimSize[i] != other.DimSize[i])
+      {
+      return false;
+      }
+    }
+  const int sliceAxis = state.WinOrder[2];
+  return state.WinCenter[sliceAxis] == other.WinCenter[sliceAxis];
+}
+
+
+bool QtSliceRenderer::isOverlaySliceCached(
+  const QtSliceRenderState& state) const
+{
+  const QtSliceRenderState& cached = this->OverlaySliceState;
+  return this->OverlaySliceCached &&
+    state.ImageMode != IMG_MIP && cached.ImageMode != IMG_MIP &&
+    isSameSlice(state, cached);
+}
+
+
+bool QtSliceRenderer::isImageSliceCached(
+  const QtSliceRenderState& state) const
+{
+  const QtSliceRenderState& frame = this->FrameState;
+  if(!this->FrameValid || state.ShaderWindow != frame.ShaderWindow ||
+     state.Image != frame.Image || state.ImageMTime != frame.ImageMTime ||
+     !isSameSlice(state, frame))
+    {
+    return false;
+    }
+  // The values do not depend on the intensity window, and are the
+  // intensities in the value, inverse and log modes.
+  if(state.ShaderWindow)
+    {
+    return (state.ImageMode == frame.ImageMode ||
+            (state.ImageMode <= IMG_LOG && frame.ImageMode <= IMG_LOG)) &&
+      state.ValueOffset == frame.ValueOffset &&
+      state.ValueScale == frame.ValueScale;
+    }
+  return state.ImageMode == frame.ImageMode &&
+    state.IWModeMin == frame.IWModeMin &&
+    state.IWModeMax == frame.IWModeMax &&
+    state.IWMin == frame.IWMin && state.IWMax == frame.IWMax;
+}
+
+
+bool QtSliceRenderer::renderOverlayBox(const QtSliceRenderState& state,
+                                       const QtOverlayLayer* layer,
+                                       int minJ, int maxJ,
+                                       int minK, int maxK)
+{
+  this->wait();
+  if(state.Image.IsNull() || !state.ValidOverlayData ||
+     !this->isImageSliceCached(state) || !this->isOverlaySliceCached(state) ||
+     state.Overlays.size() != this->OverlaySlices.size())
+    {
+    return false;
+    }
+  int painted = -1;
+  for(int i=0; i<state.Overlays.size(); i++)
+    {
+    const OverlaySlice& slice = this->OverlaySlices[i];
+    if(slice.Layer != state.Overlays[i].Layer)
+      {
+      return false;
+      }
+    if(slice.Layer.data() == layer)
+      {
+      painted = i;
+      }
+    else if(!state.Overlays[i].Empty && slice.Values.isEmpty())
+      {
+      return false;
+      }
+    }
+  const int sizeX = state.WinDataSizeX;
+  const int sizeY = state.WinDataSizeY;
+  minJ = qMax(minJ, qMax(state.WinMinX, 0));
+  maxJ = qMin(maxJ, qMin(state.WinMaxX, state.WinMinX + sizeX - 1));
+  minK = qMax(minK, qMax(state.WinMinY, 0));
+  maxK = qMin(maxK, qMin(state.WinMaxY, state.WinMinY + sizeY - 1));
+  if(painted < 0 || minJ > maxJ || minK > maxK)
+    {
+    // Hidden layer or box out of the window.
+    return true;
+    }
+
+  // Resample the box of the painted layer in its cached slice.
+  const int beginX = minJ - state.WinMinX;
+  const int endX = maxJ - state.WinMinX + 1;
+  const int beginY = minK - state.WinMinY;
+  const int endY = maxK - state.WinMinY + 1;
+  QVector<unsigned int>& values = this->OverlaySlices[painted].Values;
+  if(values.isEmpty())
+    {
+    values.fill(0, sizeX*sizeY);
+    }
+  unsigned int* target = values.data();
+  QtOverlayLayer::IndexType ind;
+  ind[state.WinOrder[0]] = minJ;
+  ind[state.WinOrder[2]] = state.WinCenter[state.WinOrder[2]];
+  for(int y=beginY; y < endY; y++)
+    {
+    unsigned int* row = target + y*sizeX + beginX;
+    std::fill(row, row + (endX - beginX), 0u);
+    ind[state.WinOrder[1]] = y + state.WinMinY;
+    layer->sampleRow(ind, state.WinOrder[0], endX - beginX, NULL, 0, row);
+    }
+
+  // Recomposite the box, grown by the pixels whose outline may change,
+  // into the front buffers.
+  const int composeBeginX = qMax(beginX - 1, 0);
+  const int composeEndX = qMin(endX + 1, sizeX);
+  const int composeBeginY = qMax(beginY - 1, 0);
+  const int composeEndY = qMin(endY + 1, sizeY);
+  QMutexLocker locker(&this->View->cWinDataMutex);
+  unsigned int* winOverlayPixels =
+    reinterpret_cast<unsigned int*>(this->View->cWinOverlayData);
+  unsigned int* winFramePixels =
+    reinterpret_cast<unsigned int*>(this->View->cWinFrameData);
+  this->composeBox(state, composeBeginX, composeEndX,
+                   composeBeginY, composeEndY, winOverlayPixels);
+  // The fragment shader of the view composites the values instead.
+  for(int y=composeBeginY; !state.ShaderWindow && y < composeEndY; y++)
+    {
+    const int offset = y*sizeX + composeBeginX;
+    composeFramePixels(this->View->cWinImData + offset,
+                       winOverlayPixels + offset, winFramePixels + offset,
+                       composeEndX - composeBeginX);
+    }
+  this->View->cWinFrameDirty |= QRect(composeBeginX, composeBeginY,
+                                      composeEndX - composeBeginX,
+                                      composeEndY - composeBeginY);
+  return true;
+}
+
+
+void QtSliceRenderer::composeRows(const QtSliceRenderState& state,
+                                  int beginK, int endK)
+{
+  // Columns of the labeled box.
+  const int sizeX = state.WinDataSizeX;
+  const int beginX = qMax(state.OverlayBounds[0] - state.WinMinX, 0);
+  const int endX = qMin(state.OverlayBounds[1] - state.WinMinX, sizeX - 1);
+  this->composeBox(state, beginX, endX + 1,
+                   qMax(beginK - state.WinMinY, 0),
+                   qMin(endK - state.WinMinY, state.WinDataSizeY),
+                   reinterpret_cast<unsigned int*>(
+                     this->View->cWinOverlayBackData));
+}
+
+
+void QtSliceRenderer::composeBox(const QtSliceRenderState& state,
+                                 int beginX, int endX, int beginY, int endY,
+                                 unsigned int* winOverlayPixels) const
+{
+  const int sizeX = state.WinDataSizeX;
+  const int sizeY = state.WinDataSizeY;
+  const bool outline = state.OverlayMode == OVERLAY_OUTLINE;
+
+  // Layers with visible voxels in the frame.
+  QVarLengthArray<QtSliceComposeLayer, 8> layers;
+  for(int i=0; i<state.Overlays.size(); i++)
+    {
+    const QtSliceOverlayState& overlay = state.Overlays[i];
+    if(overlay.Empty)
+      {
+      continue;
+      }
+    QtSliceComposeLayer layer;
+    layer.Values = this->OverlaySlices[i].Values.constData();
+    layer.LUT = overlay.LUT.isEmpty() ? NULL : overlay.LUT.constData();
+    layer.LUTSize = overlay.LUT.size();
+    layer.Opacity = overlay.Opacity;
+    layers.append(layer);
+    }
+  const int layerCount = layers.size();
+
+  // The window edges are not boundaries.
+  for(int y=beginY; y < endY; y++)
+    {
+    const int up = y > 0 ? -sizeX : 0;
+    const int down = y < sizeY - 1 ? sizeX : 0;
+    unsigned int* out = winOverlayPixels + y*sizeX;
+    for(int x = beginX; x < endX; ++x)
+      {
+      const int left = x > 0 ? -1 : 0;
+      const int right = x < sizeX - 1 ? 1 : 0;
+      const int offset = y*sizeX + x;
+      unsigned int color = 0;
+      for(int i=0; i<layerCount; i++)
+        {
+        const unsigned int* values = layers[i].Values + offset;
+        unsigned int value = values[0];
+        if(outline)
+          {
+          value = outlinePixel(value, values[left], values[right],
+                               values[up], values[down]);
+          }
+        if(value == 0)
+          {
+          continue;
+          }
+        if(layers[i].LUT)
+          {
+          value = value < layers[i].LUTSize ? layers[i].LUT[value] : 0;
+          }
+        else
+          {
+          value = premultiply(value, layers[i].Opacity);
+          }
+        if(value != 0)
+          {
+          color = blendOver(value, color);
+          }
+        }
+      out[x] = color;
+      }
+    }
+}
+
+
+void QtSliceRenderer::composeFrameRows(const QtSliceRenderState& state,
+                                       int beginY, int endY)
+{
+  const int sizeX = state.WinDataSizeX;
+  const unsigned char* winImData = this->View->cWinImBackData;
+  const unsigned int* winOverlayPixels = reinterpret_cast<unsigned int*>(
+    this->View->cWinOverlayBackData);
+  unsigned int* winFramePixels =
+    reinterpret_cast<unsigned int*>(this->View->cWinFrameBackData);
+  // Only the labeled box of the overlay is blended.
+  const bool drawOverlay = state.ValidOverlayData && !state.OverlayEmpty;
+  const int beginX = qBound(0, state.OverlayBounds[0] - state.WinMinX,
+                            sizeX);
+  const int endX = qBound(beginX, state.OverlayBounds[1] - state.WinMinX + 1,
+                          sizeX);
+  for(int y=beginY; y < endY; y++)
+    {
+    const int k = y + state.WinMinY;
+    const int offset = y*sizeX;
+    if(!drawOverlay || k < state.OverlayBounds[2] ||
+       k > state.OverlayBounds[3])
+      {
+      composeFramePixels(winImData + offset, NULL,
+                         winFramePixels + offset, sizeX);
+      continue;
+      }
+    composeFramePixels(winImData + offset, NULL,
+                       winFramePixels + offset, beginX);
+    composeFramePixels(winImData + offset + beginX,
+                       winOverlayPixels + offset + beginX,
+                       winFramePixels + offset + beginX, endX - beginX);
+    composeFramePixels(winImData + offset + endX, NULL,
+                       winFramePixels + offset + endX, sizeX - endX);
+    }
+}
+
+
+void QtSliceRenderer::composeValueFrame(const QtSliceRenderState& state,
+                                        const QRect& box,
+                                        const float* values,
+                                        const unsigned int* overlay,
+                                        unsigned int* frame)
+{
+  const int sizeX = state.WinDataSizeX;
+  const QRect window = box & QRect(0, 0, sizeX, state.WinDataSizeY);
+  QVarLengthArray<unsigned char, 1024> gray(sizeX);
+  for(int y=0; y < state.WinDataSizeY; y++)
+    {
+    const int offset = y*sizeX;
+    memset(gray.data(), 0, sizeX);
+    for(int x=window.left(); y >= window.top() && y <= window.bottom() &&
+          x <= window.right(); x++)
+      {
+      gray[x] = windowValue(state,
+        values[offset + x]*state.ValueScale + state.ValueOffset);
+      }
+    composeFramePixels(gray.constData(), overlay ? overlay + offset : NULL,
+                       frame + offset, sizeX);
+    }
+}
+
+
+void QtSliceRenderer::resliceRows(const QtSliceRenderState& state,
+                                  int beginK, int endK)
+{
+  const QtGlSliceView::ImageType* imData = state.Image.GetPointer();
+  const int overlayCount = this->OverlayTargets.size();
+  unsigned int* const* overlayTargets = this->OverlayTargets.constData();
+  const int* winOrder = state.WinOrder;
+  const int* winCenter = state.WinCenter;
+  const double iwMin = state.IWMin;
+
+  unsigned char* winImData = this->View->cWinImBackData;
+  float* winValueData = this->View->cWinValueBackData;
+  unsigned short* winZBuffer = this->View->cWinZBackBuffer;
+
+  QtGlSliceView::IndexType ind;
+
+  int l, m;
+
+  double tf;
+
+  ind[ winOrder[ 2 ] ] = winCenter[ winOrder[ 2 ] ];
+  int startJ = state.WinMinX;
+  if(startJ<0)
+    startJ = 0;
+  for(int k=beginK; k < endK; k++)
+    {
+    if(this->isCanceled(state))
+      {
+      return;
+      }
+
+    ind[winOrder[1]] = k;
+
+    if(k-state.WinMinY >= (int)state.WinDataSizeY)
+      continue;
+
+    // The gray levels may be copied from the previous frame.
+    for(int j=startJ; this->ResliceImage && j <= state.WinMaxX; j++)
+      {
+      ind[winOrder[0]] = j;
+
+      if(j-state.WinMinX >= (int)state.WinDataSizeX)
+         continue;
+
+      switch(state.ImageMode)
+        {
+        default:
+        case IMG_VAL:
+        case IMG_INV:
+        case IMG_LOG:
+          tf = (double)(imData->GetPixel(ind));
+          break;
+        case IMG_DX:
+        case IMG_DY:
+        case IMG_DZ:
+          {
+          const int axis = state.ImageMode - IMG_DX;
+          tf = 0;
+          if(ind[axis]>0)
+            {
+            tf = (double)(imData->GetPixel(ind));
+            ind[axis]--;
+            tf -= (double)(imData->GetPixel(ind));
+            ind[axis]++;
+            }
+          break;
+          }
+        case IMG_BLEND:
+          {
+          const int tempval = (int)winCenter[winOrder[2]]-1;
+          int tmpI = ind[winOrder[2]];
+          ind[winOrder[2]] = (tempval < 0) ? 0 : tempval;
+          tf = (double)(imData->GetPixel(ind));
+
+          ind[winOrder[2]] = winCenter[winOrder[2]];
+          tf += (double)(imData->GetPixel(ind))*2;
+
+          const int tempval1 = (int)state.DimSize[winOrder[2]]-1;
+          const int tempval2 = (int)winCenter[winOrder[2]]+1;
+          ind[winOrder[2]] = (tempval1 < tempval2) ? tempval1 : tempval2;
+          tf += (double)(imData->GetPixel(ind));
+
+          tf = tf/4;
+          ind[winOrder[2]] = tmpI;
+          break;
+          }
+        case IMG_MIP:
+          tf = iwMin;
+          m = (j-state.WinMinX) + (k-state.WinMinY)*state.WinDataSizeX;
+          winZBuffer[m] = 0;
+          int tmpI = ind[winOrder[2]];
+          for(l=0; l<(int)state.DimSize[winOrder[2]]; l++)
+            {
+            ind[winOrder[2]] = l;
+            if(imData->GetPixel(ind) > tf)
+              {
+              tf = (double)(imData->GetPixel(ind));
+              winZBuffer[m] = (unsigned short)l;
+              }
+            }
+          ind[winOrder[2]] = tmpI;
+          break;
+          }
+
+      l = (j-state.WinMinX) + (k-state.WinMinY)*state.WinDataSizeX;
+      if(state.ShaderWindow)
+        {
+        winValueData[l] =
+          (float)((tf-state.ValueOffset)/state.ValueScale);
+        }
+      else
+        {
+        winImData[l] = windowValue(state, tf);
+        }
+      }
+
+    // Only the rows and columns holding labels are sampled.
+    for(int i=0; i<overlayCount; i++)
+      {
+      const QtSliceOverlayState& overlay = state.Overlays[i];
+      unsigned int* target = overlayTargets[i];
+      if(!target || k < overlay.Bounds[2] || k > overlay.Bounds[3])
+        {
+        continue;
+        }
+      const int beginJ = qMax(startJ, overlay.Bounds[0]);
+      const int endJ = qMin(qMin(state.WinMaxX, overlay.Bounds[1]),
+                            state.WinMinX + state.WinDataSizeX - 1);
+      if(endJ >= beginJ)
+        {
+        const int rowOffset = (beginJ-state.WinMinX) +
+          (k-state.WinMinY)*state.WinDataSizeX;
+        ind[winOrder[0]] = beginJ;
+        overlay.Layer->sampleRow(ind, winOrder[0], endJ - beginJ + 1,
+          state.ImageMode == IMG_MIP ? winZBuffer + rowOffset : NULL,
+          winOrder[2], target + rowOffset);
+        }
+      }
+    }
+}
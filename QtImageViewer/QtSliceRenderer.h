@@ -0,0 +1,244 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+#ifndef __QtSliceRenderer_h
+#define __QtSliceRenderer_h
+
+// Qt includes
+#include <QAtomicInt>
+#include <QMutex>
+#include <QObject>
+#include <QSharedPointer>
+#include <QVector>
+#include <QWaitCondition>
+
+// ImageViewer includes
+#include "QtGlSliceView.h"
+#include "QtImageViewer_Export.h"
+
+/// Overlay layer of a QtSliceRenderState.
+struct QtSliceOverlayState
+{
+  QtSliceOverlayState();
+
+  QSharedPointer<QtOverlayLayer>   Layer;
+  /// Packed premultiplied RGBA8 color of each label, see
+  /// QtGlSliceView::updateOverlayLUT(). Empty for color overlays.
+  QVector<unsigned int>            LUT;
+  /// Opacity applied to the alpha of color overlays.
+  unsigned char Opacity;
+  /// True if the layer has no visible voxel in the frame. Otherwise the
+  /// window box (min j, max j, min k, max k) holding its visible voxels.
+  bool          Empty;
+  int           Bounds[4];
+};
+
+/// Snapshot of the QtGlSliceView state needed to reslice one frame.
+/// It is copied on the GUI thread so that the renderer never reads the
+/// members of the view while they are being modified.
+struct QtSliceRenderState
+{
+  QtSliceRenderState();
+
+  QtGlSliceView::ImagePointer      Image;
+  /// Visible overlay layers, from the bottom one to the top one.
+  QVector<QtSliceOverlayState>     Overlays;
+  bool          ValidOverlayData;
+  /// True if no overlay layer has a visible voxel in the frame. Otherwise
+  /// the union of the boxes of the layers.
+  bool          OverlayEmpty;
+  int           OverlayBounds[4];
+  OverlayModeType OverlayMode;
+  ImageModeType ImageMode;
+  IWModeType    IWModeMin;
+  IWModeType    IWModeMax;
+  double        IWMin;
+  double        IWMax;
+  /// True if the values of the slice are sampled for the fragment shader
+  /// of the view rather than its gray levels. The value of a pixel, the
+  /// intensity or the difference of intensities of the derivative modes,
+  /// is stored as (value - ValueOffset) / ValueScale in cWinValueData.
+  bool          ShaderWindow;
+  double        ValueOffset;
+  double        ValueScale;
+  /// Modification time of Image, to detect changes of its voxels.
+  unsigned long ImageMTime;
+  unsigned long DimSize[3];
+  int           WinOrder[3];
+  int           WinCenter[3];
+  int           WinMinX;
+  int           WinMaxX;
+  int           WinMinY;
+  int           WinMaxY;
+  int           WinDataSizeX;
+  int           WinDataSizeY;
+  /// Set by the renderer, used to abort the frames when it is canceled.
+  int           Generation;
+};
+
+/// QtSliceRenderer reslices the image and the overlay layers of a
+/// QtGlSliceView into its back buffers on the shared QtTaskScheduler, in
+/// bands of rows split among the workers. The back buffers are swapped
+/// with the front ones once the frame is complete, and sliceRendered() is
+/// then emitted for the view to repaint. Only the last requested frame is
+/// rendered next; the frame in progress is completed unless canceled.
+class QtImageViewer_EXPORT QtSliceRenderer : public QObject
+{
+  Q_OBJECT
+public:
+  typedef QObject Superclass;
+
+  /// Height of the bands of rows of the window processed by a worker. It
+  /// divides QtSliceTexture::TileSize.
+  static const int BandHeight = 16;
+
+  QtSliceRenderer(QtGlSliceView* view);
+  virtual ~QtSliceRenderer();
+
+  /// Queue a frame to render, once the frame in progress is done. A frame
+  /// that is pending is discarded in favor of the new one.
+  void requestRender(const QtSliceRenderState& state);
+
+  /// Discard the pending frame, abort the frame in progress and block
+  /// until the worker is idle. Must be called before the buffers of the
+  /// view are reallocated.
+  void cancel();
+
+  /// Block until the pending frames are rendered.
+  void wait();
+
+  /// Return true if a frame is pending or being rendered.
+  bool isBusy() const;
+
+  /// Number of frames discarded while pending because a newer frame was
+  /// requested, or aborted in progress by cancel(), since the last reset.
+  int droppedFrames() const;
+  void resetDroppedFrames();
+
+  /// Update the front buffers of the view after the voxels of layer in the
+  /// box [minJ, maxJ] x [minK, maxK] of the slice of state have been
+  /// modified: only the box is resampled and recomposited, from the cached
+  /// slices of the current frame, on the calling thread. Return false if
+  /// the current frame is not of state, a full frame is then needed.
+  bool renderOverlayBox(const QtSliceRenderState& state,
+                        const QtOverlayLayer* layer,
+                        int minJ, int maxJ, int minK, int maxK);
+
+  /// Render the pending frames until there are none left. Run by the
+  /// render task.
+  void renderPendingFrames();
+
+  /// Reslice the rows [beginK, endK) of the state into the back buffers
+  /// of the view, and sample the overlay layers that are not cached.
+  /// Stop early if the frame has been aborted.
+  void resliceRows(const QtSliceRenderState& state, int beginK, int endK);
+
+  /// Color and composite the sampled overlay layers of the rows
+  /// [beginK, endK) into the overlay back buffer of the view, keeping only
+  /// the boundaries of the labels in the outline mode.
+  void composeRows(const QtSliceRenderState& state, int beginK, int endK);
+
+  /// Composite the gray levels and the overlay of the rows [beginY, endY)
+  /// of the window into the opaque RGBA frame back buffer of the view.
+  void composeFrameRows(const QtSliceRenderState& state,
+                        int beginY, int endY);
+
+  /// Window the values of box, sampled for the frame of state, and
+  /// composite them with the overlay, NULL if there is none, into the
+  /// opaque RGBA frame as the fragment shader of the view does. The pixels
+  /// out of box are black.
+  static void composeValueFrame(const QtSliceRenderState& state,
+                                const QRect& box, const float* values,
+                                const unsigned int* overlay,
+                                unsigned int* frame);
+
+signals:
+  /// Emitted from a worker thread when the front buffers of the view
+  /// hold a new frame.
+  void sliceRendered();
+
+  /// Emitted from a worker thread when no frame is left to render.
+  void idle();
+
+protected:
+  /// Reslice the state into the back buffers of the view.
+  /// Return false if the frame has been aborted.
+  bool reslice(const QtSliceRenderState& state);
+
+  /// Composite the sampled overlay layers of the window box
+  /// [beginX, endX) x [beginY, endY) into winOverlayPixels.
+  void composeBox(const QtSliceRenderState& state,
+                  int beginX, int endX, int beginY, int endY,
+                  unsigned int* winOverlayPixels) const;
+
+  /// Return true if the front buffers of the view hold the gray levels, or
+  /// the values, of the frame of state, which then only differs by its
+  /// overlay.
+  bool isImageSliceCached(const QtSliceRenderState& state) const;
+
+  /// Set OverlaySlices to the layers of state, reusing the cached slices,
+  /// and OverlayTargets to the slices that have to be sampled.
+  void prepareOverlaySlices(const QtSliceRenderState& state);
+
+  /// Return true if the renderer has been canceled since state was
+  /// requested.
+  bool isCanceled(const QtSliceRenderState& state) const;
+
+  /// Return true if the overlay slices sampled for OverlaySliceState can
+  /// be reused for the frame of state.
+  bool isOverlaySliceCached(const QtSliceRenderState& state) const;
+
+  QtGlSliceView*         View;
+  mutable QMutex         Mutex;
+  QWaitCondition         IdleCondition;
+  QtSliceRenderState     PendingState;
+  bool                   HasPendingState;
+  bool                   Busy;
+  QAtomicInt             Generation;
+  int                    DroppedFrames;
+  /// Frame held by the front buffers of the view.
+  QtSliceRenderState     FrameState;
+  bool                   FrameValid;
+  /// False if resliceRows() only samples the overlay, the gray levels
+  /// being copied from the front buffers.
+  bool                   ResliceImage;
+
+  /// Values of an overlay layer sampled over the window. They do not
+  /// change with the intensity window, the colors or the overlay mode.
+  struct OverlaySlice
+    {
+    QSharedPointer<QtOverlayLayer> Layer;
+    QVector<unsigned int>          Values;
+    };
+  /// One slice per layer of the frame being rendered. They are kept as
+  /// long as the slice and the window are the same as OverlaySliceState.
+  QVector<OverlaySlice>  OverlaySlices;
+  QtSliceRenderState     OverlaySliceState;
+  bool                   OverlaySliceCached;
+  /// Where resliceRows() samples each layer, NULL to skip it.
+  QVector<unsigned int*> OverlayTargets;
+
+private:
+  Q_DISABLE_COPY(QtSliceRenderer);
+};
+
+#endif
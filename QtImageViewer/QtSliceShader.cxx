@@ -0,0 +1,304 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+
+//QtImageViewer includes
+#include "QtSliceShader.h"
+
+// Qt includes
+#include <QGLContext>
+#include <QGLShaderProgram>
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_TEXTURE0
+#define GL_TEXTURE0 0x84C0
+#endif
+#ifndef GL_TEXTURE1
+#define GL_TEXTURE1 0x84C1
+#endif
+#ifndef GL_LUMINANCE32F_ARB
+#define GL_LUMINANCE32F_ARB 0x8818
+#endif
+
+
+struct QtSliceShader::TextureFunctions
+{
+  typedef void (APIENTRY *ActiveTexture)(GLenum);
+
+  ActiveTexture activeTexture;
+};
+
+
+namespace
+{
+
+/// Window the value of a pixel as QtSliceRenderer::resliceRows() does:
+/// the gray level is truncated to [0, 255] according to the IW modes.
+/// The modes are 0 for the values, 1 for the inverse, 2 for the log and 3
+/// for the derivatives.
+const char* const FragmentShaderSource =
+  "uniform sampler2D values;\n"
+  "uniform sampler2D overlay;\n"
+  "uniform int drawOverlay;\n"
+  "uniform int mode;\n"
+  "uniform int iwModeMin;\n"
+  "uniform int iwModeMax;\n"
+  "uniform vec2 valueRange;\n"
+  "uniform vec2 window;\n"
+  "uniform vec4 box;\n"
+  "void main()\n"
+  "{\n"
+  "  vec2 st = gl_TexCoord[0].st;\n"
+  "  float gray = 0.0;\n"
+  "  if (st.s >= box.x && st.t >= box.y && st.s < box.z && st.t < box.w)\n"
+  "    {\n"
+  "    float value = texture2D(values, st).r * valueRange.y + valueRange.x;\n"
+  "    float width = window.y - window.x;\n"
+  "    float tf;\n"
+  "    if (mode == 1)\n"
+  "      tf = (window.y - value) / width * 255.0;\n"
+  "    else if (mode == 2)\n"
+  "      tf = log(max(value - window.x + 1.0e-8, 1.0e-30))\n"
+  "        / log(width + 1.0e-8) * 255.0;\n"
+  "    else if (mode == 3)\n"
+  "      tf = value / width * 255.0 + 128.0;\n"
+  "    else\n"
+  "      tf = (value - window.x) / width * 255.0;\n"
+  "    if (tf > 255.0)\n"
+  "      tf = iwModeMax == 0 ? 0.0 :\n"
+  "        (iwModeMax == 2 ? clamp(512.0 - tf, 0.0, 255.0) : 255.0);\n"
+  "    else if (tf < 0.0)\n"
+  "      tf = iwModeMin == 1 ? 255.0 :\n"
+  "        (iwModeMin == 2 ? min(-tf, 255.0) : 0.0);\n"
+  "    gray = floor(tf) / 255.0;\n"
+  "    }\n"
+  "  vec4 color = vec4(gray, gray, gray, 1.0);\n"
+  "  if (drawOverlay != 0)\n"
+  "    {\n"
+  "    vec4 labels = texture2D(overlay, st);\n"
+  "    color.rgb = labels.rgb + color.rgb * (1.0 - labels.a);\n"
+  "    }\n"
+  "  gl_FragColor = color;\n"
+  "}\n";
+
+} // end namespace
+
+
+QtSliceShader::QtSliceShader()
+  : Initialized(false)
+  , Program(NULL)
+  , FloatValues(false)
+  , Values(GL_LUMINANCE, GL_FLOAT, sizeof(float))
+  , Mode(IMG_VAL)
+  , ValueOffset(0.0)
+  , ValueScale(1.0)
+  , IWMin(0.0)
+  , IWMax(1.0)
+  , IWModeMin(IW_MIN)
+  , IWModeMax(IW_MAX)
+  , Functions(NULL)
+{
+}
+
+
+QtSliceShader::~QtSliceShader()
+{
+  delete this->Program;
+  delete this->Functions;
+}
+
+
+bool QtSliceShader::initialize()
+{
+  if (this->Initialized)
+    {
+    return this->Program != NULL;
+    }
+  this->Initialized = true;
+  const QGLContext* context = QGLContext::currentContext();
+  if (!context || !QGLShaderProgram::hasOpenGLShaderPrograms(context))
+    {
+    return false;
+    }
+  // Multitexturing is core in OpenGL 1.3.
+  TextureFunctions functions;
+  functions.activeTexture = reinterpret_cast<TextureFunctions::ActiveTexture>(
+    context->getProcAddress("glActiveTexture"));
+  if (!functions.activeTexture)
+    {
+    functions.activeTexture =
+      reinterpret_cast<TextureFunctions::ActiveTexture>(
+        context->getProcAddress("glActiveTextureARB"));
+    }
+  if (!functions.activeTexture)
+    {
+    return false;
+    }
+  this->Functions = new TextureFunctions(functions);
+  // The float values are normalized by GL into 16-bit textures.
+  this->FloatValues = QtSliceTexture::hasExtension("GL_ARB_texture_float");
+  this->Values.setInternalFormat(this->FloatValues ?
+                                 GL_LUMINANCE32F_ARB : GL_LUMINANCE16);
+
+  this->Program = new QGLShaderProgram(context);
+  if (!this->Program->addShaderFromSourceCode(QGLShader::Fragment,
+                                              FragmentShaderSource) ||
+      !this->Program->link())
+    {
+    delete this->Program;
+    this->Program = NULL;
+    return false;
+    }
+  return true;
+}
+
+
+bool QtSliceShader::isSupported(int width, int height)
+{
+  return this->initialize() && this->Values.isSupported(width, height) &&
+    this->Overlay.isSupported(width, height);
+}
+
+
+bool QtSliceShader::usesFloatValues() const
+{
+  return this->FloatValues;
+}
+
+
+void QtSliceShader::upload(const float* values, const unsigned char* overlay,
+                           int width, int height, const QRect& dirty,
+                           const QRect& visible)
+{
+  this->Values.upload(reinterpret_cast<const unsigned char*>(values),
+                      width, height, dirty, visible);
+  if (overlay)
+    {
+    this->Overlay.upload(overlay, width, height, dirty, visible);
+    }
+}
+
+
+void QtSliceShader::setValues(ImageModeType mode, double offset,
+                              double scale, const QRect& box)
+{
+  this->Mode = mode;
+  this->ValueOffset = offset;
+  this->ValueScale = scale;
+  this->Box = box;
+}
+
+
+void QtSliceShader::setWindow(double iwMin, double iwMax,
+                              IWModeType iwModeMin, IWModeType iwModeMax)
+{
+  this->IWMin = iwMin;
+  this->IWMax = iwMax;
+  this->IWModeMin = iwModeMin;
+  this->IWModeMax = iwModeMax;
+}
+
+
+void QtSliceShader::draw(double x, double y, double scaleX, double scaleY,
+                         const QRect& visible, bool drawOverlay)
+{
+  const QVector<int> tiles = this->Values.visibleTiles(visible);
+  if (tiles.isEmpty() || !this->Program || !this->Program->bind())
+    {
+    return;
+    }
+  int mode = 0;
+  switch (this->Mode)
+    {
+    default:
+      break;
+    case IMG_INV:
+      mode = 1;
+      break;
+    case IMG_LOG:
+      mode = 2;
+      break;
+    case IMG_DX:
+    case IMG_DY:
+    case IMG_DZ:
+      mode = 3;
+      break;
+    }
+  this->Program->setUniformValue("values", static_cast<GLint>(0));
+  this->Program->setUniformValue("overlay", static_cast<GLint>(1));
+  this->Program->setUniformValue("drawOverlay",
+                                 static_cast<GLint>(drawOverlay));
+  this->Program->setUniformValue("mode", static_cast<GLint>(mode));
+  this->Program->setUniformValue("iwModeMin",
+                                 static_cast<GLint>(this->IWModeMin));
+  this->Program->setUniformValue("iwModeMax",
+                                 static_cast<GLint>(this->IWModeMax));
+  this->Program->setUniformValue("valueRange",
+                                 static_cast<GLfloat>(this->ValueOffset),
+                                 static_cast<GLfloat>(this->ValueScale));
+  this->Program->setUniformValue("window",
+                                 static_cast<GLfloat>(this->IWMin),
+                                 static_cast<GLfloat>(this->IWMax));
+  const GLfloat size = static_cast<GLfloat>(QtSliceTexture::TileSize);
+  for (int i = 0; i < tiles.size(); ++i)
+    {
+    // The box is compared to the texture coordinates of the pixel centers
+    // of the tile.
+    const QRect tileBox = this->Values.tileBox(tiles[i]);
+    const QRect& box = this->Box;
+    this->Program->setUniformValue("box",
+      (box.left() - tileBox.left()) / size,
+      (box.top() - tileBox.top()) / size,
+      (box.right() + 1 - tileBox.left()) / size,
+      (box.bottom() + 1 - tileBox.top()) / size);
+    if (drawOverlay)
+      {
+      this->Functions->activeTexture(GL_TEXTURE1);
+      this->Overlay.bindTile(tiles[i]);
+      this->Functions->activeTexture(GL_TEXTURE0);
+      }
+    this->Values.bindTile(tiles[i]);
+    this->Values.drawTile(tiles[i], x, y, scaleX, scaleY);
+    }
+  if (drawOverlay)
+    {
+    this->Functions->activeTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    this->Functions->activeTexture(GL_TEXTURE0);
+    }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  this->Program->release();
+}
+
+
+void QtSliceShader::release()
+{
+  this->Values.release();
+  this->Overlay.release();
+  delete this->Program;
+  this->Program = NULL;
+  delete this->Functions;
+  this->Functions = NULL;
+  this->Initialized = false;
+}
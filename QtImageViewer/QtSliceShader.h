@@ -0,0 +1,112 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+#ifndef __QtSliceShader_h
+#define __QtSliceShader_h
+
+// Qt includes
+#include <QRect>
+
+// ImageViewer includes
+#include "QtGlSliceView.h"
+#include "QtImageViewer_Export.h"
+#include "QtSliceTexture.h"
+
+class QGLShaderProgram;
+
+/// Fragment shader windowing the intensities of a slice of a
+/// QtGlSliceView, so that changing the intensity window only changes its
+/// uniforms.
+/// The renderer samples the values of the slice rather than its gray
+/// levels, normalized to [0, 1]. They are uploaded into a float texture, or
+/// a 16-bit one without float texture support, and the premultiplied
+/// overlay into an RGBA8 texture. The shader applies the image mode and
+/// the IW modes and blends the overlay as QtSliceRenderer does on the CPU.
+/// All the methods must be called with the GL context of the view current.
+class QtImageViewer_EXPORT QtSliceShader
+{
+public:
+  QtSliceShader();
+  /// The GL objects must have been released beforehand.
+  ~QtSliceShader();
+
+  /// Compile the shader. Return false if the context does not support
+  /// shaders, multitexturing or if the shader does not compile.
+  bool initialize();
+
+  /// Return true if the shader is compiled and the textures support
+  /// frames of width x height.
+  bool isSupported(int width, int height);
+
+  /// Return true if the values are held in a float texture.
+  bool usesFloatValues() const;
+
+  /// Upload the box dirty of the values of the frame of width x height
+  /// pixels, and of its premultiplied RGBA8 overlay if not NULL, in the
+  /// tiles of the box visible. See QtSliceTexture::upload().
+  void upload(const float* values, const unsigned char* overlay,
+              int width, int height, const QRect& dirty,
+              const QRect& visible);
+
+  /// Set how the values are windowed: the value of a pixel is its
+  /// normalized value * scale + offset, the intensity or the difference of
+  /// intensities of the derivative modes. Only the pixels of box are
+  /// windowed, the others are black.
+  void setValues(ImageModeType mode, double offset, double scale,
+                 const QRect& box);
+
+  /// Set the intensity window and the IW modes.
+  void setWindow(double iwMin, double iwMax,
+                 IWModeType iwModeMin, IWModeType iwModeMax);
+
+  /// Draw the frame as QtSliceTexture::draw() does, with its overlay if
+  /// drawOverlay is true.
+  void draw(double x, double y, double scaleX, double scaleY,
+            const QRect& visible, bool drawOverlay);
+
+  /// Delete the GL objects.
+  void release();
+
+protected:
+  bool              Initialized;
+  QGLShaderProgram* Program;
+  bool              FloatValues;
+  QtSliceTexture    Values;
+  QtSliceTexture    Overlay;
+  ImageModeType     Mode;
+  double            ValueOffset;
+  double            ValueScale;
+  QRect             Box;
+  double            IWMin;
+  double            IWMax;
+  IWModeType        IWModeMin;
+  IWModeType        IWModeMax;
+
+  /// Entry point of glActiveTexture(), NULL if not supported.
+  struct TextureFunctions;
+  TextureFunctions* Functions;
+
+private:
+  Q_DISABLE_COPY(QtSliceShader);
+};
+
+#endif
@@ -0,0 +1,391 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+
+//QtImageViewer includes
+#include "QtSliceTexture.h"
+
+// Qt includes
+#include <QGLContext>
+
+//std includes
+#include <cstddef>
+#include <cstring>
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY 0x88B9
+#endif
+
+
+struct QtSliceTexture::BufferFunctions
+{
+  typedef void (APIENTRY *GenBuffers)(GLsizei, GLuint*);
+  typedef void (APIENTRY *DeleteBuffers)(GLsizei, const GLuint*);
+  typedef void (APIENTRY *BindBuffer)(GLenum, GLuint);
+  typedef void (APIENTRY *BufferData)(GLenum, ptrdiff_t, const GLvoid*,
+                                      GLenum);
+  typedef GLvoid* (APIENTRY *MapBuffer)(GLenum, GLenum);
+  typedef GLboolean (APIENTRY *UnmapBuffer)(GLenum);
+
+  GenBuffers    genBuffers;
+  DeleteBuffers deleteBuffers;
+  BindBuffer    bindBuffer;
+  BufferData    bufferData;
+  MapBuffer     mapBuffer;
+  UnmapBuffer   unmapBuffer;
+};
+
+
+const int QtSliceTexture::TileSize;
+
+
+QtSliceTexture::QtSliceTexture(GLenum format, GLenum type, int pixelSize)
+  : InternalFormat(GL_RGBA8)
+  , Format(format)
+  , Type(type)
+  , PixelSize(pixelSize)
+  , Initialized(false)
+  , MaxSize(0)
+  , Width(0)
+  , Height(0)
+  , Columns(0)
+  , CurrentPixelBuffer(0)
+  , UploadedPixels(0)
+  , Functions(NULL)
+{
+  this->PixelBuffers[0] = this->PixelBuffers[1] = 0;
+}
+
+
+QtSliceTexture::~QtSliceTexture()
+{
+  delete this->Functions;
+}
+
+
+void QtSliceTexture::initialize()
+{
+  this->Initialized = true;
+  const QGLContext* context = QGLContext::currentContext();
+  if (!context)
+    {
+    return;
+    }
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &this->MaxSize);
+
+  // Pixel buffer objects are core in OpenGL 2.1.
+  const bool core =
+    QGLFormat::openGLVersionFlags() & QGLFormat::OpenGL_Version_2_1;
+  if (!core && !hasExtension("GL_ARB_pixel_buffer_object"))
+    {
+    return;
+    }
+  const char* suffix = core ? "" : "ARB";
+  BufferFunctions functions;
+  functions.genBuffers = reinterpret_cast<BufferFunctions::GenBuffers>(
+    context->getProcAddress(QString("glGenBuffers") + suffix));
+  functions.deleteBuffers = reinterpret_cast<BufferFunctions::DeleteBuffers>(
+    context->getProcAddress(QString("glDeleteBuffers") + suffix));
+  functions.bindBuffer = reinterpret_cast<BufferFunctions::BindBuffer>(
+    context->getProcAddress(QString("glBindBuffer") + suffix));
+  functions.bufferData = reinterpret_cast<BufferFunctions::BufferData>(
+    context->getProcAddress(QString("glBufferData") + suffix));
+  functions.mapBuffer = reinterpret_cast<BufferFunctions::MapBuffer>(
+    context->getProcAddress(QString("glMapBuffer") + suffix));
+  functions.unmapBuffer = reinterpret_cast<BufferFunctions::UnmapBuffer>(
+    context->getProcAddress(QString("glUnmapBuffer") + suffix));
+  if (functions.genBuffers && functions.deleteBuffers &&
+      functions.bindBuffer && functions.bufferData &&
+      functions.mapBuffer && functions.unmapBuffer)
+    {
+    this->Functions = new BufferFunctions(functions);
+    this->Functions->genBuffers(2, this->PixelBuffers);
+    }
+}
+
+
+bool QtSliceTexture::isSupported(int width, int height)
+{
+  if (!this->Initialized)
+    {
+    this->initialize();
+    }
+  return width > 0 && height > 0 && this->MaxSize >= TileSize;
+}
+
+
+bool QtSliceTexture::hasExtension(const char* extension)
+{
+  const char* extensions =
+    reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+  const size_t length = strlen(extension);
+  for (const char* found = extensions;
+       found && (found = strstr(found, extension)) != NULL;
+       found += length)
+    {
+    if ((found == extensions || found[-1] == ' ') &&
+        (found[length] == ' ' || found[length] == '\0'))
+      {
+      return true;
+      }
+    }
+  return false;
+}
+
+
+bool QtSliceTexture::usesPixelBuffers() const
+{
+  return this->Functions != NULL;
+}
+
+
+void QtSliceTexture::setInternalFormat(GLint internalFormat)
+{
+  this->InternalFormat = internalFormat;
+}
+
+
+void QtSliceTexture::upload(const unsigned char* pixels,
+                            int width, int height, const QRect& dirty,
+                            const QRect& visible)
+{
+  if (!this->Initialized)
+    {
+    this->initialize();
+    }
+  if (width != this->Width || height != this->Height)
+    {
+    this->releaseTiles();
+    this->Width = width;
+    this->Height = height;
+    this->Columns = (width + TileSize - 1) / TileSize;
+    const int rows = (height + TileSize - 1) / TileSize;
+    this->Tiles.resize(this->Columns * rows);
+    for (int i = 0; i < this->Tiles.size(); ++i)
+      {
+      Tile& tile = this->Tiles[i];
+      tile.Texture = 0;
+      tile.Box = QRect((i % this->Columns) * TileSize,
+                       (i / this->Columns) * TileSize, TileSize, TileSize)
+        & QRect(0, 0, width, height);
+      tile.Dirty = tile.Box;
+      }
+    }
+  else if (!dirty.isEmpty())
+    {
+    for (int i = 0; i < this->Tiles.size(); ++i)
+      {
+      Tile& tile = this->Tiles[i];
+      tile.Dirty |= dirty & tile.Box;
+      }
+    }
+  for (int i = 0; i < this->Tiles.size(); ++i)
+    {
+    Tile& tile = this->Tiles[i];
+    if (!tile.Dirty.isEmpty() && tile.Box.intersects(visible))
+      {
+      this->uploadTile(i, pixels, tile.Dirty);
+      tile.Dirty = QRect();
+      }
+    }
+}
+
+
+void QtSliceTexture::uploadTile(int index, const unsigned char* pixels,
+                                const QRect& box)
+{
+  Tile& tile = this->Tiles[index];
+  if (!tile.Texture)
+    {
+    glGenTextures(1, &tile.Texture);
+    glBindTexture(GL_TEXTURE_2D, tile.Texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glTexImage2D(GL_TEXTURE_2D, 0, this->InternalFormat,
+                 TileSize, TileSize, 0, this->Format, this->Type, NULL);
+    }
+  else
+    {
+    glBindTexture(GL_TEXTURE_2D, tile.Texture);
+    }
+
+  const int pixelSize = this->PixelSize;
+  const int width = this->Width;
+  const unsigned char* source =
+    pixels + pixelSize * (box.y() * width + box.x());
+  const int rowSize = pixelSize * box.width();
+  const int x = box.x() - tile.Box.x();
+  const int y = box.y() - tile.Box.y();
+  bool uploaded = false;
+  if (this->Functions)
+    {
+    // Orphan the buffer, so that the copy does not wait for the transfer
+    // still reading it, then copy the rows of the box.
+    this->CurrentPixelBuffer = 1 - this->CurrentPixelBuffer;
+    this->Functions->bindBuffer(GL_PIXEL_UNPACK_BUFFER,
+                                this->PixelBuffers[this->CurrentPixelBuffer]);
+    this->Functions->bufferData(GL_PIXEL_UNPACK_BUFFER,
+                                rowSize * box.height(), NULL, GL_STREAM_DRAW);
+    unsigned char* target = static_cast<unsigned char*>(
+      this->Functions->mapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY));
+    if (target)
+      {
+      for (int row = 0; row < box.height(); ++row)
+        {
+        memcpy(target + row * rowSize, source + pixelSize * row * width,
+               rowSize);
+        }
+      this->Functions->unmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, box.width(), box.height(),
+                      this->Format, this->Type, NULL);
+      uploaded = true;
+      }
+    this->Functions->bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+  if (!uploaded)
+    {
+    // Without pixel buffer objects, or if the buffer cannot be mapped,
+    // e.g. once the context is lost.
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, box.width(), box.height(),
+                    this->Format, this->Type, source);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+  this->UploadedPixels += box.width() * box.height();
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+
+void QtSliceTexture::draw(double x, double y,
+                          double scaleX, double scaleY,
+                          const QRect& visible) const
+{
+  const QVector<int> tiles = this->visibleTiles(visible);
+  if (tiles.isEmpty())
+    {
+    return;
+    }
+  glEnable(GL_TEXTURE_2D);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+  for (int i = 0; i < tiles.size(); ++i)
+    {
+    this->bindTile(tiles[i]);
+    this->drawTile(tiles[i], x, y, scaleX, scaleY);
+    }
+  glDisable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+
+QVector<int> QtSliceTexture::visibleTiles(const QRect& visible) const
+{
+  QVector<int> tiles;
+  for (int i = 0; i < this->Tiles.size(); ++i)
+    {
+    if (this->Tiles[i].Texture && this->Tiles[i].Box.intersects(visible))
+      {
+      tiles.append(i);
+      }
+    }
+  return tiles;
+}
+
+
+QRect QtSliceTexture::tileBox(int tile) const
+{
+  return this->Tiles[tile].Box;
+}
+
+
+void QtSliceTexture::bindTile(int tile) const
+{
+  glBindTexture(GL_TEXTURE_2D, this->Tiles[tile].Texture);
+}
+
+
+void QtSliceTexture::drawTile(int tile, double x, double y,
+                              double scaleX, double scaleY) const
+{
+  const QRect& box = this->Tiles[tile].Box;
+  const double s = box.width() / static_cast<double>(TileSize);
+  const double t = box.height() / static_cast<double>(TileSize);
+  const double x0 = x + box.x() * scaleX;
+  const double y0 = y + box.y() * scaleY;
+  const double x1 = x + (box.x() + box.width()) * scaleX;
+  const double y1 = y + (box.y() + box.height()) * scaleY;
+  glBegin(GL_QUADS);
+  glTexCoord2d(0., 0.);
+  glVertex2d(x0, y0);
+  glTexCoord2d(s, 0.);
+  glVertex2d(x1, y0);
+  glTexCoord2d(s, t);
+  glVertex2d(x1, y1);
+  glTexCoord2d(0., t);
+  glVertex2d(x0, y1);
+  glEnd();
+}
+
+
+void QtSliceTexture::releaseTiles()
+{
+  for (int i = 0; i < this->Tiles.size(); ++i)
+    {
+    if (this->Tiles[i].Texture)
+      {
+      glDeleteTextures(1, &this->Tiles[i].Texture);
+      }
+    }
+  this->Tiles.clear();
+  this->Width = this->Height = 0;
+  this->Columns = 0;
+}
+
+
+void QtSliceTexture::release()
+{
+  this->releaseTiles();
+  if (this->Functions)
+    {
+    this->Functions->deleteBuffers(2, this->PixelBuffers);
+    this->PixelBuffers[0] = this->PixelBuffers[1] = 0;
+    delete this->Functions;
+    this->Functions = NULL;
+    }
+  this->Initialized = false;
+}
+
+
+qint64 QtSliceTexture::uploadedPixels() const
+{
+  return this->UploadedPixels;
+}
@@ -0,0 +1,151 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+#ifndef __QtSliceTexture_h
+#define __QtSliceTexture_h
+
+// Qt includes
+#include <QRect>
+#include <QVector>
+#include <QtOpenGL/qgl.h>
+
+// ImageViewer includes
+#include "QtImageViewer_Export.h"
+
+/// GL textures holding the RGBA frame of a QtGlSliceView, drawn as
+/// textured quads, or another image of the window such as the values
+/// windowed by QtSliceShader.
+/// The frame is split into tiles of TileSize x TileSize pixels, each held
+/// by its own texture, so that frames larger than the maximum texture size
+/// can be drawn. Only the tiles in the visible box of the frame are
+/// uploaded and drawn; the modified boxes of the others are kept until
+/// they become visible. The tiles are created when first uploaded.
+/// Only the modified box of a tile is uploaded, with glTexSubImage2D.
+/// When pixel buffer objects are supported, the pixels are copied into one
+/// of two buffers used in turn and the texture is updated from it, so that
+/// the transfer does not wait for the previous one. The tiles are powers of
+/// two large, so that OpenGL 1.1 implementations and Mesa work alike.
+/// All the methods must be called with the GL context of the view current.
+class QtImageViewer_EXPORT QtSliceTexture
+{
+public:
+  /// Size of the tiles. It is a whole number of the bands of rows
+  /// QtSliceRenderer splits the frames into.
+  static const int TileSize = 256;
+
+  /// The pixels uploaded are of format and type, pixelSize bytes each.
+  QtSliceTexture(GLenum format = GL_RGBA, GLenum type = GL_UNSIGNED_BYTE,
+                 int pixelSize = 4);
+  /// The GL objects must have been released beforehand.
+  ~QtSliceTexture();
+
+  /// Return true if the frame can be drawn from textures: the context
+  /// supports textures of the size of the tiles.
+  bool isSupported(int width, int height);
+
+  /// Return true if the extension is listed by the current context.
+  static bool hasExtension(const char* extension);
+
+  /// Return true if the uploads go through pixel buffer objects.
+  bool usesPixelBuffers() const;
+
+  /// Set the format of the texture, GL_RGBA8 by default. Must be set
+  /// before the first upload.
+  void setInternalFormat(GLint internalFormat);
+
+  /// Upload the box dirty of the frame of width x height pixels, in the
+  /// tiles of the box visible. The whole frame is modified if its size
+  /// changed.
+  void upload(const unsigned char* pixels, int width, int height,
+              const QRect& dirty, const QRect& visible);
+
+  /// Draw the tiles of the box visible of the frame, as quads from
+  /// (x, y) to (x + width * scaleX, y + height * scaleY) for the whole
+  /// frame, in the current coordinates.
+  void draw(double x, double y, double scaleX, double scaleY,
+            const QRect& visible) const;
+
+  /// Return the tiles of the box visible of the frame that have been
+  /// uploaded.
+  QVector<int> visibleTiles(const QRect& visible) const;
+
+  /// Box of the frame held by tile.
+  QRect tileBox(int tile) const;
+
+  /// Bind the texture of tile to the active texture unit.
+  void bindTile(int tile) const;
+
+  /// Draw the quad of tile, bound to the active texture unit, with its
+  /// texture coordinates. See draw().
+  void drawTile(int tile, double x, double y,
+                double scaleX, double scaleY) const;
+
+  /// Delete the GL objects.
+  void release();
+
+  /// Number of pixels uploaded so far.
+  qint64 uploadedPixels() const;
+
+protected:
+  /// Resolve the extensions of the current context.
+  void initialize();
+
+  /// Delete the textures of the tiles.
+  void releaseTiles();
+
+  /// Upload the box of the frame into the texture of tile.
+  void uploadTile(int tile, const unsigned char* pixels, const QRect& box);
+
+  struct Tile
+    {
+    GLuint Texture;
+    /// Box of the frame held by the tile.
+    QRect  Box;
+    /// Box modified since the tile was last uploaded.
+    QRect  Dirty;
+    };
+
+  GLint  InternalFormat;
+  GLenum Format;
+  GLenum Type;
+  int    PixelSize;
+  bool   Initialized;
+  GLint  MaxSize;
+  /// Size of the frame, and tiles covering it row by row.
+  int    Width;
+  int    Height;
+  int    Columns;
+  QVector<Tile> Tiles;
+  /// Pixel buffer objects used in turn, 0 if not supported.
+  GLuint PixelBuffers[2];
+  int    CurrentPixelBuffer;
+  qint64 UploadedPixels;
+
+  /// Entry points of the pixel buffer objects.
+  struct BufferFunctions;
+  BufferFunctions* Functions;
+
+private:
+  Q_DISABLE_COPY(QtSliceTexture);
+};
+
+#endif
@@ -0,0 +1,632 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+
+//QtImageViewer includes
+#include "QtTaskScheduler.h"
+
+// Qt includes
+#include <QMutexLocker>
+#include <QThread>
+#include <QtAlgorithms>
+
+// std includes
+#if defined(Q_OS_UNIX)
+#include <cstdlib>
+#endif
+#if defined(Q_OS_LINUX)
+#include <sched.h>
+#endif
+
+
+/// Thread running QtTaskScheduler::workerLoop().
+class QtTaskWorker : public QThread
+{
+public:
+  QtTaskWorker(QtTaskScheduler* scheduler, int index)
+    : Scheduler(scheduler)
+    , Index(index)
+    {
+    }
+protected:
+  virtual void run()
+    {
+    this->Scheduler->workerLoop(this->Index);
+    }
+  QtTaskScheduler* Scheduler;
+  int Index;
+};
+
+
+QtTask::QtTask(Priority taskPriority)
+  : TaskPriority(taskPriority)
+  , AutoDelete(true)
+  , Canceled(0)
+  , Group(0)
+{
+}
+
+
+QtTask::~QtTask()
+{
+}
+
+
+QtTask::Priority QtTask::priority() const
+{
+  return this->TaskPriority;
+}
+
+
+bool QtTask::autoDelete() const
+{
+  return this->AutoDelete;
+}
+
+
+void QtTask::setAutoDelete(bool newAutoDelete)
+{
+  this->AutoDelete = newAutoDelete;
+}
+
+
+void QtTask::cancel()
+{
+  this->Canceled = 1;
+}
+
+
+bool QtTask::isCanceled() const
+{
+  return this->Canceled != 0;
+}
+
+
+bool QtTask::shouldYield() const
+{
+  QtTaskScheduler* scheduler = QtTaskScheduler::instance();
+  // Idle workers will pick up the urgent tasks by themselves.
+  return scheduler->hasPendingTasks(this->TaskPriority) &&
+    scheduler->idleThreadCount() == 0;
+}
+
+
+QtTaskGroup::QtTaskGroup()
+  : PendingTasks(0)
+  , MostUrgentPriority(QtTask::Background)
+{
+}
+
+
+QtTaskGroup::~QtTaskGroup()
+{
+  this->wait();
+}
+
+
+void QtTaskGroup::run(QtTask* task)
+{
+  {
+  QMutexLocker locker(&this->Mutex);
+  task->Group = this;
+  ++this->PendingTasks;
+  this->MostUrgentPriority = qMin(this->MostUrgentPriority,
+                                  static_cast<int>(task->priority()));
+  this->Tasks << task;
+  }
+  QtTaskScheduler::instance()->submit(task);
+}
+
+
+void QtTaskGroup::wait()
+{
+  QtTaskScheduler* scheduler = QtTaskScheduler::instance();
+  const int worker = scheduler->currentWorker();
+  forever
+    {
+    int priority;
+    {
+    QMutexLocker locker(&this->Mutex);
+    if (this->PendingTasks == 0)
+      {
+      return;
+      }
+    priority = this->MostUrgentPriority;
+    }
+    // Help instead of blocking. Only tasks at least as urgent as the group
+    // are run so that a visible frame never waits for speculative work.
+    QtTask* task = scheduler->takeTask(worker, priority);
+    if (task)
+      {
+      scheduler->runTask(task);
+      continue;
+      }
+    // The remaining tasks are running on other workers.
+    QMutexLocker locker(&this->Mutex);
+    if (this->PendingTasks > 0)
+      {
+      this->DoneCondition.wait(&this->Mutex);
+      }
+    }
+}
+
+
+void QtTaskGroup::cancel()
+{
+  QMutexLocker locker(&this->Mutex);
+  foreach(QtTask* task, this->Tasks)
+    {
+    task->cancel();
+    }
+}
+
+
+bool QtTaskGroup::isDone() const
+{
+  QMutexLocker locker(&this->Mutex);
+  return this->PendingTasks == 0;
+}
+
+
+void QtTaskGroup::taskFinished(QtTask* task)
+{
+  // The group may be destroyed as soon as the mutex is released.
+  QMutexLocker locker(&this->Mutex);
+  this->Tasks.removeAll(task);
+  --this->PendingTasks;
+  this->DoneCondition.wakeAll();
+}
+
+
+QtTaskScheduler::QtTaskScheduler()
+  : Stopping(false)
+  , MaximumThreads(0)
+  , Adaptive(false)
+  , AffinityGeneration(0)
+  , ActiveWorkers(0)
+  , PendingTasks(0)
+  , IdleWorkers(0)
+  , StartedWorkers(0)
+{
+  for (int i = 0; i < QtTask::NumberOfPriorities; ++i)
+    {
+    this->PendingTasksByPriority[i] = 0;
+    }
+  // The queues are allocated for every core up front so that the workers
+  // can be started and parked without locking the stealing.
+  const int count = qMax(1, QThread::idealThreadCount());
+  for (int i = 0; i < count; ++i)
+    {
+    this->LocalQueues << new WorkerQueues;
+    }
+  this->ActiveWorkers = this->threadLimit();
+}
+
+
+QtTaskScheduler::~QtTaskScheduler()
+{
+  {
+  QMutexLocker locker(&this->Mutex);
+  this->Stopping = true;
+  this->WorkAvailable.wakeAll();
+  this->Reactivated.wakeAll();
+  }
+  foreach(QtTaskWorker* worker, this->Workers)
+    {
+    worker->wait();
+    delete worker;
+    }
+  this->Workers.clear();
+
+  QList<WorkerQueues*> queues = this->LocalQueues;
+  queues << &this->SharedQueues;
+  foreach(WorkerQueues* workerQueues, queues)
+    {
+    for (int p = 0; p < QtTask::NumberOfPriorities; ++p)
+      {
+      foreach(QtTask* task, workerQueues->Queues[p])
+        {
+        if (task->Group)
+          {
+          task->Group->taskFinished(task);
+          }
+        if (task->AutoDelete)
+          {
+          delete task;
+          }
+        }
+      }
+    }
+  qDeleteAll(this->LocalQueues);
+  this->LocalQueues.clear();
+}
+
+
+QtTaskScheduler* QtTaskScheduler::instance()
+{
+  static QtTaskScheduler scheduler;
+  return &scheduler;
+}
+
+
+void QtTaskScheduler::startWorkers()
+{
+  if (this->StartedWorkers >= this->ActiveWorkers)
+    {
+    return;
+    }
+  QMutexLocker locker(&this->Mutex);
+  if (this->Stopping)
+    {
+    return;
+    }
+  while (this->Workers.size() < this->ActiveWorkers)
+    {
+    QtTaskWorker* worker = new QtTaskWorker(this, this->Workers.size());
+    this->Workers << worker;
+    this->StartedWorkers.ref();
+    worker->start();
+    }
+}
+
+
+int QtTaskScheduler::threadCount() const
+{
+  return this->ActiveWorkers;
+}
+
+
+int QtTaskScheduler::threadLimit() const
+{
+  int limit = this->LocalQueues.size();
+  if (this->MaximumThreads > 0)
+    {
+    limit = qMin(limit, this->MaximumThreads);
+    }
+  if (!this->Affinity.isEmpty())
+    {
+    limit = qMin(limit, this->Affinity.size());
+    }
+  return limit;
+}
+
+
+void QtTaskScheduler::setActiveThreadCount(int count)
+{
+  {
+  QMutexLocker locker(&this->Mutex);
+  if (count == this->ActiveWorkers)
+    {
+    return;
+    }
+  this->ActiveWorkers = count;
+  this->Reactivated.wakeAll();
+  }
+  this->startWorkers();
+}
+
+
+void QtTaskScheduler::setMaximumThreadCount(int count)
+{
+  int limit;
+  {
+  QMutexLocker locker(&this->Mutex);
+  this->MaximumThreads = qMax(0, count);
+  limit = this->threadLimit();
+  }
+  this->setActiveThreadCount(limit);
+}
+
+
+int QtTaskScheduler::maximumThreadCount() const
+{
+  QMutexLocker locker(&this->Mutex);
+  return this->MaximumThreads;
+}
+
+
+void QtTaskScheduler::setAdaptiveThreadCount(bool adaptive)
+{
+  int limit;
+  {
+  QMutexLocker locker(&this->Mutex);
+  this->Adaptive = adaptive;
+  this->LastLoadUpdate = QTime();
+  limit = this->threadLimit();
+  }
+  if (!adaptive)
+    {
+    this->setActiveThreadCount(limit);
+    }
+}
+
+
+bool QtTaskScheduler::adaptiveThreadCount() const
+{
+  QMutexLocker locker(&this->Mutex);
+  return this->Adaptive;
+}
+
+
+void QtTaskScheduler::setThreadAffinity(const QList<int>& cpus)
+{
+  int limit;
+  {
+  QMutexLocker locker(&this->Mutex);
+  this->Affinity = cpus;
+  this->AffinityGeneration.ref();
+  limit = this->threadLimit();
+  // Parked and idle workers bind themselves when they wake up.
+  this->WorkAvailable.wakeAll();
+  this->Reactivated.wakeAll();
+  }
+  this->applyThreadAffinity();
+  this->setActiveThreadCount(limit);
+}
+
+
+QList<int> QtTaskScheduler::threadAffinity() const
+{
+  QMutexLocker locker(&this->Mutex);
+  return this->Affinity;
+}
+
+
+void QtTaskScheduler::applyThreadAffinity()
+{
+#if defined(Q_OS_LINUX)
+  QList<int> cpus = this->threadAffinity();
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+    if (cpus.isEmpty() || cpus.contains(cpu))
+      {
+      CPU_SET(cpu, &cpuSet);
+      }
+    }
+  // 0 is the calling thread.
+  sched_setaffinity(0, sizeof(cpuSet), &cpuSet);
+#endif
+}
+
+
+void QtTaskScheduler::updateAdaptiveThreadCount()
+{
+#if defined(Q_OS_UNIX)
+  int limit;
+  {
+  QMutexLocker locker(&this->Mutex);
+  if (!this->Adaptive ||
+      (this->LastLoadUpdate.isValid() && this->LastLoadUpdate.elapsed() < 1000))
+    {
+    return;
+    }
+  this->LastLoadUpdate.start();
+  limit = this->threadLimit();
+  }
+  double load = 0.;
+  if (getloadavg(&load, 1) != 1)
+    {
+    return;
+    }
+  // The load average includes the workers of the pool that are busy.
+  const int busyWorkers = this->ActiveWorkers - this->IdleWorkers;
+  const int otherLoad = qMax(0, qRound(load) - busyWorkers);
+  this->setActiveThreadCount(qBound(1, limit - otherLoad, limit));
+#endif
+}
+
+
+int QtTaskScheduler::idleThreadCount() const
+{
+  return this->IdleWorkers;
+}
+
+
+bool QtTaskScheduler::hasPendingTasks(QtTask::Priority priority) const
+{
+  for (int p = 0; p < priority; ++p)
+    {
+    if (this->PendingTasksByPriority[p] > 0)
+      {
+      return true;
+      }
+    }
+  return false;
+}
+
+
+int QtTaskScheduler::currentWorker() const
+{
+  const int* worker = this->WorkerIndex.localData();
+  return worker ? *worker : -1;
+}
+
+
+void QtTaskScheduler::submit(QtTask* task)
+{
+  this->startWorkers();
+  this->enqueue(task, this->currentWorker());
+}
+
+
+void QtTaskScheduler::enqueue(QtTask* task, int worker)
+{
+  WorkerQueues* queues = worker >= 0 ?
+    this->LocalQueues[worker] : &this->SharedQueues;
+  {
+  QMutexLocker locker(&queues->Mutex);
+  queues->Queues[task->priority()] << task;
+  this->PendingTasksByPriority[task->priority()].ref();
+  }
+  this->PendingTasks.ref();
+  // A worker counts itself idle before it checks PendingTasks, under the
+  // mutex held until it waits: either it sees the task or it is woken.
+  if (this->IdleWorkers > 0)
+    {
+    QMutexLocker locker(&this->Mutex);
+    this->WorkAvailable.wakeOne();
+    }
+}
+
+
+QtTask* QtTaskScheduler::takeTask(int worker, int maxPriority)
+{
+  const int workerCount = this->LocalQueues.size();
+  for (int p = 0; p <= maxPriority; ++p)
+    {
+    if (this->PendingTasksByPriority[p] <= 0)
+      {
+      continue;
+      }
+    QtTask* task = 0;
+    if (worker >= 0)
+      {
+      // Newest first: its data is most likely still in cache.
+      WorkerQueues* own = this->LocalQueues[worker];
+      QMutexLocker locker(&own->Mutex);
+      if (!own->Queues[p].isEmpty())
+        {
+        task = own->Queues[p].takeLast();
+        }
+      }
+    if (!task)
+      {
+      QMutexLocker locker(&this->SharedQueues.Mutex);
+      if (!this->SharedQueues.Queues[p].isEmpty())
+        {
+        task = this->SharedQueues.Queues[p].takeFirst();
+        }
+      }
+    for (int i = 1; !task && i <= workerCount; ++i)
+      {
+      const int victim = (qMax(worker, 0) + i) % workerCount;
+      if (victim == worker)
+        {
+        continue;
+        }
+      // Oldest first: it is the largest piece of work left.
+      WorkerQueues* other = this->LocalQueues[victim];
+      QMutexLocker locker(&other->Mutex);
+      if (!other->Queues[p].isEmpty())
+        {
+        task = other->Queues[p].takeFirst();
+        }
+      }
+    if (task)
+      {
+      this->PendingTasksByPriority[p].deref();
+      this->PendingTasks.deref();
+      return task;
+      }
+    }
+  return 0;
+}
+
+
+void QtTaskScheduler::runTask(QtTask* task)
+{
+  bool finished = true;
+  if (!task->isCanceled())
+    {
+    finished = task->run();
+    }
+  QtTaskGroup* group = task->Group;
+  if (!finished && !task->isCanceled())
+    {
+    // The task yielded, queue it again behind the urgent work.
+    this->enqueue(task, -1);
+    if (group)
+      {
+      QMutexLocker locker(&group->Mutex);
+      group->DoneCondition.wakeAll();
+      }
+    return;
+    }
+  // The group lists the task until then: QtTaskGroup::cancel() may still
+  // reach it.
+  const bool autoDelete = task->AutoDelete;
+  if (group)
+    {
+    group->taskFinished(task);
+    }
+  if (autoDelete)
+    {
+    delete task;
+    }
+}
+
+
+void QtTaskScheduler::workerLoop(int worker)
+{
+  this->WorkerIndex.setLocalData(new int(worker));
+  int affinityGeneration = -1;
+  forever
+    {
+    if (affinityGeneration != this->AffinityGeneration)
+      {
+      affinityGeneration = this->AffinityGeneration;
+      this->applyThreadAffinity();
+      }
+    if (worker >= this->ActiveWorkers)
+      {
+      QMutexLocker locker(&this->Mutex);
+      if (this->Stopping)
+        {
+        return;
+        }
+      if (worker >= this->ActiveWorkers)
+        {
+        // Pass on a wake up meant for an active worker.
+        if (this->PendingTasks > 0)
+          {
+          this->WorkAvailable.wakeOne();
+          }
+        this->Reactivated.wait(&this->Mutex);
+        }
+      continue;
+      }
+    if (worker == 0)
+      {
+      // The first worker is never parked, it samples the load.
+      this->updateAdaptiveThreadCount();
+      }
+    QtTask* task = this->takeTask(worker, QtTask::NumberOfPriorities - 1);
+    if (task)
+      {
+      this->runTask(task);
+      continue;
+      }
+    QMutexLocker locker(&this->Mutex);
+    if (this->Stopping)
+      {
+      return;
+      }
+    this->IdleWorkers.ref();
+    if (this->PendingTasks <= 0)
+      {
+      this->WorkAvailable.wait(&this->Mutex);
+      }
+    this->IdleWorkers.deref();
+    }
+}
@@ -0,0 +1,310 @@
+/*=========================================================================
+
+Library:   TubeTK
+
+Copyright 2010 Kitware Inc. 28 Corporate Drive,
+Clifton Park, NY, 12065, USA.
+
+All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+=========================================================================*/
+#ifndef __QtTaskScheduler_h
+#define __QtTaskScheduler_h
+
+// Qt includes
+#include <QAtomicInt>
+#include <QList>
+#include <QMutex>
+#include <QThreadStorage>
+#include <QTime>
+#include <QWaitCondition>
+#include <QtGlobal>
+
+// ImageViewer includes
+#include "QtImageViewer_Export.h"
+class QtTaskGroup;
+class QtTaskScheduler;
+class QtTaskWorker;
+
+/// Unit of work run by the QtTaskScheduler.
+/// Tasks are ordered by priority: a worker always picks the most urgent
+/// queued task. Long tasks should poll shouldYield() and return false from
+/// run() so that urgent work is not kept waiting; they are then queued
+/// again behind it. The region growing of QtRegionGrowing does so between
+/// its batches of spans, the analysis of QtOverlayAnalysis between slices.
+class QtImageViewer_EXPORT QtTask
+{
+public:
+  /// Priority classes, the most urgent first.
+  enum Priority
+    {
+    VisibleFrame = 0,
+    Refinement,
+    Prefetch,
+    Background
+    };
+  static const int NumberOfPriorities = 4;
+
+  QtTask(Priority priority = Background);
+  virtual ~QtTask();
+
+  Priority priority() const;
+
+  /// If true (default), the scheduler deletes the task once it is
+  /// finished or canceled.
+  bool autoDelete() const;
+  void setAutoDelete(bool autoDelete);
+
+  /// A canceled task that has not started is discarded. Running tasks can
+  /// poll isCanceled() to stop early.
+  void cancel();
+  bool isCanceled() const;
+
+  /// Do the work. Return true when the task is finished, false to be
+  /// queued again (e.g. when shouldYield() is true).
+  virtual bool run() = 0;
+
+protected:
+  /// Return true if more urgent tasks are waiting for a worker.
+  bool shouldYield() const;
+
+private:
+  friend class QtTaskScheduler;
+  friend class QtTaskGroup;
+  Priority     TaskPriority;
+  bool         AutoDelete;
+  QAtomicInt   Canceled;
+  QtTaskGroup* Group;
+
+  Q_DISABLE_COPY(QtTask);
+};
+
+/// Set of tasks that can be waited for.
+/// wait() runs queued tasks of the same or higher priority while waiting
+/// instead of blocking a worker thread, so tasks can wait for the tasks
+/// they spawn.
+class QtImageViewer_EXPORT QtTaskGroup
+{
+public:
+  QtTaskGroup();
+  /// Wait for the remaining tasks.
+  ~QtTaskGroup();
+
+  /// Submit a task to the shared scheduler as part of this group.
+  void run(QtTask* task);
+
+  /// Block until all the tasks of the group are finished or canceled.
+  void wait();
+
+  /// Cancel the tasks of the group that have not started yet.
+  void cancel();
+
+  bool isDone() const;
+
+protected:
+  friend class QtTaskScheduler;
+  void taskFinished(QtTask* task);
+
+  mutable QMutex   Mutex;
+  QWaitCondition   DoneCondition;
+  int              PendingTasks;
+  int              MostUrgentPriority;
+  QList<QtTask*>   Tasks;
+
+private:
+  Q_DISABLE_COPY(QtTaskGroup);
+};
+
+/// QtTaskScheduler is the work-stealing thread pool shared by all the
+/// QtGlSliceView instances of the process. It runs the rendering, the
+/// precomputations and any other background work so that the GUI thread
+/// never blocks.
+/// Each worker owns one deque per priority: tasks spawned from a worker are
+/// pushed on its own deque and popped in LIFO order, tasks submitted from
+/// other threads go into a shared queue, and idle workers steal the oldest
+/// tasks of the other workers. A more urgent task is always taken before a
+/// less urgent one, wherever it is queued.
+/// Only threadCount() workers run tasks; they are started on demand and
+/// the others are parked.
+class QtImageViewer_EXPORT QtTaskScheduler
+{
+public:
+  QtTaskScheduler();
+  ~QtTaskScheduler();
+
+  /// Return the scheduler shared by the process.
+  static QtTaskScheduler* instance();
+
+  /// Queue a task. The scheduler takes ownership of auto-delete tasks.
+  void submit(QtTask* task);
+
+  /// Number of worker threads allowed to run tasks.
+  int threadCount() const;
+
+  /// Cap the number of worker threads, 0 (default) for one per core.
+  /// \sa setAdaptiveThreadCount()
+  void setMaximumThreadCount(int count);
+  int maximumThreadCount() const;
+
+  /// Number of workers allowed by the maximum thread count and the
+  /// affinity, before any adaptation to the load.
+  int threadLimit() const;
+
+  /// If true, the number of workers running tasks follows the load of the
+  /// machine, up to the maximum thread count: the cores busy with other
+  /// processes are left to them. Only supported on Unix.
+  void setAdaptiveThreadCount(bool adaptive);
+  bool adaptiveThreadCount() const;
+
+  /// Restrict the workers, and the calling thread, to the given cores.
+  /// Threads started afterwards by the calling thread inherit it. An empty
+  /// list removes the restriction. Only supported on Linux.
+  void setThreadAffinity(const QList<int>& cpus);
+  QList<int> threadAffinity() const;
+
+  /// Return true if a task more urgent than priority is queued.
+  bool hasPendingTasks(QtTask::Priority priority) const;
+
+  /// Number of workers waiting for a task.
+  int idleThreadCount() const;
+
+  /// Call functor(rangeBegin, rangeEnd) on subranges of [begin, end) in
+  /// parallel, each at least grain long, and return when all are done.
+  /// The calling thread processes the first subrange.
+  template <class TFunctor>
+  void parallelFor(int begin, int end, int grain,
+                   QtTask::Priority priority, TFunctor& functor);
+
+protected:
+  friend class QtTaskWorker;
+  friend class QtTaskGroup;
+
+  typedef QList<QtTask*> TaskQueueType;
+
+  struct WorkerQueues
+    {
+    QMutex        Mutex;
+    TaskQueueType Queues[QtTask::NumberOfPriorities];
+    };
+
+  /// Start the workers allowed to run and not started yet.
+  void startWorkers();
+
+  /// Change the number of workers allowed to run tasks.
+  void setActiveThreadCount(int count);
+
+  /// Adapt the number of active workers to the load average.
+  void updateAdaptiveThreadCount();
+
+  /// Bind the calling thread to the cores of the affinity.
+  void applyThreadAffinity();
+
+  /// Return the index of the worker running the current thread, -1 if the
+  /// current thread is not a worker. It does not lock.
+  int currentWorker() const;
+
+  /// Pop the most urgent task not less urgent than maxPriority: from the
+  /// deque of the worker first, then from the shared queue, then by
+  /// stealing from the other workers. Return 0 if there is none.
+  QtTask* takeTask(int worker, int maxPriority);
+
+  /// Run a task taken from a queue and requeue or release it.
+  void runTask(QtTask* task);
+
+  /// Push a task on the queue of worker (the shared queue if -1).
+  void enqueue(QtTask* task, int worker);
+
+  /// Main loop of the worker threads.
+  void workerLoop(int worker);
+
+  mutable QMutex          Mutex;
+  QWaitCondition          WorkAvailable;
+  QWaitCondition          Reactivated;
+  bool                    Stopping;
+  int                     MaximumThreads;
+  bool                    Adaptive;
+  QList<int>              Affinity;
+  QAtomicInt              AffinityGeneration;
+  QTime                   LastLoadUpdate;
+  QAtomicInt              ActiveWorkers;
+  QAtomicInt              PendingTasks;
+  QAtomicInt              IdleWorkers;
+  QAtomicInt              StartedWorkers;
+  QAtomicInt              PendingTasksByPriority[QtTask::NumberOfPriorities];
+  WorkerQueues            SharedQueues;
+  QList<WorkerQueues*>    LocalQueues;
+  QList<QtTaskWorker*>    Workers;
+  /// Index of the worker of the current thread, unset out of the workers.
+  QThreadStorage<int*>    WorkerIndex;
+
+private:
+  Q_DISABLE_COPY(QtTaskScheduler);
+};
+
+/// Task processing one subrange of QtTaskScheduler::parallelFor().
+template <class TFunctor>
+class QtRangeTask : public QtTask
+{
+public:
+  QtRangeTask(TFunctor& functor, int begin, int end, Priority priority)
+    : QtTask(priority)
+    , Functor(functor)
+    , Begin(begin)
+    , End(end)
+    {
+    }
+  virtual bool run()
+    {
+    this->Functor(this->Begin, this->End);
+    return true;
+    }
+protected:
+  TFunctor& Functor;
+  int Begin;
+  int End;
+};
+
+
+template <class TFunctor>
+void QtTaskScheduler::parallelFor(int begin, int end, int grain,
+                                  QtTask::Priority priority,
+                                  TFunctor& functor)
+{
+  if (end <= begin)
+    {
+    return;
+    }
+  grain = qMax(grain, 1);
+  // A few subranges per worker so that stealing can balance uneven rows.
+  const int maxChunks = qMax(1, 4 * this->threadCount());
+  const int chunks = qBound(1, (end - begin) / grain, maxChunks);
+  if (chunks == 1)
+    {
+    functor(begin, end);
+    return;
+    }
+  const int chunkSize = (end - begin + chunks - 1) / chunks;
+  QtTaskGroup group;
+  for (int chunkBegin = begin + chunkSize; chunkBegin < end;
+       chunkBegin += chunkSize)
+    {
+    group.run(new QtRangeTask<TFunctor>(
+      functor, chunkBegin, qMin(chunkBegin + chunkSize, end), priority));
+    }
+  functor(begin, qMin(begin + chunkSize, end));
+  group.wait();
+}
+
+#endif